@@ -0,0 +1,260 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <forth/resources.h>
+#include <stack_machine/common.h>
+#include <stack_machine/context.h>
+#include <stack_machine/compiler.h>
+#include <stack_machine/entry.h>
+#include <stack_machine/interpreter.h>
+#include <stack_machine/repl.h>
+#include <collections/hashtable.h>
+
+/*
+ * Microbenchmarks for the interpreter's hot paths, run as a host process.
+ * Each benchmark runs once to warm up, then is timed over a number of
+ * repetitions of a fixed number of iterations; the minimum, median and
+ * maximum time per operation are written to stdout as JSON.
+ */
+
+#define REPETITIONS 11
+
+typedef struct {
+    char *name;
+    int iterations;             // calls to fn per repetition
+    int ops;                    // operations each call performs
+    void (*fn)(void);
+} bench_t;
+
+static context_t *ctx;
+static char **words;
+static entry_t **entries;
+static int num_words;
+static hashtable_t table;
+
+static char *misses[] = { "NO-SUCH-WORD", "XYZZY", "PLUGH", "DUPP", "2SWAPPED", "+LOOPY", "ROT3", "Q" };
+static char *numbers[] = { "0", "42", "-17", "12345678", "$7FFF", "%1010", "'x'", "2147483647" };
+
+#define NUM_MISSES (int)(sizeof(misses) / sizeof(misses[0]))
+#define NUM_NUMBERS (int)(sizeof(numbers) / sizeof(numbers[0]))
+#define STACK_OPS 64
+
+static void interpret_literals(void)
+{
+    interpret(ctx, "1 2 3 DROP DROP DROP");
+}
+
+static void interpret_arithmetic(void)
+{
+    interpret(ctx, "1 2 + 3 * 4 - DROP");
+}
+
+static void interpret_colon(void)
+{
+    interpret(ctx, "3 4 BENCH-POLY DROP");
+}
+
+static void find_entry_hit(void)
+{
+    entry_t *entry;
+    for (int i = 0; i < num_words; i++)
+        find_entry(ctx->exe_tok, words[i], &entry);
+}
+
+static void find_entry_miss(void)
+{
+    entry_t *entry;
+    for (int i = 0; i < NUM_MISSES; i++)
+        find_entry(ctx->exe_tok, misses[i], &entry);
+}
+
+static void hashtable_fill(hashtable_t *htbl)
+{
+    for (int i = 0; i < num_words; i++)
+        hashtable_insert(htbl, entries[i]);
+}
+
+static void hashtable_insert_all(void)
+{
+    hashtable_t htbl;
+    hashtable_init(&htbl, BUCKETS, entry_hash, entry_match, NULL);
+    hashtable_fill(&htbl);
+    hashtable_destroy(&htbl);
+}
+
+static void hashtable_lookup_all(void)
+{
+    for (int i = 0; i < num_words; i++)
+    {
+        void *data = entries[i];
+        hashtable_lookup(&table, &data);
+    }
+}
+
+static void hashtable_insert_remove_all(void)
+{
+    hashtable_t htbl;
+    hashtable_init(&htbl, BUCKETS, entry_hash, entry_match, NULL);
+    hashtable_fill(&htbl);
+
+    for (int i = 0; i < num_words; i++)
+    {
+        void *data = entries[i];
+        hashtable_remove(&htbl, &data);
+    }
+    hashtable_destroy(&htbl);
+}
+
+static void push_pop(void)
+{
+    int num;
+    for (int i = 0; i < STACK_OPS; i++)
+        pushnum(ctx, i);
+
+    for (int i = 0; i < STACK_OPS; i++)
+        popnum(ctx, &num);
+}
+
+static void parse_numbers(void)
+{
+    int num;
+    for (int i = 0; i < NUM_NUMBERS; i++)
+        parsenum(numbers[i], strlen(numbers[i]), &num, ctx->base);
+}
+
+/**
+ * Bootstraps system.fth into a fresh context each time. The JIT arena is
+ * shared by every context and never reclaimed, so these run threaded.
+ */
+static void load_system(void)
+{
+    context_t *fresh = create_context();
+    fresh->jit = 0;
+    load(fresh, "system.fth", (char *)&system_forth);
+
+    // The stacks are aligned within their blocks, and so are not freed;
+    // nor are the headers, which are allocated in chunks
+    hashtable_destroy(fresh->exe_tok);
+    free(fresh->exe_tok);
+    free(fresh->tib->buffer);
+    free(fresh->tib);
+    free(fresh->mem);
+    free(fresh);
+}
+
+static long long now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void run(bench_t *bench, int repetitions, int first)
+{
+    double *ns = malloc(repetitions * sizeof(double));
+
+    for (int i = 0; i < bench->iterations; i++)
+        bench->fn();
+
+    for (int r = 0; r < repetitions; r++)
+    {
+        long long start = now();
+        for (int i = 0; i < bench->iterations; i++)
+            bench->fn();
+
+        ns[r] = (double)(now() - start) / ((double)bench->iterations * bench->ops);
+    }
+
+    qsort(ns, repetitions, sizeof(double), compare_double);
+    printf("%s    {\"name\": \"%s\", \"iterations\": %d, \"ops\": %d, \"repetitions\": %d, "
+           "\"min_ns\": %.2f, \"median_ns\": %.2f, \"max_ns\": %.2f}",
+           first ? "" : ",\n",
+           bench->name, bench->iterations, bench->ops, repetitions,
+           ns[0], ns[repetitions / 2], ns[repetitions - 1]);
+
+    free(ns);
+}
+
+static void usage(char *prog)
+{
+    fprintf(stderr, "usage: %s [-r repetitions] [-f filter]\n", prog);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    int repetitions = REPETITIONS;
+    char *filter = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:f:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'r': repetitions = atoi(optarg); break;
+            case 'f': filter = optarg; break;
+            default: usage(argv[0]);
+        }
+    }
+
+    if (repetitions < 1)
+        usage(argv[0]);
+
+    ctx = init_context();
+    interpret(ctx, ": BENCH-POLY ( a b -- n ) OVER * SWAP 2* + ;");
+    if (ctx->state == ERROR)
+        return 1;
+
+    words = get_words(ctx->exe_tok);
+    num_words = hashtable_size(ctx->exe_tok);
+    entries = malloc(num_words * sizeof(entry_t *));
+    for (int i = 0; i < num_words; i++)
+        find_entry(ctx->exe_tok, words[i], &entries[i]);
+
+    hashtable_init(&table, BUCKETS, entry_hash, entry_match, NULL);
+    hashtable_fill(&table);
+
+    bench_t benches[] = {
+        { "interpret/literals",       100000, 1,          interpret_literals },
+        { "interpret/arithmetic",     100000, 1,          interpret_arithmetic },
+        { "interpret/colon",          100000, 1,          interpret_colon },
+        { "find_entry/hit",           1000,   num_words,  find_entry_hit },
+        { "find_entry/miss",          10000,  NUM_MISSES, find_entry_miss },
+        { "hashtable/insert",         1000,   num_words,  hashtable_insert_all },
+        { "hashtable/lookup",         1000,   num_words,  hashtable_lookup_all },
+        { "hashtable/insert+remove",  1000,   2 * num_words, hashtable_insert_remove_all },
+        { "stack/pushnum+popnum",     10000,  2 * STACK_OPS, push_pop },
+        { "parsenum",                 10000,  NUM_NUMBERS, parse_numbers },
+        { "load/system.fth",          10,     1,          load_system },
+    };
+
+    printf("{\n  \"benchmarks\": [\n");
+
+    int first = 1;
+    for (unsigned i = 0; i < sizeof(benches) / sizeof(benches[0]); i++)
+    {
+        if (filter != NULL && strstr(benches[i].name, filter) == NULL)
+            continue;
+
+        run(&benches[i], repetitions, first);
+        fflush(stdout);
+        first = 0;
+    }
+
+    printf("\n  ]\n}\n");
+
+    hashtable_destroy(&table);
+    free(entries);
+    free(words);
+    return 0;
+}
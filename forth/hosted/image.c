@@ -0,0 +1,289 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <stack_machine/common.h>
+#include <stack_machine/context.h>
+#include <stack_machine/entry.h>
+#include <stack_machine/image.h>
+#include <stack_machine/repl.h>
+#include <stack_machine/vm.h>
+#include <collections/hashtable.h>
+
+/*
+ * Writes the dictionary image (see image.h) that init_context loads in
+ * place of the bootstrap sources.
+ *
+ * The sources are loaded into two contexts, which sit at different
+ * addresses. A cell that differs between them is an address, and is
+ * stored relative to whichever of the first context's dictionary, context,
+ * input buffer or entries it points into; the second context must agree,
+ * or the image can't be made. A cell that is the same in both is a number,
+ * unless it is an opcode's code address, or points into this program, in
+ * which case the image can't be made either.
+ */
+
+extern char __executable_start[], _end[];
+
+typedef struct {
+    context_t *ctx;
+    entry_t **entries;          // in the same order for both
+} run_t;
+
+static run_t a, b;
+static context_t *pristine;     // only the primitives
+static int num_entries;
+
+static char *strings;
+static int strings_size;
+
+static void fail(char *what, int offset, int value)
+{
+    fprintf(stderr, "forth-image: can't relocate %s at offset %d: 0x%x\n", what, offset, value);
+    exit(1);
+}
+
+static int add_string(char *s)
+{
+    int len = strlen(s) + 1;
+    strings = realloc(strings, strings_size + len);
+    memcpy(strings + strings_size, s, len);
+    strings_size += len;
+    return strings_size - len;
+}
+
+static int within(int addr, void *start, int size)
+{
+    return addr >= (int)start && addr <= (int)start + size;
+}
+
+/**
+ * Classifies the value x, which is y in the second context, returning the
+ * reference to store it as and setting its addend.
+ */
+static image_ref_t classify(int x, int y, int *addend, char *what, int offset)
+{
+    image_ref_t ref = { IMAGE_ABS, 0 };
+    *addend = x;
+
+    if (x == y)
+    {
+        int op = vm_opcode((word_t)x);
+        if (op >= 0)
+        {
+            ref.kind = IMAGE_OPCODE;
+            *addend = op;
+        }
+        else if (within(x, __executable_start, _end - __executable_start))
+        {
+            fail(what, offset, x);
+        }
+        return ref;
+    }
+
+    if (within(x, a.ctx->mem, (byte_t *)a.ctx->mem_end - (byte_t *)a.ctx->mem))
+    {
+        ref.kind = IMAGE_MEM;
+        *addend = x - (int)a.ctx->mem;
+        if (y - (int)b.ctx->mem != *addend)
+            fail(what, offset, x);
+    }
+    else if (within(x, a.ctx, sizeof(context_t) - 1))
+    {
+        ref.kind = IMAGE_CTX;
+        *addend = x - (int)a.ctx;
+        if (y - (int)b.ctx != *addend)
+            fail(what, offset, x);
+    }
+    else if (within(x, a.ctx->tib->buffer, READLINE_BUFSIZ))
+    {
+        ref.kind = IMAGE_TIB;
+        *addend = x - (int)a.ctx->tib->buffer;
+        if (y - (int)b.ctx->tib->buffer != *addend)
+            fail(what, offset, x);
+    }
+    else
+    {
+        for (int i = 0; i < num_entries; i++)
+        {
+            if (within(x, a.entries[i], sizeof(entry_t) - 1))
+            {
+                ref.kind = IMAGE_ENTRY;
+                ref.target = i;
+                *addend = x - (int)a.entries[i];
+                if (y - (int)b.entries[i] != *addend)
+                    fail(what, offset, x);
+                return ref;
+            }
+        }
+        fail(what, offset, x);
+    }
+    return ref;
+}
+
+static image_ref_t code_ref(entry_t *entry)
+{
+    image_ref_t ref = { IMAGE_ABS, 0 };
+    if (entry->code_ptr == __EXEC)
+    {
+        ref.kind = IMAGE_EXEC;
+    }
+    else if (entry->code_ptr == __REF)
+    {
+        ref.kind = IMAGE_REF;
+    }
+    else
+    {
+        // The code of a primitive, which create_context gives some name
+        for (int i = 0; i < pristine->exe_tok->capacity; i++)
+        {
+            entry_t *prim = hashtable_occupied(pristine->exe_tok, i) ? hashtable_data(pristine->exe_tok, i) : NULL;
+            if (prim != NULL && prim->code_ptr == entry->code_ptr)
+            {
+                ref.kind = IMAGE_PRIM;
+                ref.target = add_string(prim->name);
+                return ref;
+            }
+        }
+        fprintf(stderr, "forth-image: no primitive has the code of %s\n", entry->name);
+        exit(1);
+    }
+    return ref;
+}
+
+static int string_ref(char *s, char *original)
+{
+    if (s == NULL)
+        return IMAGE_NONE;
+    return s == original ? IMAGE_KEEP : add_string(s);
+}
+
+static context_t *load_sources(void)
+{
+    context_t *ctx = create_context();
+    ctx->jit = 0;
+    bootstrap(ctx);
+
+    if (ctx->state == ERROR || ctx->sp != ctx->ds)
+    {
+        fprintf(stderr, "forth-image: the sources did not load cleanly\n");
+        exit(1);
+    }
+    return ctx;
+}
+
+static void write_all(FILE *fp, void *data, int size)
+{
+    if (size > 0 && fwrite(data, size, 1, fp) != 1)
+    {
+        perror("forth-image");
+        exit(1);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "usage: %s image\n", argv[0]);
+        return 2;
+    }
+
+    pristine = create_context();
+    a.ctx = load_sources();
+    b.ctx = load_sources();
+
+    // Pair up the entries by name
+    hashtable_t *htbl = a.ctx->exe_tok;
+    num_entries = hashtable_size(htbl);
+    a.entries = malloc(num_entries * sizeof(entry_t *));
+    b.entries = malloc(num_entries * sizeof(entry_t *));
+
+    for (int i = 0, n = 0; i < htbl->capacity; i++)
+    {
+        if (!hashtable_occupied(htbl, i))
+            continue;
+
+        a.entries[n] = hashtable_data(htbl, i);
+        if (find_entry(b.ctx->exe_tok, a.entries[n]->name, &b.entries[n]) != 0)
+            fail(a.entries[n]->name, 0, 0);
+        n++;
+    }
+
+    int mem_size = (byte_t *)a.ctx->dp - (byte_t *)a.ctx->mem;
+    int cells = align(mem_size) / sizeof(word_t);
+
+    image_reloc_t *relocs = malloc(cells * sizeof(image_reloc_t));
+    word_t *mem = calloc(1, cells * sizeof(word_t));
+    int num_relocs = 0;
+
+    memcpy(mem, a.ctx->mem, mem_size);
+    for (int i = 0; i < cells; i++)
+    {
+        int addend;
+        image_ref_t ref = classify(mem[i].val, b.ctx->mem[i].val, &addend, "dictionary cell", i * sizeof(word_t));
+        if (ref.kind != IMAGE_ABS)
+        {
+            relocs[num_relocs].offset = i * sizeof(word_t);
+            relocs[num_relocs].ref = ref;
+            num_relocs++;
+            mem[i].val = addend;
+        }
+    }
+
+    image_entry_t *entries = calloc(1, num_entries * sizeof(image_entry_t));
+    for (int i = 0; i < num_entries; i++)
+    {
+        entry_t *entry = a.entries[i];
+        entry_info_t *info = entry_info(entry);
+        entry_t *original = NULL;
+        find_entry(pristine->exe_tok, entry->name, &original);
+
+        entries[i].name = add_string(entry->name);
+        entries[i].stack_effect = string_ref(info->stack_effect, original ? entry_info(original)->stack_effect : NULL);
+        entries[i].docstring = string_ref(info->docstring, original ? entry_info(original)->docstring : NULL);
+        entries[i].flags = entry->flags;
+        entries[i].code = code_ref(entry);
+        entries[i].param = classify(entry->param.val, b.entries[i]->param.val, &entries[i].addend, entry->name, 0);
+        entries[i].alloc_size = info->alloc_size;
+    }
+
+    image_header_t header = {
+        .magic = IMAGE_MAGIC,
+        .num_opcodes = NUM_OPCODES,
+        .context_size = sizeof(context_t),
+        .mem_size = mem_size,
+        .num_relocs = num_relocs,
+        .num_entries = num_entries,
+        .strings_size = strings_size,
+        .last_word = -1,
+        .sticky_flags = a.ctx->sticky_flags,
+        .base = a.ctx->base,
+        .echo = a.ctx->echo,
+        .fold = a.ctx->fold,
+    };
+
+    for (int i = 0; i < num_entries; i++)
+    {
+        if (a.entries[i] == a.ctx->last_word)
+            header.last_word = i;
+    }
+
+    FILE *fp = fopen(argv[1], "wb");
+    if (fp == NULL)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    write_all(fp, &header, sizeof(header));
+    write_all(fp, mem, cells * sizeof(word_t));
+    write_all(fp, relocs, num_relocs * sizeof(image_reloc_t));
+    write_all(fp, entries, num_entries * sizeof(image_entry_t));
+    write_all(fp, strings, strings_size);
+    fclose(fp);
+
+    printf("forth-image: %d bytes of dictionary, %d relocations, %d entries\n",
+           mem_size, num_relocs, num_entries);
+    return 0;
+}
@@ -0,0 +1,11 @@
+#ifndef _HOSTED_STDIO_H
+#define _HOSTED_STDIO_H 1
+
+#include_next <stdio.h>
+
+// The keyboard driver's getchar and the hex dump helper write clash with
+// the host's, so rename them for the kernel headers and sources
+#define getchar kb_getchar
+#define write dump_write
+
+#endif
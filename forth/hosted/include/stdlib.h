@@ -0,0 +1,53 @@
+#ifndef _HOSTED_STDLIB_H
+#define _HOSTED_STDLIB_H 1
+
+/*
+ * Hosted builds compile against the host C library: these headers sit in
+ * front of it on the include path, and add what the kernel's libc has
+ * beyond the standard.
+ */
+#include_next <stdlib.h>
+#include <assert.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern char* itoa(int value, char *str, int base);
+
+// The kernel allocator's counters and trace: the host's allocator keeps
+// neither, so the hosted build reports nothing
+typedef struct {
+    unsigned int allocs;
+    unsigned int frees;
+    unsigned int live;
+    unsigned int peak;
+    unsigned int heap;
+    unsigned int free_runs;
+    unsigned int largest_free;
+    unsigned int untraced;
+} heap_stats_t;
+
+typedef struct {
+    void *site;
+    unsigned int allocs;
+    unsigned int live;
+    unsigned int live_bytes;
+} heap_site_t;
+
+#define HEAP_TRACE_SLOTS 2048
+#define HEAP_TRACE_SITES 64
+
+extern void heap_stats(heap_stats_t *stats);
+extern void heap_trace(int on);
+extern unsigned int heap_mark(void);
+extern int heap_sites(heap_site_t *sites, int n, unsigned int since);
+
+#define min(a,b) (a < b ? a : b)
+#define max(a,b) (a > b ? a : b)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef _HOSTED_STRING_H
+#define _HOSTED_STRING_H 1
+
+#include_next <string.h>
+#include <ctype.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern char *strtoupper(char*);
+extern char *trim(char*);
+extern char *rtrim(char*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
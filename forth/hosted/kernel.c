@@ -0,0 +1,139 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <kernel/system.h>
+#include <kernel/tty.h>
+#include <kernel/kb.h>
+#include <kernel/readline.h>
+
+/*
+ * Stand-ins for the kernel services libforth calls, so that it can run as
+ * an ordinary process: the terminal writes to stdout, the keyboard and
+ * readline read from stdin, and the timer is never reprogrammed.
+ */
+
+extern char __bss_start[], _end[];
+
+/**
+ * The JIT writes its code into an arena in .bss, which the kernel maps
+ * executable but a host process does not.
+ */
+__attribute__((constructor))
+static void hosted_init(void)
+{
+    unsigned long page = 4096;
+    unsigned long start = (unsigned long)__bss_start & ~(page - 1);
+    unsigned long end = ((unsigned long)_end + page - 1) & ~(page - 1);
+
+    if (mprotect((void *)start, end - start, PROT_READ | PROT_WRITE | PROT_EXEC) != 0)
+    {
+        perror("mprotect");
+        exit(1);
+    }
+}
+
+void terminal_initialize(void) {}
+void terminal_setcolor(uint8_t color) { (void)color; }
+void terminal_putchar(char c) { putchar(c); }
+void terminal_write(const char* data, size_t size) { fwrite(data, 1, size, stdout); }
+void terminal_writestring(const char* data) { fputs(data, stdout); }
+void terminal_colorstring(const char *data, colorize_t *colorizer) { (void)colorizer; fputs(data, stdout); }
+void terminal_clear(void) {}
+void terminal_clear_eol(void) {}
+void terminal_scroll(void) {}
+void terminal_flush(void) { fflush(stdout); }
+
+void terminal_setcursor(position_t *position) { (void)position; }
+void terminal_getcursor(position_t *position) { position->row = position->column = 0; }
+void terminal_cursormode(uint8_t start, uint8_t end) { (void)start; (void)end; }
+void terminal_decrementcursor(position_t *position) { (void)position; }
+uint16_t terminal_incrementcursor(position_t *position) { (void)position; return 0; }
+
+void terminal_save(screen_t *screen) { (void)screen; }
+void terminal_restore(screen_t *screen) { (void)screen; }
+
+int pager(char **text)
+{
+    for (char **line = text; *line != NULL; line++)
+        puts(*line);
+
+    return 0;
+}
+
+void keyboard_clear_buffer() {}
+
+char getch_ext(input_t *input)
+{
+    memset(input, 0, sizeof(input_t));
+    input->keycode = fgetc(stdin);
+    return input->keycode;
+}
+
+char getchar_ext(input_t *input)
+{
+    return getch_ext(input);
+}
+
+char getch()
+{
+    input_t inp;
+    return getch_ext(&inp);
+}
+
+char getchar()
+{
+    input_t inp;
+    return getchar_ext(&inp);
+}
+
+void rl_yank(char *yank[], char *text, int len, int sz) { (void)yank; (void)text; (void)len; (void)sz; }
+uint16_t rl_prev_word(char *buf, uint16_t index) { (void)buf; return index; }
+uint16_t rl_next_word(char *buf, uint16_t index) { (void)buf; return index; }
+uint16_t rl_token_start(char *buf, uint16_t index) { (void)buf; return index; }
+uint16_t rl_token_end(char *buf, uint16_t index, uint16_t sz) { (void)buf; (void)sz; return index; }
+
+/**
+ * Reads a line from stdin, without its newline; the process exits at the
+ * end of input.
+ */
+char *readline(char *buf, uint16_t sz, char **history, complete_t *completer, colorize_t *colorizer)
+{
+    (void)history;
+    (void)completer;
+    (void)colorizer;
+
+    fflush(stdout);
+    if (fgets(buf, sz, stdin) == NULL)
+        exit(0);
+
+    buf[strcspn(buf, "\n")] = '\0';
+    return buf;
+}
+
+void heap_stats(heap_stats_t *stats) { memset(stats, 0, sizeof(heap_stats_t)); }
+void heap_trace(int on) { (void)on; }
+unsigned int heap_mark(void) { return 0; }
+int heap_sites(heap_site_t *sites, int n, unsigned int since) { (void)sites; (void)n; (void)since; return 0; }
+
+/**
+ * The dictionary is given its smallest size: the host's memory has no
+ * sbrk arena to take a share of.
+ */
+unsigned int sbrk_available(void) { return 0; }
+
+void shutdown(int status) { fflush(stdout); exit(status); }
+
+void timer_phase(int hz) { (void)hz; }
+void timer_set_sampler(void (*sampler)(registers_t *r)) { (void)sampler; }
+
+/**
+ * A process's faults are signals, which nothing catches: a guard page
+ * still stops a runaway stack, but ends the process.
+ */
+void fault_set_handler(void (*handler)(registers_t *r, void *address)) { (void)handler; }
+int mmu_guard(void *addr)
+{
+    return mprotect((void *)((unsigned long)addr & ~4095ul), 4096, PROT_NONE);
+}
@@ -2,19 +2,41 @@
 #define HASHTABLE_H
 
 #include <stdlib.h>
-#include <collections/list.h>
 
 #define abs(x) (x < 0 ? -x : x)
 
+/**
+ * Open addressing hash table, using Robin Hood linear probing: an insert
+ * displaces any resident that sits closer to its home slot than the new
+ * element would, which keeps probe sequences short and lets lookups stop
+ * early. Deletion shifts the following run back a slot, so there are no
+ * tombstones. The full hash is stored alongside each element, so probing
+ * only calls match() when the hashes agree.
+ */
 typedef struct {
-    int buckets;
+    unsigned int hash;          // 0 marks an empty slot
+    void *data;
+} hashtable_slot_t;
+
+typedef struct {
+    int capacity;               // always a power of two
     int (*hash)(const void *key);
     int (*match)(const void *key1, const void *key2);
     void (*destroy)(void *data);
     int size;
-    list_t *table;
+    hashtable_slot_t *table;
 } hashtable_t;
 
+#define HASHTABLE_HISTOGRAM 8
+
+typedef struct {
+    int size;
+    int capacity;
+    int max_probe;
+    int total_probe;
+    int histogram[HASHTABLE_HISTOGRAM];   // probe lengths, the last bucket is 'or longer'
+} hashtable_stats_t;
+
 extern int hashfn(const void *key);
 
 extern int hashtable_init(hashtable_t *htbl,
@@ -27,7 +49,12 @@ extern void hashtable_destroy(hashtable_t *htbl);
 extern int hashtable_insert(hashtable_t *htbl, const void *data);
 extern int hashtable_remove(hashtable_t *htbl, void **data);
 extern int hashtable_lookup(const hashtable_t *htbl, void **data);
+extern void hashtable_stats(const hashtable_t *htbl, hashtable_stats_t *stats);
 
 #define hashtable_size(htbl) ((htbl)->size)
 
+// Iterate over the occupied slots: for (i = 0; i < capacity; i++) if (hashtable_occupied(htbl, i)) ...
+#define hashtable_occupied(htbl, i) ((htbl)->table[i].hash != 0)
+#define hashtable_data(htbl, i) ((htbl)->table[i].data)
+
 #endif
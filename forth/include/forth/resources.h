@@ -4,6 +4,8 @@
 extern int system_forth;
 extern int examples_forth;
 extern int mandlebrot_forth;
+extern int bench_forth;
 extern int resource_size;
+extern int dictionary_image;
 
 #endif
\ No newline at end of file
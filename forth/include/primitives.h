@@ -4,85 +4,64 @@
 #include <collections/hashtable.h>
 #include <stack_machine/context.h>
 
+/**
+ * Each writes its result over the deepest cell it takes, so a data stack
+ * underflow page faults on the guard page below the stack (see common.h).
+ * Division by zero traps too: neither needs a check here.
+ */
 
 #define arity1stackop(name, op)                            \
     state_t name(context_t *ctx)                           \
     {                                                      \
-        int x1;                                            \
-        if (popnum(ctx->ds, &x1))                          \
-        {                                                  \
-            pushnum(ctx->ds, op);                          \
-            return OK;                                     \
-        }                                                  \
-        else                                               \
-        {                                                  \
-            return stack_underflow(ctx);                   \
-        }                                                  \
+        int x1 = ctx->sp[-1];                              \
+        ctx->sp[-1] = op;                                  \
+        return OK;                                         \
     }
 
 
 #define arity2stackop(name, op)                            \
     state_t name(context_t *ctx)                           \
     {                                                      \
-        int x1, x2;                                        \
-        if (popnum(ctx->ds, &x2) && popnum(ctx->ds, &x1))  \
-        {                                                  \
-            pushnum(ctx->ds, op);                          \
-            return OK;                                     \
-        }                                                  \
-        else                                               \
-        {                                                  \
-            return stack_underflow(ctx);                   \
-        }                                                  \
+        int x1 = ctx->sp[-2];                              \
+        int x2 = ctx->sp[-1];                              \
+        ctx->sp[-2] = op;                                  \
+        ctx->sp--;                                         \
+        return OK;                                         \
     }
 
 
 #define arity2stackop2(name, op1, op2)                     \
     state_t name(context_t *ctx)                           \
     {                                                      \
-        int x1, x2;                                        \
-        if (popnum(ctx->ds, &x2) && popnum(ctx->ds, &x1))  \
-        {                                                  \
-            pushnum(ctx->ds, op1);                         \
-            pushnum(ctx->ds, op2);                         \
-            return OK;                                     \
-        }                                                  \
-        else                                               \
-        {                                                  \
-            return stack_underflow(ctx);                   \
-        }                                                  \
+        int x1 = ctx->sp[-2];                              \
+        int x2 = ctx->sp[-1];                              \
+        ctx->sp[-2] = op1;                                 \
+        ctx->sp[-1] = op2;                                 \
+        return OK;                                         \
     }
 
 
 #define arity3stackop(name, op)                            \
     state_t name(context_t *ctx)                           \
     {                                                      \
-        int x1, x2, x3;                                    \
-        if (popnum(ctx->ds, &x3) && popnum(ctx->ds, &x2) && popnum(ctx->ds, &x1))  \
-        {                                                  \
-            pushnum(ctx->ds, op);                          \
-            return OK;                                     \
-        }                                                  \
-        else                                               \
-        {                                                  \
-            return stack_underflow(ctx);                   \
-        }                                                  \
+        int x1 = ctx->sp[-3];                              \
+        int x2 = ctx->sp[-2];                              \
+        int x3 = ctx->sp[-1];                              \
+        ctx->sp[-3] = op;                                  \
+        ctx->sp -= 2;                                      \
+        return OK;                                         \
     }
 
 #define arity3stackop2(name, op1, op2)                     \
     state_t name(context_t *ctx)                           \
     {                                                      \
-        int x1, x2, x3;                                    \
-        if (popnum(ctx->ds, &x3) && popnum(ctx->ds, &x2) && popnum(ctx->ds, &x1))  \
-        {                                                  \
-            pushnum(ctx->ds, op1);                         \
-            pushnum(ctx->ds, op2);                         \
-            return OK;                                     \
-        }                                                  \
-        else                                               \
-        {                                                  \
-            return stack_underflow(ctx);                   \
-        }                                                  \
+        int x1 = ctx->sp[-3];                              \
+        int x2 = ctx->sp[-2];                              \
+        int x3 = ctx->sp[-1];                              \
+        ctx->sp[-3] = op1;                                 \
+        ctx->sp[-2] = op2;                                 \
+        ctx->sp--;                                         \
+        return OK;                                         \
     }
 
 
@@ -1,8 +1,6 @@
 #ifndef _COMMON_H
 #define _COMMON_H 1
 
-#include <collections/stack.h>
-
 #include <stack_machine/context.h>
 
 #define DELIMITERS " \t\n"
@@ -10,19 +8,66 @@
 #define BUCKETS 256
 #define READLINE_BUFSIZ 256
 #define READLINE_HISTSIZ 100
-#define MEMSIZ 16384
+#define MEMSIZ 16384            // the smallest dictionary, in bytes
+#define DICTIONARY_SHARE 4      // of the free memory, reserved for the dictionary
+#define DICTIONARY_GUARD 256    // bytes past mem_end that one token may compile into
+#define DS_SIZE 1024            // data stack depth, in cells: a page, so that both ends trap
+#define RS_SIZE 256             // return stack depth, in cells: JIT code nests on the machine stack
+#define CACHE_LINE 64
+#define PAGE_SIZE 4096
+#define INLINE_THRESHOLD 6      // colon definitions up to this many cells are inlined
 
 #define DEFAULT_BASE 10
 #define DEFAULT_ECHO 0
+#define DEFAULT_JIT 1
+#define DEFAULT_FOLD 1
 #define CELL sizeof(int)
+#define CELL_MIN ((int)0x80000000)
+
+// The one quotient that doesn't fit a cell, which the processor traps as
+// it would a zero divisor
+#define div_overflows(n, d) ((d) == -1 && (n) == CELL_MIN)
 
 #define true 1
 #define false 0
 
 #define align(x) (((int)x + (CELL - 1)) & ~(CELL - 1))
-extern int popnum(stack_t *stack, int *num);
-extern int peeknum(stack_t *stack, int *num);
-extern int pushnum(stack_t *stack, int num);
+
+/**
+ * Both stacks grow upwards from the start of their cell arrays, and the
+ * stack pointers address the next free cell, so the top of stack lives
+ * at sp[-1].
+ *
+ * Each stack sits on pages of its own, between two unmapped guard pages,
+ * and ends where the upper one starts. The data stack fills its page, so
+ * it starts where the lower one ends: a primitive that reads the deepest
+ * cell it takes, or writes the highest it gives, needs no check of its
+ * own, as running off either end page faults, and interpret throws the
+ * fault as -3 or -4. Return stack overflow traps the same way, as -5, but
+ * its underflow and anything that moves a stack pointer without touching
+ * the cells is checked up-front.
+ */
+#define ds_depth(ctx) ((ctx)->sp - (ctx)->ds)
+#define rs_depth(ctx) ((ctx)->rp - (ctx)->rs)
+#define ds_underflows(ctx, n) (ds_depth(ctx) < (n))
+#define ds_overflows(ctx, n) (ds_depth(ctx) + (n) > DS_SIZE)
+#define rs_underflows(ctx, n) (rs_depth(ctx) < (n))
+#define rs_overflows(ctx, n) (rs_depth(ctx) + (n) > RS_SIZE)
+#define stack_bytes(cells) (((cells) * CELL + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
+
+/**
+ * Primitives that take data space check for room up-front, and fail with
+ * -8. Compiling only checks once per token, in interpret, so a token may
+ * run into the guard beyond mem_end, but no further.
+ */
+#define dp_overflows(ctx, n) ((byte_t *)(ctx)->dp + (n) > (byte_t *)(ctx)->mem_end)
+
+extern int *alloc_stack(int cells);
+extern int popnum(context_t *ctx, int *num);
+extern int peeknum(context_t *ctx, int *num);
+extern int pushnum(context_t *ctx, int num);
+extern int rpopnum(context_t *ctx, int *num);
+extern int rpushnum(context_t *ctx, int num);
 extern int printnum(int num, int base);
-extern int parsenum(char *str, int *num, int base);
+extern int parsenum(const char *addr, int len, int *num, int base);
 #endif
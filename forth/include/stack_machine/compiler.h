@@ -7,8 +7,15 @@
 extern "C" {
 #endif
 
+extern void set_ref(context_t *ctx, word_t *cell, int ref);
+extern int is_ref(context_t *ctx, word_t *cell);
 extern word_t *comma(context_t *ctx, word_t num);
+extern word_t *comma_ref(context_t *ctx, word_t ref);
 extern void literal(context_t *ctx, int n);
+extern void literal_ref(context_t *ctx, int n);
+extern void compile_op(context_t *ctx, int op);
+extern int is_colon_definition(entry_t *xt);
+extern void compile_xt(context_t *ctx, entry_t *xt);
 extern void compile(context_t *ctx, int n, ...);
 extern context_t *load(context_t *ctx, char *filename, char *buf);
 
@@ -1,7 +1,6 @@
 #ifndef _CONTEXT_H
 #define _CONTEXT_H 1
 
-#include <collections/stack.h>
 #include <collections/hashtable.h>
 
 #ifdef __cplusplus
@@ -12,9 +11,8 @@ typedef enum { OK=0, SMUDGE=1, ERROR } state_t;
 
 typedef struct {
     char *buffer;
-    int cur_offset;
-    char *token;
-    char *saveptr;
+    int length;                 // characters in the buffer
+    int in;                     // >IN: offset to the start of the parse area
 } inbuf_t;
 
 typedef unsigned int addr_t;
@@ -25,30 +23,47 @@ typedef union {
     int val;
     addr_t addr;
     int *ptr;
+    void *code;                 // threaded code: address of an opcode's implementation
 } word_t;
 
 struct context;
 
-typedef struct {
-    char *name;
-    unsigned int flags;
+/**
+ * A word's header: only what finding and running it needs. The rest is
+ * in its entry_info_t (see entry_info).
+ */
+typedef struct entry {
     state_t (*code_ptr)(struct context *ctx);
     word_t param;
-    unsigned int alloc_size;
+    unsigned int flags;
+    unsigned int hash;          // name_hash() of the upper-cased name
+    unsigned int name_len;
+    char *name;
+} entry_t;
+
+typedef struct {
     char *stack_effect;
     char *docstring;
-} entry_t;
+    unsigned int alloc_size;    // bytes of threaded code, for colon definitions
+    struct entry *builtin;      // the definition from boot, once it has been replaced
+} entry_info_t;
 
 typedef struct context {
     inbuf_t *tib;               // input buffer
 
     word_t *mem;                // memory
     word_t *dp;                 // data pointer
+    word_t *mem_end;            // end of the data space
+    unsigned int *refs;         // a bit for each cell of it that may hold an address
     word_t *ip;                 // instruction pointer
     word_t w;                   // word register
+    word_t *last_op;            // last instruction compiled, while it may still be fused
+    word_t *prev_op;            // the instruction just before last_op, if straight-line
 
-    stack_t *ds;                // data stack
-    stack_t *rs;                // return stack
+    int *ds;                    // data stack (cell array)
+    int *sp;                    // data stack pointer: next free cell
+    int *rs;                    // return stack (cell array)
+    int *rp;                    // return stack pointer: next free cell
 
     hashtable_t *exe_tok;       // execution tokens
     entry_t *last_word;         // last defined word
@@ -56,6 +71,8 @@ typedef struct context {
     unsigned int sticky_flags;
     unsigned int base;
     unsigned int echo;
+    unsigned int jit;           // compile colon definitions to native code
+    unsigned int fold;          // fold constant expressions, strength-reduce * and /
 
     state_t state;
 
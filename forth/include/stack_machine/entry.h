@@ -15,10 +15,16 @@ extern "C" {
 #define FLAG_HIDDEN         (1<<3)
 #define FLAG_CONSTANT       (1<<4)
 #define FLAG_VARIABLE       (1<<5)
+#define FLAG_NO_JIT         (1<<6)  // reads its caller's return address
+#define FLAG_INLINE         (1<<7)  // compile in place, whatever its size
+#define FLAG_BOOT           (1<<8)  // there once the system booted: never freed
 
 
 #define is_set(entry, f) ((entry->flags & f) == f)
 
+extern state_t __REF(context_t *ctx);
+extern state_t __EXEC(context_t *ctx);
+
 extern void indent(context_t *ctx);
 extern int set_flags(hashtable_t *htbl, char *name, int flags);
 extern int add_primitive(hashtable_t *htbl, char *name, state_t (*code_ptr)(context_t *ctx), char *stack_effect, char *docstring);
@@ -26,6 +32,15 @@ extern int add_variable(context_t *ctx, char *name, word_t *addr);
 extern int add_constant(context_t *ctx, char *name, const int value);
 extern int add_word(context_t *ctx, char *name, word_t *addr);
 
+extern unsigned int name_hash(const char *addr, int len);
+extern int name_matches(const char *name, const char *addr, int len);
+extern int may_start_word(char c);
+extern entry_t *new_entry(char *name, state_t (*code_ptr)(context_t *ctx), unsigned int flags);
+extern entry_info_t *entry_info(entry_t *entry);
+extern void free_entry(entry_t *entry);
+extern void keep_builtin(entry_t *entry);
+extern void restore_builtin(entry_t *entry);
+extern int find_word(hashtable_t *htbl, const char *addr, int len, entry_t **entry);
 extern int find_entry(hashtable_t *htbl, char *name, entry_t **entry);
 extern int entry_hash(const void *data);
 extern int entry_match(const void *data1, const void *data2);
@@ -7,6 +7,9 @@ extern state_t sm_abort(context_t *ctx);
 extern state_t error_msg(context_t *ctx, int errno, char *msg, ...);
 extern state_t error(context_t *ctx, int errno);
 
+#define stack_overflow(ctx) error(ctx, -3)
 #define stack_underflow(ctx) error(ctx, -4)
+#define rstack_overflow(ctx) error(ctx, -5)
+#define rstack_underflow(ctx) error(ctx, -6)
 
 #endif
\ No newline at end of file
@@ -0,0 +1,38 @@
+#ifndef _HEAP_H
+#define _HEAP_H 1
+
+#include <stack_machine/context.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HEAP_LINE 80
+
+/**
+ * Tracing records each allocation with its call site (see heap_trace in
+ * the libc), so that the report can show where the live blocks came from.
+ */
+extern void heap_trace_start(void);
+extern void heap_trace_stop(void);
+
+/**
+ * The REPL brackets each line it interprets with these, to count the
+ * allocations per line. While tracing, a line that ends in an error has
+ * the blocks it allocated and didn't free listed by call site.
+ */
+extern void heap_line_start(void);
+extern void heap_line_end(state_t state);
+
+/**
+ * Returns the allocator's counters and, while tracing, the call sites by
+ * allocations, as a NULL terminated list. It is the callers
+ * responsibility to free it.
+ */
+extern char **heap_report(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef _IMAGE_H
+#define _IMAGE_H 1
+
+#include <stack_machine/context.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * A prebuilt dictionary: the state of a context after the bootstrap
+ * sources have been loaded, written by the hosted forth-image tool and
+ * linked into libforth, so that init_context can copy it in rather than
+ * interpret the sources again.
+ *
+ * Layout: the header, then mem_size bytes of dictionary space (padded to
+ * a cell), num_relocs image_reloc_t, num_entries image_entry_t, and the
+ * strings_size bytes of NUL terminated names.
+ *
+ * Addresses are stored as an image_ref_t, whose kind says what they are
+ * relative to, and an addend: for dictionary cells the addend is the
+ * cell's own contents.
+ */
+
+#define IMAGE_MAGIC 0x4b4f5942      // "BYOK"
+
+typedef enum {
+    IMAGE_ABS = 0,          // not an address: used as is
+    IMAGE_MEM,              // offset into ctx->mem
+    IMAGE_CTX,              // offset into the context itself
+    IMAGE_TIB,              // offset into the input buffer
+    IMAGE_ENTRY,            // offset into entry number target
+    IMAGE_OPCODE,           // vm_code of the opcode in the addend
+    IMAGE_EXEC,             // __EXEC
+    IMAGE_REF,              // __REF
+    IMAGE_PRIM,             // code of the primitive named by string target
+    IMAGE_NAMED,            // offset into the entry named by string target
+} image_kind_t;
+
+#define IMAGE_NONE -1       // string: NULL
+#define IMAGE_KEEP -2       // string: leave what create_context set
+
+typedef struct {
+    int kind;
+    int target;
+} image_ref_t;
+
+typedef struct {
+    unsigned int offset;    // byte offset of the cell in the dictionary
+    image_ref_t ref;
+} image_reloc_t;
+
+typedef struct {
+    int name;               // offsets into the strings
+    int stack_effect;
+    int docstring;
+    unsigned int flags;
+    image_ref_t code;
+    image_ref_t param;
+    int addend;             // of param
+    unsigned int alloc_size;
+} image_entry_t;
+
+typedef struct {
+    unsigned int magic;
+    unsigned int num_opcodes;       // the image only fits the libforth that made it
+    unsigned int context_size;
+    unsigned int mem_size;
+    unsigned int num_relocs;
+    unsigned int num_entries;
+    unsigned int strings_size;
+    int last_word;
+    unsigned int sticky_flags;
+    unsigned int base;
+    unsigned int echo;
+    unsigned int fold;
+} image_header_t;
+
+/**
+ * SAVE-SYSTEM writes the whole dictionary space and the user-defined
+ * entries as an image into consecutive blocks, after this header.
+ * Everything else it refers to is found by name when it is restored.
+ */
+#define SNAPSHOT_MAGIC 0x50414e53   // "SNAP"
+
+typedef struct {
+    unsigned int magic;
+    unsigned int size;              // of the image
+    unsigned int checksum;          // Adler-32 of the image
+    unsigned int system;            // the built-in dictionary it extends
+} snapshot_header_t;
+
+/**
+ * Loads the image into a context, adding its entries, or overwriting any
+ * the context already has by the same name. Returns 0, or -1 (leaving
+ * the context untouched) if the image isn't usable.
+ */
+extern int load_image(context_t *ctx, const image_header_t *image);
+
+/**
+ * Save and restore the system from block n onwards. They return 0 or a
+ * Forth error code: -35 for an invalid block, -34 if the image doesn't
+ * fit or can't be made, and -33 if the blocks don't hold a snapshot this
+ * system can restore. Restoring is only allowed from the interpreter, as
+ * it replaces the user-defined words (-21 from within one): everything
+ * is checked before anything is replaced.
+ */
+extern int save_system(context_t *ctx, int n);
+extern int restore_system(context_t *ctx, int n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -8,6 +8,8 @@ extern "C" {
 #endif
 
 extern state_t interpret(context_t *ctx, char *in);
+extern char *parse(context_t *ctx, char delim, int *len);
+extern char *parse_name(context_t *ctx, int *len);
 
 #ifdef __cplusplus
 }
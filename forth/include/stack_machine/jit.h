@@ -0,0 +1,35 @@
+#ifndef _JIT_H
+#define _JIT_H 1
+
+#include <stack_machine/context.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define JIT_ARENA_SIZE (256 * 1024)
+
+/**
+ * Translates the finished thread of a colon definition into native i386
+ * code, and points the entry's code_ptr at it. Returns false (leaving the
+ * word threaded) if the JIT is switched off, the arena is full, or the
+ * thread contains anything it does not understand.
+ */
+extern int jit_compile(context_t *ctx, entry_t *entry);
+
+/**
+ * True if addr lies within the native code generated so far.
+ */
+extern int jit_contains(void *addr);
+
+/**
+ * Gives back the native code from addr to the end of the arena, none of
+ * which may be called again.
+ */
+extern void jit_release(void *addr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef _PROFILER_H
+#define _PROFILER_H 1
+
+#include <stack_machine/context.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PROFILE_WORDS 1024          // distinct words profiled, a power of 2
+#define PROFILE_DEPTH (2 * RS_SIZE) // nested calls timed
+#define SAMPLE_SLOTS 1024           // distinct addresses sampled, a power of 2
+#define SAMPLE_LINE 80
+
+extern int profiling;
+
+/**
+ * Switching profiling on swaps the profiled call and return handlers into
+ * every thread (see vm_swap_handlers); switching it off swaps them back.
+ */
+extern void profile_start(context_t *ctx);
+extern void profile_stop(context_t *ctx);
+extern void profile_reset(void);
+
+/**
+ * Called by the profiled handlers: rp is the return stack pointer the
+ * word will exit at, or for profile_exit, is exiting at.
+ */
+extern void profile_enter(entry_t *xt, int *rp);
+extern void profile_tail(entry_t *xt, int *rp);
+extern void profile_exit(int *rp);
+
+/**
+ * Runs ctx->current_xt as a timed call, for the interpreter and for
+ * primitives called from a thread.
+ */
+extern state_t profile_execute(context_t *ctx);
+
+/**
+ * Returns the report, one line per word sorted by self time, as a NULL
+ * terminated list. It is the callers responsibility to free it.
+ */
+extern char **profile_report(void);
+
+/**
+ * Sampling reprograms the timer to tick hz times a second, and records
+ * where each tick interrupted; stopping puts the timer back to 18.2Hz.
+ */
+extern void sample_start(context_t *ctx, int hz);
+extern void sample_stop(void);
+extern void sample_reset(void);
+
+/**
+ * Returns the samples by word being run, by word last called, and by
+ * native code or C address, each sorted by count, as a NULL terminated
+ * list. It is the callers responsibility to free it.
+ */
+extern char **sample_report(context_t *ctx);
+
+/**
+ * Writes n in decimal, right aligned in width characters, and returns
+ * the position after it.
+ */
+extern char *format_count(char *out, unsigned long long n, int width);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,2 +1,20 @@
+#ifndef _REPL_H
+#define _REPL_H 1
 
-extern void repl();
\ No newline at end of file
+#include <stack_machine/context.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern context_t *create_context();
+extern void bootstrap(context_t *ctx);
+extern context_t *init_context();
+extern int run_script(char *name, char *text);
+extern void repl();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -10,6 +10,8 @@ extern "C" {
 extern void slot_flush(int n);
 extern char *slot_buffer(int n);
 extern void slot_mark_dirty(int n);
+extern int slot_write(int n, const void *data, int size);
+extern int slot_read(int n, void *data, int size);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,120 @@
+#ifndef _VM_H
+#define _VM_H 1
+
+#include <stack_machine/context.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Opcodes of the direct-threaded inner interpreter. Compiled threads hold
+ * the code address of each opcode (see vm_code), optionally followed by
+ * inline operand cells. Words without an opcode of their own are laid
+ * down as OP_CALL (colon definitions) or OP_PRIM (C primitives) followed
+ * by their execution token. A CALL right before EXIT becomes a JUMP, which
+ * reuses the caller's return stack frame.
+ */
+typedef enum {
+    OP_HALT = 0,
+    OP_CALL,
+    OP_PRIM,
+    OP_JUMP,
+    OP_EXIT,
+    OP_EXECUTE,
+    OP_LIT,
+    OP_BRANCH,
+    OP_0BRANCH,
+
+    OP_DUP,
+    OP_QDUP,
+    OP_DROP,
+    OP_SWAP,
+    OP_OVER,
+    OP_ROT,
+    OP_MINROT,
+    OP_NIP,
+    OP_TUCK,
+    OP_2DUP,
+    OP_2DROP,
+
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_MOD,
+    OP_INC,
+    OP_DEC,
+    OP_DBL,
+    OP_NEG,
+
+    OP_AND,
+    OP_OR,
+    OP_XOR,
+    OP_INVERT,
+    OP_LSHIFT,
+    OP_RSHIFT,
+
+    OP_EQ,
+    OP_NEQ,
+    OP_LT,
+    OP_GT,
+    OP_ISZERO,
+    OP_ISNEG,
+
+    OP_FETCH,
+    OP_STORE,
+    OP_PLUS_STORE,
+    OP_C_FETCH,
+    OP_C_STORE,
+
+    OP_TOR,
+    OP_RFROM,
+    OP_RFETCH,
+    OP_RDROP,
+
+    OP_DO,
+    OP_QDO,
+    OP_LOOP,
+    OP_PLOOP,
+    OP_I,
+    OP_J,
+    OP_UNLOOP,
+
+    // Superinstructions, fused by the compiler from common sequences
+    OP_LIT_ADD,
+    OP_LIT_EQ,
+    OP_LIT_EQ_0BRANCH,
+    OP_SQUARE,
+    OP_FETCH_ADD,
+
+    // Division by a constant, strength-reduced by the compiler
+    OP_DIV_SHIFT,
+    OP_DIV_MAGIC,
+
+    NUM_OPCODES
+} opcode_t;
+
+typedef struct {
+    char *name;
+    int operands;                       // inline operand cells following the opcode
+    state_t (*primitive)(context_t *ctx);
+} opcode_info_t;
+
+extern void *vm_code[NUM_OPCODES];
+extern const opcode_info_t vm_opcodes[NUM_OPCODES];
+
+extern void vm_init(void);
+extern state_t vm_run(context_t *ctx, word_t *ip);
+extern int vm_opcode(word_t cell);
+extern void vm_swap_handlers(context_t *ctx);
+extern int vm_contains(void *addr);
+extern int vm_primitive_opcode(state_t (*code_ptr)(context_t *ctx));
+extern int vm_is_branch(int op);
+extern int loop_continues(int *rp, int n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -2,6 +2,8 @@
 #include <string.h>
 #include <collections/hashtable.h>
 
+// Grow once the table is three-quarters full
+#define MAX_LOAD(capacity) ((capacity) - (capacity) / 4)
 
 int hashfn(const void *key)
 {
@@ -23,19 +25,118 @@ int hashfn(const void *key)
     return val;
 }
 
+// Stored hashes always have the top bit set, so that 0 can mean empty
+static unsigned int stored_hash(const hashtable_t *htbl, const void *data)
+{
+    return (unsigned int)htbl->hash(data) | 0x80000000;
+}
+
+// How far the element in slot i has been displaced from its home slot
+static int probe_length(const hashtable_t *htbl, int i)
+{
+    int mask = htbl->capacity - 1;
+    return (i - (int)(htbl->table[i].hash & mask)) & mask;
+}
+
+/**
+ * Finds the slot holding data, or -1. Robin Hood ordering means the search
+ * can stop as soon as it meets a resident nearer its home than the key.
+ */
+static int find_slot(const hashtable_t *htbl, const void *data)
+{
+    unsigned int hash = stored_hash(htbl, data);
+    int mask = htbl->capacity - 1;
+
+    for (int i = hash & mask, dist = 0; ; i = (i + 1) & mask, dist++)
+    {
+        hashtable_slot_t *slot = &htbl->table[i];
+        if (slot->hash == 0 || probe_length(htbl, i) < dist)
+            return -1;
+
+        if (slot->hash == hash && htbl->match(data, slot->data))
+            return i;
+    }
+}
+
+/**
+ * Robin Hood insert. Until the first displacement the probe also checks
+ * for the element already being present, so no separate lookup is needed.
+ * Returns 1 if it was already there.
+ */
+static int place(hashtable_t *htbl, unsigned int hash, void *data, int check)
+{
+    int mask = htbl->capacity - 1;
+
+    for (int i = hash & mask, dist = 0; ; i = (i + 1) & mask, dist++)
+    {
+        hashtable_slot_t *slot = &htbl->table[i];
+        if (slot->hash == 0)
+        {
+            slot->hash = hash;
+            slot->data = data;
+            htbl->size++;
+            return 0;
+        }
+
+        if (check && slot->hash == hash && htbl->match(data, slot->data))
+            return 1;
+
+        int resident = probe_length(htbl, i);
+        if (resident < dist)
+        {
+            // Take the slot, and carry on inserting the displaced element
+            hashtable_slot_t displaced = *slot;
+            slot->hash = hash;
+            slot->data = data;
+
+            hash = displaced.hash;
+            data = displaced.data;
+            dist = resident;
+            check = 0;
+        }
+    }
+}
+
+static int resize(hashtable_t *htbl, int capacity)
+{
+    hashtable_slot_t *old = htbl->table;
+    int old_capacity = htbl->capacity;
+
+    if ((htbl->table = (hashtable_slot_t *)malloc(capacity * sizeof(hashtable_slot_t))) == NULL)
+    {
+        htbl->table = old;
+        return -1;
+    }
+
+    memset(htbl->table, 0, capacity * sizeof(hashtable_slot_t));
+    htbl->capacity = capacity;
+    htbl->size = 0;
+
+    for (int i = 0; i < old_capacity; i++)
+    {
+        if (old[i].hash != 0)
+            place(htbl, old[i].hash, old[i].data, 0);
+    }
+
+    free(old);
+    return 0;
+}
+
 int hashtable_init(hashtable_t *htbl,
                    int buckets,
                    int (*hash)(const void *key),
                    int (*match)(const void *key1, const void *key2),
                    void (*destroy)(void *data))
 {
-    if ((htbl->table = (list_t *)malloc(buckets * sizeof(list_t))) == NULL)
-        return -1;
+    int capacity = 8;
+    while (capacity < buckets)
+        capacity <<= 1;
 
-    htbl->buckets = buckets;
-    for (int i = 0; i < htbl->buckets; i++)
-        list_init(&htbl->table[i], destroy);
+    if ((htbl->table = (hashtable_slot_t *)malloc(capacity * sizeof(hashtable_slot_t))) == NULL)
+        return -1;
 
+    memset(htbl->table, 0, capacity * sizeof(hashtable_slot_t));
+    htbl->capacity = capacity;
     htbl->hash = hash;
     htbl->match = match;
     htbl->destroy = destroy;
@@ -45,8 +146,14 @@ int hashtable_init(hashtable_t *htbl,
 
 void hashtable_destroy(hashtable_t *htbl)
 {
-    for (int i = 0; i < htbl->buckets; i++)
-        list_destroy(&htbl->table[i]);
+    if (htbl->destroy != NULL)
+    {
+        for (int i = 0; i < htbl->capacity; i++)
+        {
+            if (htbl->table[i].hash != 0)
+                htbl->destroy(htbl->table[i].data);
+        }
+    }
 
     free(htbl->table);
     memset(htbl, 0, sizeof(hashtable_t));
@@ -54,64 +161,60 @@ void hashtable_destroy(hashtable_t *htbl)
 
 int hashtable_insert(hashtable_t *htbl, const void *data)
 {
-    void *temp;
-    int bucket, retval;
-
-    temp = (void *)data;
-    if (hashtable_lookup(htbl, &temp) == 0)
-        return 1;   // do nothing if data already in table
-
-    bucket = htbl->hash(data) % htbl->buckets;
-    assert(bucket >= 0);
-    if ((retval = list_ins_next(&htbl->table[bucket], NULL, data)) == 0)
-        htbl->size++;
+    if (htbl->size + 1 > MAX_LOAD(htbl->capacity) && resize(htbl, htbl->capacity * 2) != 0)
+        return -1;
 
-    return retval;
+    return place(htbl, stored_hash(htbl, data), (void *)data, 1);
 }
 
 int hashtable_remove(hashtable_t *htbl, void **data)
 {
-    list_elem_t *element, *prev;
-    int bucket = htbl->hash(*data) % htbl->buckets;
-    assert(bucket >= 0);
-    prev = NULL;
+    int i = find_slot(htbl, *data);
+    if (i < 0)
+        return -1;  // not found
 
-    for (element = list_head(&htbl->table[bucket]); element != NULL; element = list_next(element))
-    {
-        if (htbl->match(*data, list_data(element)))
-        {
-            // remove data from bucket
-            if (list_rem_next(&htbl->table[bucket], prev, data) == 0)
-            {
-                htbl->size--;
-                return 0;
-            }
-            else
-            {
-                return -1;
-            }
-        }
+    *data = htbl->table[i].data;    // pass back data from the table
 
-        prev = element;
+    // Shift the rest of the run back one slot, rather than leave a tombstone
+    int mask = htbl->capacity - 1;
+    int next = (i + 1) & mask;
+    while (htbl->table[next].hash != 0 && probe_length(htbl, next) > 0)
+    {
+        htbl->table[i] = htbl->table[next];
+        i = next;
+        next = (next + 1) & mask;
     }
 
-    return -1;  // not found
+    htbl->table[i].hash = 0;
+    htbl->table[i].data = NULL;
+    htbl->size--;
+    return 0;
 }
 
 int hashtable_lookup(const hashtable_t *htbl, void **data)
 {
-    list_elem_t *element;
-    int bucket = htbl->hash(*data) % htbl->buckets;
-    assert(bucket >= 0);
+    int i = find_slot(htbl, *data);
+    if (i < 0)
+        return -1;  // not found
+
+    *data = htbl->table[i].data;    // pass back data from the table
+    return 0;
+}
+
+void hashtable_stats(const hashtable_t *htbl, hashtable_stats_t *stats)
+{
+    memset(stats, 0, sizeof(hashtable_stats_t));
+    stats->size = htbl->size;
+    stats->capacity = htbl->capacity;
 
-    for (element = list_head(&htbl->table[bucket]); element != NULL; element = list_next(element))
+    for (int i = 0; i < htbl->capacity; i++)
     {
-        if (htbl->match(*data, list_data(element)))
-        {
-            *data = list_data(element);     // pass back data from the table
-            return 0;
-        }
-    }
+        if (htbl->table[i].hash == 0)
+            continue;
 
-    return -1;  // not found
+        int len = probe_length(htbl, i);
+        stats->total_probe += len;
+        stats->max_probe = max(stats->max_probe, len);
+        stats->histogram[min(len, HASHTABLE_HISTOGRAM - 1)]++;
+    }
 }
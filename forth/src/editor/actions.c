@@ -549,20 +549,14 @@ int find_action(hashtable_t *htbl, char scancode, action_t **action)
 {
     assert(htbl != NULL);
 
-    action_t *data = malloc(sizeof(action_t));
-    if (data == NULL)
-        return -1;
-
-    data->scancode = scancode;
-    action_t *tmp = data;   // copy data ptr, so it can be freed later
+    action_t key = { .scancode = scancode };
+    action_t *data = &key;
     int retval;
     if ((retval = hashtable_lookup(htbl, (void **)&data)) == 0)
     {
         *action = data;
     }
 
-    free(tmp);
-
     return retval;
 }
 
@@ -50,7 +50,7 @@ int is_literal(char *token, char *line, int index, context_t *ctx)
     // 'in quotes' == odd-number of dbl-quotes before index
 
     int num;
-    if (parsenum(token, &num, ctx->base))
+    if (parsenum(token, strlen(token), &num, ctx->base))
     {
         return 1;
     }
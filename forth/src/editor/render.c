@@ -103,7 +103,7 @@ char *write_rows(char *dest, editor_t *ed)
 editor_t *create_model(context_t *ctx, char *data)
 {
     // Caller is responsible for calling destroy_model()
-    editor_t *ed = calloc(0, sizeof(editor_t));
+    editor_t *ed = calloc(1, sizeof(editor_t));
     assert(ed != NULL);
 
     // initialize editor model
@@ -111,8 +111,8 @@ editor_t *create_model(context_t *ctx, char *data)
     ed->inputmode = INSERT;
     ed->row = 0;
     ed->col = 0;
-    ed->yank[0] = calloc(0, sizeof(char) * COLUMNS + 1);
-    ed->yank[1] = calloc(0, sizeof(char) * COLUMNS + 1);
+    ed->yank[0] = calloc(1, sizeof(char) * COLUMNS + 1);
+    ed->yank[1] = calloc(1, sizeof(char) * COLUMNS + 1);
     model_redraw(ed, 0, ROWS - 1);
 
     char *buf = strdup(data);
@@ -123,7 +123,7 @@ editor_t *create_model(context_t *ctx, char *data)
     char *eachline = strtok_r(buf, "\n", &saveptr);
     for (int row = 0; row < ROWS; row++)
     {
-        ed->data[row] = calloc(0, sizeof(char) * COLUMNS + 1);
+        ed->data[row] = calloc(1, sizeof(char) * COLUMNS + 1);
         if (eachline != NULL)
         {
             int len = strlen(eachline);
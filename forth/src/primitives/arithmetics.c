@@ -11,7 +11,20 @@
 arity2stackop(__ADD, x1 + x2)
 arity2stackop(__SUB, x1 - x2)
 arity2stackop(__MUL, x1 * x2)
-arity2stackop(__DIV, x1 / x2)
+
+// A zero divisor traps, and interpret throws -10: the check is for the
+// one quotient that would trap as well, but is out of range instead
+state_t __DIV(context_t *ctx)
+{
+    int x1 = ctx->sp[-2];
+    int x2 = ctx->sp[-1];
+    if (div_overflows(x1, x2))
+        return error(ctx, -11); // result out of range
+
+    ctx->sp[-2] = x1 / x2;
+    ctx->sp--;
+    return OK;
+}
 
 arity1stackop(__INC, x1 + 1)
 arity1stackop(__DEC, x1 - 1)
@@ -24,10 +37,59 @@ arity1stackop(__NEG, -x1)
 
 arity2stackop(__MIN, min(x1, x2))
 arity2stackop(__MAX, max(x1, x2))
-arity2stackop(__MOD, x1 % x2)
-arity2stackop2(__SLASHMOD, x1 % x2, x1 / x2)
-arity3stackop(__STARSLASH, ((long)((long)x1 * (long)x2)) / x3)
-arity3stackop2(__STARSLASHMOD, ((long)((long)x1 * (long)x2)) % x3, ((long)((long)x1 * (long)x2)) / x3)
+
+state_t __MOD(context_t *ctx)
+{
+    int x1 = ctx->sp[-2];
+    int x2 = ctx->sp[-1];
+    if (div_overflows(x1, x2))
+        return error(ctx, -11); // result out of range
+
+    ctx->sp[-2] = x1 % x2;
+    ctx->sp--;
+    return OK;
+}
+
+state_t __SLASHMOD(context_t *ctx)
+{
+    int x1 = ctx->sp[-2];
+    int x2 = ctx->sp[-1];
+    if (div_overflows(x1, x2))
+        return error(ctx, -11); // result out of range
+
+    ctx->sp[-2] = x1 % x2;
+    ctx->sp[-1] = x1 / x2;
+    return OK;
+}
+
+state_t __STARSLASH(context_t *ctx)
+{
+    int x1 = ctx->sp[-3];
+    int x2 = ctx->sp[-2];
+    int x3 = ctx->sp[-1];
+    long product = (long)x1 * (long)x2;
+    if (div_overflows(product, x3))
+        return error(ctx, -11); // result out of range
+
+    ctx->sp[-3] = product / x3;
+    ctx->sp -= 2;
+    return OK;
+}
+
+state_t __STARSLASHMOD(context_t *ctx)
+{
+    int x1 = ctx->sp[-3];
+    int x2 = ctx->sp[-2];
+    int x3 = ctx->sp[-1];
+    long product = (long)x1 * (long)x2;
+    if (div_overflows(product, x3))
+        return error(ctx, -11); // result out of range
+
+    ctx->sp[-3] = product % x3;
+    ctx->sp[-2] = product / x3;
+    ctx->sp--;
+    return OK;
+}
 
 void init_arithmetic_words(context_t *ctx)
 {
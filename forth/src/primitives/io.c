@@ -10,13 +10,14 @@
 #include <stack_machine/entry.h>
 #include <stack_machine/error.h>
 #include <stack_machine/compiler.h>
+#include <stack_machine/image.h>
 #include <stack_machine/slots.h>
 #include <editor/editor.h>
 
 state_t __DOT(context_t *ctx)
 {
     int num;
-    if (popnum(ctx->ds, &num))
+    if (popnum(ctx, &num))
     {
         printnum(num, ctx->base);
         return OK;
@@ -31,7 +32,7 @@ state_t __DOT(context_t *ctx)
 state_t __UDOT(context_t *ctx)
 {
     int num;
-    if (popnum(ctx->ds, &num))
+    if (popnum(ctx, &num))
     {
         printnum(num < 0 ? num + 0x80000000 : num, ctx->base);
         return OK;
@@ -45,14 +46,8 @@ state_t __UDOT(context_t *ctx)
 
 state_t __DOT_S(context_t *ctx)
 {
-    dlist_elem_t *element = dlist_tail(ctx->ds);
-    while (element != NULL)
-    {
-        int *num = dlist_data(element);
-
-        printnum(*num, ctx->base);
-        element = dlist_prev(element);
-    }
+    for (int *cell = ctx->ds; cell < ctx->sp; cell++)
+        printnum(*cell, ctx->base);
 
     return OK;
 }
@@ -61,7 +56,7 @@ state_t __DOT_S(context_t *ctx)
 state_t __EMIT(context_t *ctx)
 {
     int num;
-    if (popnum(ctx->ds, &num))
+    if (popnum(ctx, &num))
     {
         putchar(num);
         return OK;
@@ -75,15 +70,14 @@ state_t __EMIT(context_t *ctx)
 
 state_t __KEY(context_t *ctx)
 {
-    pushnum(ctx->ds, getchar());
-    return OK;
+    return pushnum(ctx, getchar()) ? OK : stack_overflow(ctx);
 }
 
 
 state_t __SPACES(context_t *ctx)
 {
     int num;
-    if (popnum(ctx->ds, &num))
+    if (popnum(ctx, &num))
     {
         for (int i = 0; i < num; i++)
             putchar(' ');
@@ -108,7 +102,7 @@ state_t __TYPE(context_t *ctx)
 {
     addr_t addr;
     int num;
-    if (popnum(ctx->ds, &num) && popnum(ctx->ds, (int)&addr))
+    if (popnum(ctx, &num) && popnum(ctx, (int *)&addr))
     {
         for (int i = 0; i < num; i++)
             putchar(*((char*)addr++));
@@ -125,7 +119,7 @@ state_t __TYPE(context_t *ctx)
 state_t __LIST(context_t *ctx)
 {
     int block;
-    if (popnum(ctx->ds, &block))
+    if (popnum(ctx, &block))
     {
         char *data = slot_buffer(block);
         if (data != NULL)
@@ -145,7 +139,7 @@ state_t __LIST(context_t *ctx)
 state_t __LOAD(context_t *ctx)
 {
     int block;
-    if (popnum(ctx->ds, &block))
+    if (popnum(ctx, &block))
     {
         char *data = slot_buffer(block);
         if (data != NULL)
@@ -162,6 +156,30 @@ state_t __LOAD(context_t *ctx)
     return stack_underflow(ctx);
 }
 
+state_t __SAVE_SYSTEM(context_t *ctx)
+{
+    int block;
+    if (popnum(ctx, &block))
+    {
+        int status = save_system(ctx, block);
+        return status == 0 ? OK : error(ctx, status);
+    }
+
+    return stack_underflow(ctx);
+}
+
+state_t __RESTORE_SYSTEM(context_t *ctx)
+{
+    int block;
+    if (popnum(ctx, &block))
+    {
+        int status = restore_system(ctx, block);
+        return status == 0 ? OK : error(ctx, status);
+    }
+
+    return stack_underflow(ctx);
+}
+
 
 state_t __CURSOR(context_t *ctx)
 {
@@ -169,7 +187,7 @@ state_t __CURSOR(context_t *ctx)
     unsigned int start;
     unsigned int end;
 
-    if (popnum(ctx->ds, &end) && popnum(ctx->ds, &start))
+    if (popnum(ctx, &end) && popnum(ctx, &start))
     {
         terminal_cursormode(start, end);
         return OK;
@@ -194,5 +212,7 @@ void init_io_words(context_t *ctx)
     add_primitive(htbl, "TYPE",   __TYPE,   "( addr n -- )", "outputs the contents of addr for n bytes.");
     add_primitive(htbl, "LIST",   __LIST,   "( block -- )", "");
     add_primitive(htbl, "LOAD",   __LOAD,   "( block -- )", "");
+    add_primitive(htbl, "SAVE-SYSTEM", __SAVE_SYSTEM, "( block -- )", "save the dictionary and user-defined words in consecutive blocks from block.");
+    add_primitive(htbl, "RESTORE-SYSTEM", __RESTORE_SYSTEM, "( block -- )", "replace the user-defined words with those saved from block by SAVE-SYSTEM.");
     add_primitive(htbl, "CURSOR", __CURSOR, "( start end -- )", "");
 }
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <kernel/system.h>
 #include <kernel/tty.h>
 #include <kernel/vga.h>
 
@@ -11,55 +12,80 @@
 #include <stack_machine/entry.h>
 #include <stack_machine/error.h>
 #include <stack_machine/compiler.h>
+#include <stack_machine/interpreter.h>
+#include <stack_machine/jit.h>
+#include <stack_machine/vm.h>
 
-state_t __NEST(context_t *ctx)
+state_t __UNNEST(context_t *ctx)
 {
-    pushnum(ctx->rs, (int)ctx->ip);
-    ctx->ip = ++ctx->w.ptr;
+    if (rs_underflows(ctx, 1))
+        return rstack_underflow(ctx);
+
+    ctx->ip = (word_t *)*--ctx->rp;
     return OK;
 }
 
+state_t __COMMA(context_t *ctx)
+{
+    if (ds_underflows(ctx, 1))
+        return stack_underflow(ctx);
 
-state_t __UNNEST(context_t *ctx)
+    ctx->dp = (word_t *)align(ctx->dp);
+    if (dp_overflows(ctx, CELL))
+        return error(ctx, -8);  // dictionary overflow
+
+    comma_ref(ctx, (word_t)*--ctx->sp);
+    return OK;
+}
+
+state_t __C_COMMA(context_t *ctx)
 {
-    if (popnum(ctx->rs, (int *)&ctx->ip))
-    {
-        return OK;
-    }
-    else
-    {
+    if (ds_underflows(ctx, 1))
         return stack_underflow(ctx);
-    }
+
+    if (dp_overflows(ctx, 1))
+        return error(ctx, -8);  // dictionary overflow
+
+    set_ref(ctx, (word_t *)((int)ctx->dp & ~(CELL - 1)), false);
+    *(byte_t *)ctx->dp = (unsigned char)*--ctx->sp & 0xFF;
+    ctx->dp = (word_t *)((byte_t *)ctx->dp + 1);
+    return OK;
 }
 
-state_t __COMMA(context_t *ctx)
+state_t __COMPILE_COMMA(context_t *ctx)
 {
-    int n;
-    if (popnum(ctx->ds, &n))
-    {
-        comma(ctx, (word_t)n);
-        return OK;
-    }
-    else
-    {
+    if (ds_underflows(ctx, 1))
         return stack_underflow(ctx);
-    }
+
+    compile_xt(ctx, (entry_t *)*--ctx->sp);
+    return OK;
 }
 
 state_t __DOLIT(context_t *ctx)
 {
-    pushnum(ctx->ds, (*(int *)ctx->ip++));
+    if (ds_overflows(ctx, 1))
+        return stack_overflow(ctx);
+
+    *ctx->sp++ = (*ctx->ip++).val;
     return OK;
 }
 
-/*
 state_t __ALLOT(context_t *ctx)
 {
     int n;
-    if (popnum(ctx->ds, &n))
+    if (popnum(ctx, &n))
     {
-        ctx->dp += (n / CELL);
-        assert(ctx->dp - ctx->mem < MEMSIZ);
+        if (n > 0 && dp_overflows(ctx, n))
+            return error(ctx, -8);  // dictionary overflow
+
+        if (n < 0 && (byte_t *)ctx->dp + n < (byte_t *)ctx->mem)
+            return error(ctx, -9);  // invalid memory address
+
+        word_t *end = (word_t *)align((byte_t *)ctx->dp + n);
+        for (word_t *cell = (word_t *)align(ctx->dp); cell < end; cell++)
+            set_ref(ctx, cell, false);
+
+        ctx->dp = end;
         return OK;
     }
     else
@@ -67,49 +93,55 @@ state_t __ALLOT(context_t *ctx)
         return stack_underflow(ctx);
     }
 }
-*/
+
+state_t __UNUSED(context_t *ctx)
+{
+    if (ds_overflows(ctx, 1))
+        return stack_overflow(ctx);
+
+    *ctx->sp++ = (byte_t *)ctx->mem_end - (byte_t *)ctx->dp;
+    return OK;
+}
 
 
 state_t __CELLS(context_t *ctx)
 {
-    int n1, n2;
-    if (popnum(ctx->ds, &n1))
-    {
-        n2 = n1 <= 0 ? 0 : ((n1 - 1) / sizeof(ctx->dp)) + 1;
-        pushnum(ctx->ds, n2);
-        return OK;
-    }
-    else
-    {
+    if (ds_underflows(ctx, 1))
         return stack_underflow(ctx);
-    }
+
+    int n1 = ctx->sp[-1];
+    ctx->sp[-1] = n1 <= 0 ? 0 : ((n1 - 1) / sizeof(ctx->dp)) + 1;
+    return OK;
 }
 
 
 state_t __HERE(context_t *ctx)
 {
-    pushnum(ctx->ds, (int)ctx->dp);
-    return OK;
+    // Anything may branch to HERE now, so stop fusing across it
+    ctx->last_op = ctx->prev_op = NULL;
+    return pushnum(ctx, (int)ctx->dp) ? OK : stack_overflow(ctx);
 }
 
 state_t __COLON(context_t *ctx)
 {
-    static entry_t nest = { .code_ptr = &__NEST, .name = "NEST" };
     if (ctx->state == SMUDGE)
     {
         return error(ctx, -29);  // compiler nesting
     }
 
-    // Skip to next token
-    ctx->tib->token = strtok_r(NULL, DELIMITERS, &ctx->tib->saveptr);
-    if (ctx->tib->token != NULL)
+    int len;
+    char *token = parse_name(ctx, &len);
+    if (token != NULL)
     {
-        char *name = strdup(ctx->tib->token);
-        add_word(ctx, name, comma(ctx, (word_t)(int *)&nest));
+        char *name = strndup(token, len);
+        ctx->dp = (word_t *)align(ctx->dp);
+        ctx->last_op = ctx->prev_op = NULL;
+        add_word(ctx, name, ctx->dp);
+        free(name);
 
         if (ctx->echo) {
             terminal_setcolor(0x0F);
-            printf("Compiling: %s (0x%x)", name, ctx->last_word->param);
+            printf("Compiling: %s (0x%x)", ctx->last_word->name, ctx->last_word->param);
             terminal_setcolor(0x07);
             terminal_writestring("\n");
         }
@@ -124,9 +156,10 @@ state_t __COLON(context_t *ctx)
 
 state_t __SEMICOLON(context_t *ctx)
 {
-    static entry_t unnest = { .code_ptr = &__UNNEST, .name = "UNNEST" };
-    comma(ctx, (word_t)(int *)&unnest);
-    ctx->last_word->alloc_size = (int)ctx->dp - ctx->last_word->param.val;
+    compile_op(ctx, OP_EXIT);
+    ctx->last_op = ctx->prev_op = NULL;
+    entry_info(ctx->last_word)->alloc_size = (int)ctx->dp - ctx->last_word->param.val;
+    jit_compile(ctx, ctx->last_word);
     ctx->state = OK;
     return OK;
 }
@@ -139,103 +172,92 @@ state_t __IMMEDIATE(context_t *ctx)
     return OK;
 }
 
-state_t __FETCH(context_t *ctx)
+state_t __SET_INLINE(context_t *ctx)
 {
-    word_t addr;
-    if (popnum(ctx->ds, (int *)&addr))
-    {
-        if (addr.addr % sizeof(word_t) != 0)
-            return error(ctx, -23);  // address alignment exception
+    assert(ctx->last_word != NULL);
+    entry_t *entry = ctx->last_word;
+    entry->flags |= FLAG_INLINE;
+    return OK;
+}
 
-        pushnum(ctx->ds, *addr.ptr);
-        return OK;
-    }
-    else
-    {
+state_t __FETCH(context_t *ctx)
+{
+    if (ds_underflows(ctx, 1))
         return stack_underflow(ctx);
-    }
+
+    word_t addr = (word_t)ctx->sp[-1];
+    if (addr.addr % sizeof(word_t) != 0)
+        return error(ctx, -23);  // address alignment exception
+
+    ctx->sp[-1] = *addr.ptr;
+    return OK;
 }
 
 state_t __C_FETCH(context_t *ctx)
 {
-    word_t addr;
-    if (popnum(ctx->ds, (int *)&addr))
-    {
-        pushnum(ctx->ds, *((unsigned char *)addr.ptr));
-        return OK;
-    }
-    else
-    {
+    if (ds_underflows(ctx, 1))
         return stack_underflow(ctx);
-    }
+
+    ctx->sp[-1] = *((unsigned char *)ctx->sp[-1]);
+    return OK;
 }
 
 state_t __STORE(context_t *ctx)
 {
-    int x;
-    word_t addr;
-    if (popnum(ctx->ds, (int *)&addr) && popnum(ctx->ds, &x))
-    {
-        if (addr.addr % sizeof(word_t) != 0)
-            return error(ctx, -23);  // address alignment exception
-
-        *addr.ptr = x;
-        return OK;
-    }
-    else
-    {
+    if (ds_underflows(ctx, 2))
         return stack_underflow(ctx);
-    }
+
+    word_t addr = (word_t)ctx->sp[-1];
+    if (addr.addr % sizeof(word_t) != 0)
+        return error(ctx, -23);  // address alignment exception
+
+    *addr.ptr = ctx->sp[-2];
+    ctx->sp -= 2;
+    return OK;
 }
 
 
 state_t __PLUS_STORE(context_t *ctx)
 {
-    int x;
-    word_t addr;
+    if (ds_underflows(ctx, 2))
+        return stack_underflow(ctx);
 
-    if (popnum(ctx->ds, (int *)&addr) && popnum(ctx->ds, &x))
-    {
-        if (addr.addr % sizeof(word_t) != 0)
-            return error(ctx, -23);  // address alignment exception
+    word_t addr = (word_t)ctx->sp[-1];
+    if (addr.addr % sizeof(word_t) != 0)
+        return error(ctx, -23);  // address alignment exception
 
-        *addr.ptr += x;
-        return OK;
-    }
-    else
-    {
-        return stack_underflow(ctx);
-    }
+    *addr.ptr += ctx->sp[-2];
+    ctx->sp -= 2;
+    return OK;
 }
 
 
 state_t __C_STORE(context_t *ctx)
 {
-    int x;
-    word_t addr;
-    if (popnum(ctx->ds, (int *)&addr) && popnum(ctx->ds, &x))
-    {
-        *((char *)addr.ptr) = (unsigned char)x & 0xFF;
-        return OK;
-    }
-    else
-    {
+    if (ds_underflows(ctx, 2))
         return stack_underflow(ctx);
-    }
+
+    *((char *)ctx->sp[-1]) = (unsigned char)ctx->sp[-2] & 0xFF;
+    ctx->sp -= 2;
+    return OK;
 }
 
 
 state_t __VARIABLE(context_t *ctx)
 {
-    // Skip to next token
-    ctx->tib->token = strtok_r(NULL, DELIMITERS, &ctx->tib->saveptr);
-    if (ctx->tib->token != NULL)
+    int len;
+    char *token = parse_name(ctx, &len);
+    if (token != NULL)
     {
         entry_t *entry;
-        if (find_entry(ctx->exe_tok, ctx->tib->token, &entry) != 0)
+        if (find_word(ctx->exe_tok, token, len, &entry) != 0)
         {
-            char *name = strdup(ctx->tib->token);
+            if (dp_overflows(ctx, align(ctx->dp) - (int)ctx->dp + CELL))
+                return error(ctx, -8);  // dictionary overflow
+
+            char *name = strndup(token, len);
             add_variable(ctx, name, comma(ctx, (word_t)0));
+            free(name);
         }
     }
     return OK;
@@ -244,17 +266,18 @@ state_t __VARIABLE(context_t *ctx)
 state_t __CONSTANT(context_t *ctx)
 {
     int x;
-    if (popnum(ctx->ds, &x))
+    if (popnum(ctx, &x))
     {
-        // Skip to next token
-        ctx->tib->token = strtok_r(NULL, DELIMITERS, &ctx->tib->saveptr);
-        if (ctx->tib->token != NULL)
+        int len;
+        char *token = parse_name(ctx, &len);
+        if (token != NULL)
         {
             entry_t *entry;
-            if (find_entry(ctx->exe_tok, ctx->tib->token, &entry) != 0)
+            if (find_word(ctx->exe_tok, token, len, &entry) != 0)
             {
-                char *constant_name = strdup(ctx->tib->token);
-                add_constant(ctx, constant_name, x);
+                char *name = strndup(token, len);
+                add_constant(ctx, name, x);
+                free(name);
             }
         }
         return OK;
@@ -271,7 +294,7 @@ WORD should be defined in terms of PARSE and MOVE
 state_t __WORD(context_t *ctx)
 {
     int ch;
-    if (popnum(ctx->ds, &ch))
+    if (popnum(ctx, &ch))
     {
         ctx->tib->token = strtok_r(NULL, DELIMITERS, &ctx->tib->saveptr);
         if (ctx->tib->token != NULL)
@@ -291,35 +314,35 @@ state_t __WORD(context_t *ctx)
 
 state_t __SOURCE(context_t *ctx)
 {
-   pushnum(ctx->ds, (int)ctx->tib->buffer);
-   pushnum(ctx->ds, strlen(ctx->tib->buffer));
+   if (ds_overflows(ctx, 2))
+       return stack_overflow(ctx);
+
+   pushnum(ctx, (int)ctx->tib->buffer);
+   pushnum(ctx, ctx->tib->length);
    return OK;
 }
 
 state_t __TO_IN(context_t *ctx)
 {
-    pushnum(ctx->ds, (int)ctx->tib->buffer + ctx->tib->cur_offset);
-    return OK;
+    return pushnum(ctx, (int)&ctx->tib->in) ? OK : stack_overflow(ctx);
 }
 
 
 state_t __PARSE(context_t *ctx)
 {
     int ch;
-    if (popnum(ctx->ds, &ch))
+    if (popnum(ctx, &ch))
     {
         if (ch < 0 || ch > 255)
             return error(ctx, -24);  // invalid numeric argument
 
-        char delim[] = { ch & 0xff, 0 };
-        char *start = ctx->tib->token;
-
-        ctx->tib->token = strtok_r(NULL, delim, &ctx->tib->saveptr);
-
-        int offset = ctx->tib->token == NULL ? 0 : ctx->tib->token - start;
-        pushnum(ctx->ds, (int)ctx->tib->buffer + ctx->tib->cur_offset + offset);
-        pushnum(ctx->ds, strlen(ctx->tib->token));
+        if (ds_overflows(ctx, 2))
+            return stack_overflow(ctx);
 
+        int len;
+        char *token = parse(ctx, ch, &len);
+        pushnum(ctx, (int)token);
+        pushnum(ctx, len);
         return OK;
     }
     else
@@ -328,28 +351,46 @@ state_t __PARSE(context_t *ctx)
     }
 }
 
+state_t __PARSE_NAME(context_t *ctx)
+{
+    if (ds_overflows(ctx, 2))
+        return stack_overflow(ctx);
+
+    int len;
+    char *token = parse_name(ctx, &len);
+    pushnum(ctx, token == NULL ? (int)(ctx->tib->buffer + ctx->tib->length) : (int)token);
+    pushnum(ctx, len);
+    return OK;
+}
+
 state_t __TICK(context_t *ctx)
 {
-    ctx->tib->token = strtok_r(NULL, DELIMITERS, &ctx->tib->saveptr);
-    if (ctx->tib->token != NULL)
+    char name[READLINE_BUFSIZ] = "";
+    int len;
+    char *token = parse_name(ctx, &len);
+    if (token != NULL)
     {
         entry_t *entry;
-        if (find_entry(ctx->exe_tok, ctx->tib->token, &entry) == 0)
+        if (find_word(ctx->exe_tok, token, len, &entry) == 0)
         {
-            pushnum(ctx->ds, (int)entry);
-            return OK;
+            return pushnum(ctx, (int)entry) ? OK : stack_overflow(ctx);
         }
+
+        memcpy(name, token, len);
+        name[len] = '\0';
     }
 
-    return error_msg(ctx, -13, ": '%s'", ctx->tib->token); // word not found
+    return error_msg(ctx, -13, ": '%s'", name); // word not found
 }
 
 state_t __EXECUTE(context_t *ctx)
 {
     int xt;
-    if (popnum(ctx->ds, &xt))
+    if (popnum(ctx, &xt))
     {
         entry_t *entry = (entry_t *)xt;
+        ctx->current_xt = entry;
+        ctx->w = entry->param;
         return entry->code_ptr(ctx);
     }
     else
@@ -360,10 +401,14 @@ state_t __EXECUTE(context_t *ctx)
 
 state_t __CREATE(context_t *ctx)
 {
-    ctx->tib->token = strtok_r(NULL, DELIMITERS, &ctx->tib->saveptr);
-    if (ctx->tib->token != NULL)
+    int len;
+    char *token = parse_name(ctx, &len);
+    if (token != NULL)
     {
-        add_word(ctx, strdup(ctx->tib->token), ctx->dp);
+        char *name = strndup(token, len);
+        add_word(ctx, name, ctx->dp);
+        ctx->last_word->code_ptr = __REF;
+        free(name);
     }
     return OK;
 }
@@ -392,10 +437,28 @@ state_t __WORDS(context_t *ctx)
     return OK;
 }
 
-state_t __THROW(context_t *ctx)
+state_t __HASH_STATS(context_t *ctx)
+{
+    hashtable_stats_t stats;
+    hashtable_stats(ctx->exe_tok, &stats);
+
+    printf("words: %d  slots: %d  load: %d%%\n", stats.size, stats.capacity, stats.size * 100 / stats.capacity);
+    printf("probe length: max %d, mean %d.%d\n", stats.max_probe,
+           stats.total_probe / max(stats.size, 1),
+           stats.total_probe * 10 / max(stats.size, 1) % 10);
+
+    for (int i = 0; i < HASHTABLE_HISTOGRAM; i++)
+    {
+        printf("  %d%s: %d\n", i, i == HASHTABLE_HISTOGRAM - 1 ? "+" : " ", stats.histogram[i]);
+    }
+    return OK;
+}
+
+// Not __THROW, which the host libc's sys/cdefs.h defines for hosted builds
+state_t __THROW_CODE(context_t *ctx)
 {
     int errno;
-    if (popnum(ctx->ds, &errno))
+    if (popnum(ctx, &errno))
     {
         return error(ctx, errno);
     }
@@ -409,7 +472,7 @@ state_t __QERROR(context_t *ctx)
 {
     int cond;
     int errno;
-    if (popnum(ctx->ds, &errno) && popnum(ctx->ds, &cond))
+    if (popnum(ctx, &errno) && popnum(ctx, &cond))
     {
         return cond == 0 ? OK : error(ctx, errno);
     }
@@ -425,7 +488,7 @@ state_t __MOVE(context_t *ctx)
     addr_t a2;
     unsigned int u;
 
-    if (popnum(ctx->ds, (int)&u) && popnum(ctx->ds, &a2) && popnum(ctx->ds, &a1))
+    if (popnum(ctx, (int *)&u) && popnum(ctx, &a2) && popnum(ctx, &a1))
     {
         memmove((void *)a2, (void *)a1, sizeof(word_t) * u);
         return OK;
@@ -443,7 +506,7 @@ state_t __CMOVE(context_t *ctx)
     addr_t a2;
     unsigned int u;
 
-    if (popnum(ctx->ds, &u) && popnum(ctx->ds, &a2) && popnum(ctx->ds, &a1))
+    if (popnum(ctx, &u) && popnum(ctx, &a2) && popnum(ctx, &a1))
     {
         memmove((void *)a2, (void *)a1, u);
         return OK;
@@ -463,20 +526,97 @@ state_t __BRANCH(context_t *ctx)
 
 state_t __0BRANCH(context_t *ctx)
 {
-    int x;
-    if (popnum(ctx->ds, &x))
+    if (ds_underflows(ctx, 1))
+        return stack_underflow(ctx);
+
+    if (*--ctx->sp == 0)
+        return __BRANCH(ctx);
+
+    ctx->ip++;
+    return OK;
+}
+
+state_t __DO(context_t *ctx)
+{
+    if (ds_underflows(ctx, 2))
+        return stack_underflow(ctx);
+
+    if (rs_overflows(ctx, 2))
+        return rstack_overflow(ctx);
+
+    ctx->sp -= 2;
+    *ctx->rp++ = ctx->sp[0];
+    *ctx->rp++ = ctx->sp[1];
+    return OK;
+}
+
+state_t __QDO(context_t *ctx)
+{
+    if (ds_underflows(ctx, 2))
+        return stack_underflow(ctx);
+
+    if (ctx->sp[-1] == ctx->sp[-2])
     {
-        if (x == 0)
-        {
-            return __BRANCH(ctx);
-        }
-        else
-        {
-            ctx->ip++;
-            return OK;
-        }
+        ctx->sp -= 2;
+        return __BRANCH(ctx);
     }
-    return stack_underflow(ctx);
+
+    ctx->ip++;
+    return __DO(ctx);
+}
+
+state_t __LOOP(context_t *ctx)
+{
+    if (rs_underflows(ctx, 2))
+        return rstack_underflow(ctx);
+
+    if (++ctx->rp[-1] != ctx->rp[-2])
+        return __BRANCH(ctx);
+
+    ctx->rp -= 2;
+    ctx->ip++;
+    return OK;
+}
+
+state_t __PLOOP(context_t *ctx)
+{
+    if (ds_underflows(ctx, 1))
+        return stack_underflow(ctx);
+
+    if (rs_underflows(ctx, 2))
+        return rstack_underflow(ctx);
+
+    if (loop_continues(ctx->rp, *--ctx->sp))
+        return __BRANCH(ctx);
+
+    ctx->rp -= 2;
+    ctx->ip++;
+    return OK;
+}
+
+state_t __I(context_t *ctx)
+{
+    if (rs_underflows(ctx, 1))
+        return rstack_underflow(ctx);
+
+    return pushnum(ctx, ctx->rp[-1]) ? OK : stack_overflow(ctx);
+}
+
+state_t __J(context_t *ctx)
+{
+    if (rs_underflows(ctx, 3))
+        return rstack_underflow(ctx);
+
+    return pushnum(ctx, ctx->rp[-3]) ? OK : stack_overflow(ctx);
+}
+
+state_t __UNLOOP(context_t *ctx)
+{
+    if (rs_underflows(ctx, 2))
+        return rstack_underflow(ctx);
+
+    ctx->rp -= 2;
+    return OK;
 }
 
 state_t __LITERAL(context_t *ctx)
@@ -485,9 +625,9 @@ state_t __LITERAL(context_t *ctx)
         return error(ctx, -14); // use only during compilation
 
     int x;
-    if (popnum(ctx->ds, &x))
+    if (popnum(ctx, &x))
     {
-        literal(ctx, x);
+        literal_ref(ctx, x);
         return OK;
     }
     else
@@ -499,10 +639,10 @@ state_t __LITERAL(context_t *ctx)
 state_t __GT_BODY(context_t *ctx)
 {
     int xt;
-    if (popnum(ctx->ds, &xt))
+    if (popnum(ctx, &xt))
     {
         entry_t *entry = (entry_t *)xt;
-        pushnum(ctx->ds, entry->param.val);
+        pushnum(ctx, entry->param.val);
         return OK;
     }
     else
@@ -514,11 +654,14 @@ state_t __GT_BODY(context_t *ctx)
 state_t __NAME_GT(context_t *ctx)
 {
     int xt;
-    if (popnum(ctx->ds, &xt))
+    if (popnum(ctx, &xt))
     {
+        if (ds_overflows(ctx, 2))
+            return stack_overflow(ctx);
+
         entry_t *entry = (entry_t *)xt;
-        pushnum(ctx->ds, entry->name);
-        pushnum(ctx->ds, strlen(entry->name));
+        pushnum(ctx, (int)entry->name);
+        pushnum(ctx, strlen(entry->name));
         return OK;
     }
     else
@@ -529,8 +672,7 @@ state_t __NAME_GT(context_t *ctx)
 
 state_t __LATEST(context_t *ctx)
 {
-    pushnum(ctx->ds, ctx->last_word);
-    return OK;
+    return pushnum(ctx, (int)ctx->last_word) ? OK : stack_overflow(ctx);
 }
 
 // 00002e2c:  0a 20 ff 2b  |....|  DISASSEMBLE
@@ -542,7 +684,7 @@ state_t __DISASSEMBLE(context_t *ctx)
         char buf[80] = { 0 };
         char *out = buf;
 
-        char hex_addr[sizeof(unsigned int) + 1];
+        char hex_addr[2 * sizeof(unsigned int) + 1];
 
         itoa(addr, hex_addr, 16);
         out = rpad(out, hex_addr, 8, '0');
@@ -550,10 +692,10 @@ state_t __DISASSEMBLE(context_t *ctx)
         out = write(out, ' ');
         out = write(out, ' ');
 
-        out = hex_bytes(out, &value, 4);
+        out = hex_bytes(out, (char *)&value, 4);
         out = write(out, ' ');
         out = write(out, '|');
-        out = safe_puts(out, &value, 4);
+        out = safe_puts(out, (char *)&value, 4);
         out = write(out, '|');
 
         out = write(out, ' ');
@@ -564,22 +706,34 @@ state_t __DISASSEMBLE(context_t *ctx)
 
     int size;
     word_t addr;
-    if (popnum(ctx->ds, &size) && popnum(ctx->ds, (int *)&addr))
+    if (popnum(ctx, &size) && popnum(ctx, (int *)&addr))
     {
-        entry_t *entry = NULL;
+        char operand[16];
+        word_t *cell = (word_t *)addr.ptr;
         for (int i = 0; i < size; i++)
         {
-            int value = addr.ptr[i];
-            // TODO determine a better way to identify XTs - magic number?
-            //if (entry != NULL && strcmp(entry->name, "(LIT)") == 0)
-            //{
-            //    print_line(&value, value, NULL);
-            //}
-            //else
-            //{
-                entry = (entry_t*)value;
-                print_line(&addr.ptr[i], value, entry->name);
-            //}
+            int op = vm_opcode(cell[i]);
+            if (op < 0)
+            {
+                // Not an instruction, so must be inline data
+                print_line((unsigned int)&cell[i], cell[i].val, "");
+                continue;
+            }
+
+            print_line((unsigned int)&cell[i], cell[i].val, vm_opcodes[op].name);
+            for (int n = 0; n < vm_opcodes[op].operands && i + 1 < size; n++)
+            {
+                i++;
+                if (op == OP_CALL || op == OP_PRIM || op == OP_JUMP)
+                {
+                    print_line((unsigned int)&cell[i], cell[i].val, ((entry_t *)cell[i].ptr)->name);
+                }
+                else
+                {
+                    itoa(cell[i].val, operand, 10);
+                    print_line((unsigned int)&cell[i], cell[i].val, operand);
+                }
+            }
         }
         return OK;
     }
@@ -589,13 +743,15 @@ state_t __DISASSEMBLE(context_t *ctx)
     }
 }
 
-
 void init_memory_words(context_t *ctx)
 {
     hashtable_t *htbl = ctx->exe_tok;
     add_primitive(htbl, "CELLS", __CELLS, "( n1 -- n2 )", "n2 is the size in address units of n1 cells.");
+    add_primitive(htbl, "COMPILE,", __COMPILE_COMMA, "( xt -- )", "Append the execution semantics of the definition represented by xt to the execution semantics of the current definition.");
     add_primitive(htbl, ",", __COMMA, "( x -- )", "Reserve one cell of data space and store x in the cell.");
-//    add_primitive(htbl, "ALLOT", __ALLOT, "( n -- )", "If n is greater than zero, reserve n address units of data space. If n is less than zero, release |n| address units of data space. If n is zero, leave the data-space pointer unchanged.");
+    add_primitive(htbl, "C,", __C_COMMA, "( char -- )", "Reserve one character of data space and store char in it.");
+    add_primitive(htbl, "ALLOT", __ALLOT, "( n -- )", "If n is greater than zero, reserve n address units of data space. If n is less than zero, release |n| address units of data space. If n is zero, leave the data-space pointer unchanged. The data-space pointer is then aligned.");
+    add_primitive(htbl, "UNUSED", __UNUSED, "( -- u )", "u is the amount of data space remaining, in address units.");
     add_primitive(htbl, "HERE", __HERE, "( -- addr )","addr is the data-space pointer.");
     add_primitive(htbl, ":", __COLON, "( C: \"<spaces>name\" -- colon-sys )", "Enter compilation state and start the current definition, producing colon-sys.");
     add_primitive(htbl, ";", __SEMICOLON, "( C: colon-sys -- )", "End the current definition, allow it to be found in the dictionary and enter interpretation state, consuming colon-sys.");
@@ -612,9 +768,11 @@ void init_memory_words(context_t *ctx)
     add_primitive(htbl, "CONSTANT", __CONSTANT, "( x \"<spaces>name\" -- )", "Skip leading space delimiters. Parse name delimited by a space. Create a definition for name with the execution semantics: `name Execution: ( -- x )`, which places x on the stack.");
 //    add_primitive(htbl, "WORD", __WORD, "( char \"<chars>ccc<char>\" -- c-addr )", "Skip leading delimiters. Parse characters ccc delimited by char. ");
     add_primitive(htbl, "PARSE", __PARSE, "( char \"ccc<char>\" -- c-addr u )", "Parse ccc delimited by the delimiter char. c-addr is the address (within the input buffer) and u is the length of the parsed string. If the parse area was empty, the resulting string has a zero length.");
-    add_primitive(htbl, "THROW", __THROW, "( i*x -- )", "");
+    add_primitive(htbl, "PARSE-NAME", __PARSE_NAME, "( \"<spaces>name<space>\" -- c-addr u )", "Skip leading space delimiters. Parse name delimited by a space. c-addr is the address of the selected string within the input buffer and u is its length in characters. If the parse area is empty or contains only white space, the resulting string has length zero.");
+    add_primitive(htbl, "THROW", __THROW_CODE, "( i*x -- )", "");
     add_primitive(htbl, "?ERROR", __QERROR, "", "");
     add_primitive(htbl, "WORDS", __WORDS, "( -- )", "List the definition names in alphabetical order.");
+    add_primitive(htbl, "HASH-STATS", __HASH_STATS, "( -- )", "Display the occupancy and probe lengths of the dictionary hash table.");
     add_primitive(htbl, "'", __TICK, "( \"<spaces>name\" -- xt )", "Skip leading space delimiters. Parse name delimited by a space. Find name and return xt, the execution token for name.");
     add_primitive(htbl, "EXECUTE", __EXECUTE, "( i*x xt -- j*x )", "Remove xt from the stack and perform the semantics identified by it. Other stack effects are due to the word EXECUTEd.");
     add_primitive(htbl, "CREATE", __CREATE, "( \"<spaces>name\" -- )", "Skip leading space delimiters. Parse name delimited by a space. Create a definition for name with the execution semantics: name Execution: ( -- a-addr )");
@@ -622,10 +780,18 @@ void init_memory_words(context_t *ctx)
 
     add_primitive(htbl, "IMMEDIATE", __IMMEDIATE, "( -- )", "Make the most recent definition an immediate word.");
     set_flags(htbl, ";", FLAG_IMMEDIATE);
+    add_primitive(htbl, "INLINE", __SET_INLINE, "( -- )", "Make the most recent definition compile in place of calls to it, whatever its size.");
 
     add_primitive(htbl, "BRANCH", __BRANCH, "( -- )", "");
     add_primitive(htbl, "0BRANCH", __0BRANCH, "( x -- )", "");
     add_primitive(htbl, "(LIT)", __DOLIT, "", "");
+    add_primitive(htbl, "(DO)", __DO, "( n1 n2 -- ) ( R: -- loop-sys )", "");
+    add_primitive(htbl, "(?DO)", __QDO, "( n1 n2 -- ) ( R: -- | loop-sys )", "");
+    add_primitive(htbl, "(LOOP)", __LOOP, "( -- ) ( R: loop-sys1 -- | loop-sys2 )", "");
+    add_primitive(htbl, "(+LOOP)", __PLOOP, "( n -- ) ( R: loop-sys1 -- | loop-sys2 )", "");
+    add_primitive(htbl, "I", __I, "( -- n ) ( R: loop-sys -- loop-sys )", "n is a copy of the current (innermost) loop index.");
+    add_primitive(htbl, "J", __J, "( -- n ) ( R: loop-sys1 loop-sys2 -- loop-sys1 loop-sys2 )", "n is a copy of the next-outer loop index.");
+    add_primitive(htbl, "UNLOOP", __UNLOOP, "( -- ) ( R: loop-sys -- )", "Discard the loop-control parameters for the current nesting level.");
     add_primitive(htbl, "LITERAL", __LITERAL, "Compilation: ( x -- ), Runtime: ( -- x )", "Append the run-time semantics to the current definition.");
     set_flags(htbl, "LITERAL", FLAG_IMMEDIATE);
 
@@ -639,5 +805,7 @@ void init_memory_words(context_t *ctx)
     add_constant(ctx, "TIB", (int)ctx->tib->buffer);
     add_constant(ctx, "BASE", (int)&ctx->base);
     add_constant(ctx, "ECHO", (int)&ctx->echo);
+    add_constant(ctx, "JIT", (int)&ctx->jit);
+    add_constant(ctx, "FOLD", (int)&ctx->fold);
     add_constant(ctx, "STATE", (int)&ctx->state);
 }
@@ -1,14 +1,19 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <kernel/tty.h>
 #include <kernel/system.h>
 
 #include <primitives.h>
+#include <forth/resources.h>
 #include <stack_machine/common.h>
+#include <stack_machine/compiler.h>
 #include <stack_machine/context.h>
 #include <stack_machine/entry.h>
 #include <stack_machine/error.h>
+#include <stack_machine/heap.h>
+#include <stack_machine/profiler.h>
 
 #include <util/license.h>
 
@@ -18,11 +23,18 @@ state_t __LICENSE(context_t *ctx)
     return OK;
 }
 
+state_t __BYE(context_t *ctx)
+{
+    (void)ctx;
+    shutdown(0);
+    return OK;
+}
+
 state_t __DUMP(context_t *ctx)
 {
     int size;
     word_t addr;
-    if (popnum(ctx->ds, &size) && popnum(ctx->ds, (int *)&addr))
+    if (popnum(ctx, &size) && popnum(ctx, (int *)&addr))
     {
         if (addr.val >= 0 && size > 0)
         {
@@ -39,10 +51,223 @@ state_t __DUMP(context_t *ctx)
     }
 }
 
+state_t __PROFILE_ON(context_t *ctx)
+{
+    profile_start(ctx);
+    return OK;
+}
+
+state_t __PROFILE_OFF(context_t *ctx)
+{
+    profile_stop(ctx);
+    return OK;
+}
+
+state_t __PROFILE_RESET(context_t *ctx)
+{
+    (void)ctx;
+    profile_reset();
+    return OK;
+}
+
+state_t __DOT_PROFILE(context_t *ctx)
+{
+    (void)ctx;
+    char **text = profile_report();
+    if (text != NULL)
+    {
+        pager(text);
+        free(text);
+    }
+    return OK;
+}
+
+state_t __SAMPLE_ON(context_t *ctx)
+{
+    int hz;
+    if (!popnum(ctx, &hz))
+        return stack_underflow(ctx);
+
+    sample_start(ctx, hz);
+    return OK;
+}
+
+state_t __SAMPLE_OFF(context_t *ctx)
+{
+    (void)ctx;
+    sample_stop();
+    return OK;
+}
+
+state_t __SAMPLE_RESET(context_t *ctx)
+{
+    (void)ctx;
+    sample_reset();
+    return OK;
+}
+
+state_t __DOT_SAMPLES(context_t *ctx)
+{
+    char **text = sample_report(ctx);
+    if (text != NULL)
+    {
+        pager(text);
+        free(text);
+    }
+    return OK;
+}
+
+state_t __HEAP_STATS(context_t *ctx)
+{
+    (void)ctx;
+    char **text = heap_report();
+    if (text != NULL)
+    {
+        pager(text);
+        free(text);
+    }
+    return OK;
+}
+
+state_t __HEAP_TRACE_ON(context_t *ctx)
+{
+    (void)ctx;
+    heap_trace_start();
+    return OK;
+}
+
+state_t __HEAP_TRACE_OFF(context_t *ctx)
+{
+    (void)ctx;
+    heap_trace_stop();
+    return OK;
+}
+
+state_t __CYCLES(context_t *ctx)
+{
+    if (ds_overflows(ctx, 2))
+        return stack_overflow(ctx);
+
+    unsigned long long now = rdtsc();
+    pushnum(ctx, (unsigned int)now);
+    pushnum(ctx, (unsigned int)(now >> 32));
+    return OK;
+}
+
+static state_t execute(context_t *ctx, entry_t *xt)
+{
+    ctx->current_xt = xt;
+    ctx->w = xt->param;
+    return xt->code_ptr(ctx);
+}
+
+state_t __TIMEIT(context_t *ctx)
+{
+    int xt;
+    if (!popnum(ctx, &xt))
+        return stack_underflow(ctx);
+
+    unsigned long long start = rdtsc();
+    state_t retval = execute(ctx, (entry_t *)xt);
+    unsigned long long cycles = rdtsc() - start;
+
+    if (retval == OK)
+    {
+        char buf[24] = { 0 };
+        format_count(buf, cycles, 0);
+        printf("%s cycles ", buf);
+    }
+    return retval;
+}
+
+#define BENCH_NAME 20
+
+/**
+ * Calls xt once to warm up, then n times, and prints its name, n and the
+ * average cycles per call as a row of BENCH's table.
+ */
+state_t __PAREN_BENCH(context_t *ctx)
+{
+    int n, xt;
+    if (!popnum(ctx, &n) || !popnum(ctx, &xt))
+        return stack_underflow(ctx);
+
+    if (n <= 0)
+        return error_msg(ctx, -24, ": iterations must be positive"); // invalid numeric argument
+
+    entry_t *entry = (entry_t *)xt;
+    state_t retval = execute(ctx, entry);
+    unsigned long long start = rdtsc();
+
+    for (int i = 0; i < n && retval == OK; i++)
+        retval = execute(ctx, entry);
+
+    unsigned long long cycles = rdtsc() - start;
+    if (retval != OK)
+        return retval;
+
+    char buf[80] = { 0 };
+    char *out = buf;
+    char *name = entry->name != NULL ? entry->name : "?";
+    int len = min(strlen(name), BENCH_NAME);
+
+    memcpy(out, name, len);
+    out += len;
+    while (out < buf + BENCH_NAME)
+        *out++ = ' ';
+
+    out = format_count(out, n, 10);
+    format_count(out, (long long)((double)(long long)cycles / n), 20);
+    printf("%s\n", buf);
+    return OK;
+}
+
+/**
+ * Runs the benchmarks, interpreting bench.fth first if this is the first
+ * time, so that they take no dictionary space until wanted.
+ */
+state_t __BENCH(context_t *ctx)
+{
+    entry_t *entry;
+    if (find_entry(ctx->exe_tok, "(BENCHMARKS)", &entry) != 0)
+    {
+        // load reads through the TIB, so put back the rest of this line
+        char line[READLINE_BUFSIZ];
+        inbuf_t saved = *ctx->tib;
+        memcpy(line, saved.buffer, saved.length + 1);
+
+        load(ctx, "bench.fth", (char *)&bench_forth);
+        if (ctx->state == ERROR)
+            return ERROR;
+
+        memcpy(ctx->tib->buffer, line, saved.length + 1);
+        *ctx->tib = saved;
+
+        if (find_entry(ctx->exe_tok, "(BENCHMARKS)", &entry) != 0)
+            return error_msg(ctx, -13, ": '%s'", "(BENCHMARKS)"); // word not found
+    }
+    return execute(ctx, entry);
+}
 
 void init_misc_words(context_t *ctx)
 {
     hashtable_t *htbl = ctx->exe_tok;
     add_primitive(htbl, "LICENSE", __LICENSE, "( -- )", "displays the MIT license text.");
+    add_primitive(htbl, "BYE", __BYE, "( -- )", "Shuts the machine down: under QEMU with the isa-debug-exit device, this ends the emulator.");
     add_primitive(htbl, "DUMP", __DUMP, "( n addr -- )", "Dumps n bytes starting from addr.");
+    add_primitive(htbl, "PROFILE-ON", __PROFILE_ON, "( -- )", "Starts counting calls and cycles spent in each word.");
+    add_primitive(htbl, "PROFILE-OFF", __PROFILE_OFF, "( -- )", "Stops profiling, keeping the counts so far.");
+    add_primitive(htbl, "PROFILE-RESET", __PROFILE_RESET, "( -- )", "Clears the profile counts.");
+    add_primitive(htbl, ".PROFILE", __DOT_PROFILE, "( -- )", "Shows calls, self and total cycles for each word profiled, busiest first.");
+    add_primitive(htbl, "SAMPLE-ON", __SAMPLE_ON, "( hz -- )", "Speeds the timer up to hz ticks a second, and samples what is running on each.");
+    add_primitive(htbl, "SAMPLE-OFF", __SAMPLE_OFF, "( -- )", "Stops sampling, and puts the timer back to 18.2 ticks a second.");
+    add_primitive(htbl, "SAMPLE-RESET", __SAMPLE_RESET, "( -- )", "Clears the samples.");
+    add_primitive(htbl, ".SAMPLES", __DOT_SAMPLES, "( -- )", "Shows the samples by word and by address, busiest first.");
+    add_primitive(htbl, "HEAP-STATS", __HEAP_STATS, "( -- )", "Shows the allocator's counters, the allocations per line interpreted and, while tracing, the allocations and live blocks by call site.");
+    add_primitive(htbl, "HEAP-TRACE-ON", __HEAP_TRACE_ON, "( -- )", "Starts recording the call site of each allocation, and listing what a line that ends in an error left allocated.");
+    add_primitive(htbl, "HEAP-TRACE-OFF", __HEAP_TRACE_OFF, "( -- )", "Stops recording call sites.");
+    add_primitive(htbl, "CYCLES", __CYCLES, "( -- ud )", "Pushes the CPU's time stamp counter, the clock cycles since reset, as a double cell.");
+    add_primitive(htbl, "TIMEIT", __TIMEIT, "( i*x xt -- j*x )", "Executes xt and shows the clock cycles it took.");
+    add_primitive(htbl, "(BENCH)", __PAREN_BENCH, "( xt n -- )", "Executes xt n times, after once to warm up, and shows its name, n and the average clock cycles per execution.");
+    add_primitive(htbl, "BENCH", __BENCH, "( -- )", "Runs the benchmarks in bench.fth, loading it the first time, and shows the clock cycles per iteration of each.");
 }
@@ -8,302 +8,250 @@
 
 state_t __DROP(context_t *ctx)
 {
-    int x;
-    if (popnum(ctx->ds, &x))
-    {
-        return OK;
-    }
-    else
-    {
+    if (ds_underflows(ctx, 1))
         return stack_underflow(ctx);
-    }
+
+    ctx->sp--;
+    return OK;
 }
 
 state_t __OVER(context_t *ctx)
 {
-    int x1, x2;
-    if (popnum(ctx->ds, &x2) && popnum(ctx->ds, &x1))
-    {
-        pushnum(ctx->ds, x1);
-        pushnum(ctx->ds, x2);
-        pushnum(ctx->ds, x1);
-        return OK;
-    }
-    else
-    {
+    if (ds_underflows(ctx, 2))
         return stack_underflow(ctx);
-    }
+
+    if (ds_overflows(ctx, 1))
+        return stack_overflow(ctx);
+
+    ctx->sp[0] = ctx->sp[-2];
+    ctx->sp++;
+    return OK;
 }
 
 
 state_t __DUP(context_t *ctx)
 {
-    int x;
-    if (peeknum(ctx->ds, &x))
-    {
-        pushnum(ctx->ds, x);
-        return OK;
-    }
-    else
-    {
+    if (ds_underflows(ctx, 1))
         return stack_underflow(ctx);
-    }
+
+    if (ds_overflows(ctx, 1))
+        return stack_overflow(ctx);
+
+    ctx->sp[0] = ctx->sp[-1];
+    ctx->sp++;
+    return OK;
 }
 
 state_t __QDUP(context_t *ctx)
 {
-    int x;
-    if (peeknum(ctx->ds, &x))
-    {
-        if (x != 0) pushnum(ctx->ds, x);
-        return OK;
-    }
-    else
-    {
+    if (ds_underflows(ctx, 1))
         return stack_underflow(ctx);
+
+    if (ctx->sp[-1] != 0)
+    {
+        if (ds_overflows(ctx, 1))
+            return stack_overflow(ctx);
+
+        ctx->sp[0] = ctx->sp[-1];
+        ctx->sp++;
     }
+    return OK;
 }
 
 
 state_t __SWAP(context_t *ctx)
 {
-    int x1, x2;
-    if (popnum(ctx->ds, &x2) && popnum(ctx->ds, &x1))
-    {
-        pushnum(ctx->ds, x2);
-        pushnum(ctx->ds, x1);
-        return OK;
-    }
-    else
-    {
+    if (ds_underflows(ctx, 2))
         return stack_underflow(ctx);
-    }
+
+    int x2 = ctx->sp[-1];
+    ctx->sp[-1] = ctx->sp[-2];
+    ctx->sp[-2] = x2;
+    return OK;
 }
 
 state_t __2DROP(context_t *ctx)
 {
-    int x1, x2;
-    if (popnum(ctx->ds, &x2) && popnum(ctx->ds, &x1))
-    {
-        return OK;
-    }
-    else
-    {
+    if (ds_underflows(ctx, 2))
         return stack_underflow(ctx);
-    }
+
+    ctx->sp -= 2;
+    return OK;
 }
 
 
 state_t __2SWAP(context_t *ctx)
 {
-    int x1, x2, x3, x4;
-    if (popnum(ctx->ds, &x4) && popnum(ctx->ds, &x3) && popnum(ctx->ds, &x2) && popnum(ctx->ds, &x1))
-    {
-        pushnum(ctx->ds, x3);
-        pushnum(ctx->ds, x4);
-        pushnum(ctx->ds, x1);
-        pushnum(ctx->ds, x2);
-        return OK;
-    }
-    else
-    {
+    if (ds_underflows(ctx, 4))
         return stack_underflow(ctx);
-    }
+
+    int *sp = ctx->sp;
+    int x1 = sp[-4], x2 = sp[-3];
+    sp[-4] = sp[-2];
+    sp[-3] = sp[-1];
+    sp[-2] = x1;
+    sp[-1] = x2;
+    return OK;
 }
 
 
 state_t __2DUP(context_t *ctx)
 {
-    int x1, x2;
-    if (popnum(ctx->ds, &x2) && popnum(ctx->ds, &x1))
-    {
-        pushnum(ctx->ds, x1);
-        pushnum(ctx->ds, x2);
-        pushnum(ctx->ds, x1);
-        pushnum(ctx->ds, x2);
-        return OK;
-    }
-    else
-    {
+    if (ds_underflows(ctx, 2))
         return stack_underflow(ctx);
-    }
+
+    if (ds_overflows(ctx, 2))
+        return stack_overflow(ctx);
+
+    int *sp = ctx->sp;
+    sp[0] = sp[-2];
+    sp[1] = sp[-1];
+    ctx->sp += 2;
+    return OK;
 }
 
 state_t __2OVER(context_t *ctx)
 {
-    int x1, x2, x3, x4;
-    if (popnum(ctx->ds, &x4) && popnum(ctx->ds, &x3) && popnum(ctx->ds, &x2) && popnum(ctx->ds, &x1))
-    {
-        pushnum(ctx->ds, x1);
-        pushnum(ctx->ds, x2);
-        pushnum(ctx->ds, x3);
-        pushnum(ctx->ds, x4);
-        pushnum(ctx->ds, x1);
-        pushnum(ctx->ds, x2);
-        return OK;
-    }
-    else
-    {
+    if (ds_underflows(ctx, 4))
         return stack_underflow(ctx);
-    }
+
+    if (ds_overflows(ctx, 2))
+        return stack_overflow(ctx);
+
+    int *sp = ctx->sp;
+    sp[0] = sp[-4];
+    sp[1] = sp[-3];
+    ctx->sp += 2;
+    return OK;
 }
 
 state_t __NIP(context_t *ctx)
 {
-    int x1, x2;
-    if (popnum(ctx->ds, &x2) && popnum(ctx->ds, &x1))
-    {
-        pushnum(ctx->ds, x2);
-        return OK;
-    }
-    else
-    {
+    if (ds_underflows(ctx, 2))
         return stack_underflow(ctx);
-    }
+
+    ctx->sp[-2] = ctx->sp[-1];
+    ctx->sp--;
+    return OK;
 }
 
 
 state_t __TUCK(context_t *ctx)
 {
-    int x1, x2;
-    if (popnum(ctx->ds, &x2) && popnum(ctx->ds, &x1))
-    {
-        pushnum(ctx->ds, x2);
-        pushnum(ctx->ds, x1);
-        pushnum(ctx->ds, x2);
-        return OK;
-    }
-    else
-    {
+    if (ds_underflows(ctx, 2))
         return stack_underflow(ctx);
-    }
+
+    if (ds_overflows(ctx, 1))
+        return stack_overflow(ctx);
+
+    int *sp = ctx->sp;
+    int x2 = sp[-1];
+    sp[0] = x2;
+    sp[-1] = sp[-2];
+    sp[-2] = x2;
+    ctx->sp++;
+    return OK;
 }
 
 
 state_t __ROT(context_t *ctx)
 {
-    int x1, x2, x3;
-    if (popnum(ctx->ds, &x3) && popnum(ctx->ds, &x2) && popnum(ctx->ds, &x1))
-    {
-        pushnum(ctx->ds, x2);
-        pushnum(ctx->ds, x3);
-        pushnum(ctx->ds, x1);
-        return OK;
-    }
-    else
-    {
+    if (ds_underflows(ctx, 3))
         return stack_underflow(ctx);
-    }
+
+    int *sp = ctx->sp;
+    int x1 = sp[-3];
+    sp[-3] = sp[-2];
+    sp[-2] = sp[-1];
+    sp[-1] = x1;
+    return OK;
 }
 
 state_t __MINROT(context_t *ctx)
 {
-    int x1, x2, x3;
-    if (popnum(ctx->ds, &x3) && popnum(ctx->ds, &x2) && popnum(ctx->ds, &x1))
-    {
-        pushnum(ctx->ds, x3);
-        pushnum(ctx->ds, x1);
-        pushnum(ctx->ds, x2);
-        return OK;
-    }
-    else
-    {
+    if (ds_underflows(ctx, 3))
         return stack_underflow(ctx);
-    }
+
+    int *sp = ctx->sp;
+    int x3 = sp[-1];
+    sp[-1] = sp[-2];
+    sp[-2] = sp[-3];
+    sp[-3] = x3;
+    return OK;
 }
 
 
 state_t __DEPTH(context_t *ctx)
 {
-    pushnum(ctx->ds, stack_size(ctx->ds));
-    return OK;
+    return pushnum(ctx, ds_depth(ctx)) ? OK : stack_overflow(ctx);
 }
 
 state_t __RDEPTH(context_t *ctx)
 {
-    pushnum(ctx->ds, stack_size(ctx->rs));
-    return OK;
+    return pushnum(ctx, rs_depth(ctx)) ? OK : stack_overflow(ctx);
 }
 
 
 state_t __TOR(context_t *ctx)
 {
-    int x1;
-    if (popnum(ctx->ds, &x1))
-    {
-        pushnum(ctx->rs, x1);
-        return OK;
-    }
-    else
-    {
+    if (ds_underflows(ctx, 1))
         return stack_underflow(ctx);
-    }
+
+    if (rs_overflows(ctx, 1))
+        return rstack_overflow(ctx);
+
+    *ctx->rp++ = *--ctx->sp;
+    return OK;
 }
 
 
 state_t __RFROM(context_t *ctx)
 {
-    int x1;
-    if (popnum(ctx->rs, &x1))
-    {
-        pushnum(ctx->ds, x1);
-        return OK;
-    }
-    else
-    {
-        return error(ctx, -6);  // return stack underflow
-    }
+    if (rs_underflows(ctx, 1))
+        return rstack_underflow(ctx);
+
+    if (ds_overflows(ctx, 1))
+        return stack_overflow(ctx);
+
+    *ctx->sp++ = *--ctx->rp;
+    return OK;
 }
 
 state_t __RFETCH(context_t *ctx)
 {
-    int x1;
-    if (peeknum(ctx->rs, &x1))
-    {
-        pushnum(ctx->ds, x1);
-        return OK;
-    }
-    else
-    {
-        return error(ctx, -6);  // return stack underflow
-    }
+    if (rs_underflows(ctx, 1))
+        return rstack_underflow(ctx);
+
+    if (ds_overflows(ctx, 1))
+        return stack_overflow(ctx);
+
+    *ctx->sp++ = ctx->rp[-1];
+    return OK;
 }
 
 
 state_t __RDROP(context_t *ctx)
 {
-    int x;
-    if (popnum(ctx->rs, &x))
-    {
-        return OK;
-    }
-    else
-    {
-        return error(ctx, -6);  // return stack underflow
-    }
+    if (rs_underflows(ctx, 1))
+        return rstack_underflow(ctx);
+
+    ctx->rp--;
+    return OK;
 }
 
 
 state_t __PICK(context_t *ctx)
 {
-    int u;
-    if (popnum(ctx->ds, &u))
-    {
-        dlist_elem_t *element = dlist_head(ctx->ds);
-        while (u >= 0 && element != NULL)
-        {
-            if (u == 0)
-            {
-                int *num = dlist_data(element);
-                pushnum(ctx->ds, *num);
-                return OK;
-            }
-            u--;
-            element = dlist_next(element);
-        }
-    }
+    if (ds_underflows(ctx, 1))
+        return stack_underflow(ctx);
+
+    // u is replaced in-situ by xu, so cannot overflow
+    int u = ctx->sp[-1];
+    if (u < 0 || ds_underflows(ctx, u + 2))
+        return error(ctx, -11);  // result out of range
 
-    return error(ctx, -11);  // result out of range
+    ctx->sp[-1] = ctx->sp[-2 - u];
+    return OK;
 }
 
 
@@ -2,38 +2,82 @@
 #include <stdio.h>
 #include <string.h>
 
-#include <collections/stack.h>
+#include <kernel/system.h>
+
 #include <stack_machine/common.h>
 #include <stack_machine/entry.h>
 
+/**
+ * Allocate a stack of the given number of cells, on pages of its own with
+ * a guard page either side, and ending where the upper one starts (see
+ * common.h). Stacks live as long as the context, so the block is never
+ * freed, and its guard pages never mapped again. Returns NULL if either
+ * guard page can't be unmapped, as nothing else stops a primitive running
+ * off the stack.
+ */
+int *alloc_stack(int cells)
+{
+    int size = stack_bytes(cells);
+    char *block = valloc(size + 2 * PAGE_SIZE);
+    if (block == NULL)
+        return NULL;
+
+    if (mmu_guard(block) != 0)
+    {
+        free(block);
+        return NULL;
+    }
+
+    // With its first page unmapped, the block can't go back to the heap
+    if (mmu_guard(block + PAGE_SIZE + size) != 0)
+        return NULL;
+
+    return (int *)(block + PAGE_SIZE + size) - cells;
+}
+
 // TODO: change int *num to word_t *num
-int popnum(stack_t *stack, int *num)
+int popnum(context_t *ctx, int *num)
 {
-    if (stack_empty(stack))
+    if (ds_underflows(ctx, 1))
         return false;
 
-    int *data;
-    stack_pop(stack, (void **)&data);
-    *num = *data;
-    free(data);
+    *num = *--ctx->sp;
     return true;
 }
 
-int peeknum(stack_t *stack, int *num)
+int peeknum(context_t *ctx, int *num)
 {
-    if (stack_empty(stack))
+    if (ds_underflows(ctx, 1))
         return false;
 
-    int *data = stack_peek(stack);
-    *num = *data;
+    *num = ctx->sp[-1];
     return true;
 }
 
-int pushnum(stack_t *stack, int num)
+int pushnum(context_t *ctx, int num)
 {
-    int *n = malloc(sizeof(int));
-    *n = num;
-    stack_push(stack, n);
+    if (ds_overflows(ctx, 1))
+        return false;
+
+    *ctx->sp++ = num;
+    return true;
+}
+
+int rpopnum(context_t *ctx, int *num)
+{
+    if (rs_underflows(ctx, 1))
+        return false;
+
+    *num = *--ctx->rp;
+    return true;
+}
+
+int rpushnum(context_t *ctx, int num)
+{
+    if (rs_overflows(ctx, 1))
+        return false;
+
+    *ctx->rp++ = num;
     return true;
 }
 
@@ -49,22 +93,70 @@ int printnum(int num, int base)
     return true;
 }
 
-int parsenum(char *s, int *num, int base)
+#define __ 0xFF
+
+// Digit value of each character, in any base up to 36
+static const unsigned char digit_value[256] = {
+    __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __,
+    __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __,
+    __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, __, __, __, __, __, __,
+    __, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24,
+    25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, __, __, __, __, __,
+    __, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24,
+    25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, __, __, __, __, __,
+    [128 ... 255] = __
+};
+
+#undef __
+
+/**
+ * Converts the len characters at addr to a single cell number in a
+ * single pass, without copying. Accepts an optional $ (hex), # (decimal)
+ * or % (binary) prefix overriding base, then an optional '-', or a 'c'
+ * character literal. Fails if any character is not a digit in the base,
+ * or if the magnitude does not fit in a cell.
+ */
+int parsenum(const char *addr, int len, int *num, int base)
 {
-    int i = atoi(s, base);
-    int len = strlen(s) + 1;
-    char *copy = calloc(0, len);
-    itoa(i, copy, base);
-    int retval = memcmp(s, copy, len);
-    free((void *)copy);
-
-    if (retval == 0)
+    const char *end = addr + len;
+
+    if (len == 3 && addr[0] == '\'' && addr[2] == '\'')
     {
-        *num = i;
+        *num = (unsigned char) addr[1];
         return true;
     }
-    else
+
+    if (addr < end)
     {
+        switch (*addr)
+        {
+            case '$': base = 16; addr++; break;
+            case '#': base = 10; addr++; break;
+            case '%': base = 2;  addr++; break;
+        }
+    }
+
+    int negative = addr < end && *addr == '-';
+    if (negative)
+        addr++;
+
+    if (addr == end || base < 2 || base > 36)
         return false;
+
+    // Unsigned numbers may use the whole cell, negated ones only down to INT_MIN
+    unsigned limit = negative ? 0x80000000u : 0xFFFFFFFFu;
+    unsigned accum = 0;
+
+    while (addr < end)
+    {
+        unsigned digit = digit_value[(unsigned char) *addr++];
+        if (digit >= (unsigned) base || accum > (limit - digit) / base)
+            return false;
+
+        accum = accum * base + digit;
     }
+
+    *num = negative ? -accum : accum;
+    return true;
 }
@@ -8,31 +8,443 @@
 #include <stack_machine/compiler.h>
 #include <stack_machine/entry.h>
 #include <stack_machine/interpreter.h>
+#include <stack_machine/vm.h>
 
 
+/**
+ * The dictionary has a bit in ctx->refs for each cell laid down as an
+ * address (an opcode, an xt, a variable's address) or by , or LITERAL,
+ * which may hold one. SAVE-SYSTEM only relocates the cells marked.
+ */
+void set_ref(context_t *ctx, word_t *cell, int ref)
+{
+    unsigned int i = cell - ctx->mem;
+    if (ref)
+        ctx->refs[i / 32] |= 1u << (i % 32);
+    else
+        ctx->refs[i / 32] &= ~(1u << (i % 32));
+}
+
+int is_ref(context_t *ctx, word_t *cell)
+{
+    unsigned int i = cell - ctx->mem;
+    return (ctx->refs[i / 32] >> (i % 32)) & 1;
+}
+
 /**
  * Allocate a word of space in memory, and advance DP by
- * the size of word (4 bytes).
+ * the size of word (4 bytes). Running out is caught by the caller, or
+ * after the token by interpret, before the guard is used up.
  */
 word_t *comma(context_t *ctx, word_t num)
 {
-    assert(ctx->dp - ctx->mem < MEMSIZ);
-    ctx->dp = align(ctx->dp);
+    ctx->dp = (word_t *)align(ctx->dp);
+    assert((byte_t *)ctx->dp + CELL <= (byte_t *)ctx->mem_end + DICTIONARY_GUARD);
     *ctx->dp = num;
+    set_ref(ctx, ctx->dp, false);
     return ctx->dp++;
 }
 
+/**
+ * As comma, for a cell that holds, or may hold, an address.
+ */
+word_t *comma_ref(context_t *ctx, word_t ref)
+{
+    word_t *cell = comma(ctx, ref);
+    set_ref(ctx, cell, true);
+    return cell;
+}
+
 
-void literal(context_t *ctx, int n)
+/**
+ * True for words defined with ':' (threaded or compiled to native code),
+ * whose param field holds their thread.
+ */
+int is_colon_definition(entry_t *xt)
 {
-    entry_t *entry;
-    if (find_entry(ctx->exe_tok, "(LIT)", &entry) == 0)
+    return xt->code_ptr != __REF && !(xt->flags & (FLAG_PRIMITIVE | FLAG_CONSTANT | FLAG_VARIABLE));
+}
+
+/**
+ * Pairs of instructions the peephole stage replaces with a single one.
+ * The fused opcode keeps the first instruction's operands; any operand of
+ * the second (the 0BRANCH offset) is laid down after it as usual.
+ */
+static const struct {
+    opcode_t first, second, fused;
+} superinstructions[] = {
+    { OP_LIT,       OP_ADD,     OP_LIT_ADD },
+    { OP_LIT,       OP_EQ,      OP_LIT_EQ },
+    { OP_LIT_EQ,    OP_0BRANCH, OP_LIT_EQ_0BRANCH },
+    { OP_OVER,      OP_OVER,    OP_2DUP },
+    { OP_DUP,       OP_MUL,     OP_SQUARE },
+    { OP_RFROM,     OP_DROP,    OP_RDROP },
+    { OP_FETCH,     OP_ADD,     OP_FETCH_ADD },
+    { OP_SWAP,      OP_DROP,    OP_NIP },
+};
+
+/**
+ * Before an EXIT, rewrites a call just compiled into a jump that reuses
+ * the caller's return stack frame, or, for the word being defined (i.e.
+ * RECURSE), into a branch back to its start. The EXIT stays, as other
+ * paths may branch to it. Words reading their caller's return address
+ * must still be called.
+ */
+static void tail_call(context_t *ctx)
+{
+    word_t *prev = ctx->last_op;
+    if (prev == NULL || prev + 2 != (word_t *)align(ctx->dp))
+        return;
+
+    int op = vm_opcode(*prev);
+    entry_t *xt = (entry_t *)prev[1].ptr;
+    if ((op != OP_CALL && op != OP_PRIM) || !is_colon_definition(xt) || is_set(xt, FLAG_NO_JIT))
+        return;
+
+    if (xt == ctx->last_word && entry_info(xt)->alloc_size == 0)
+    {
+        prev[0].code = vm_code[OP_BRANCH];
+        prev[1].val = (byte_t *)xt->param.ptr - (byte_t *)&prev[1];
+        set_ref(ctx, &prev[1], false);
+    }
+    else
+    {
+        prev[0].code = vm_code[OP_JUMP];
+    }
+}
+
+/**
+ * Evaluates a pure unary or binary opcode on literal operands exactly as
+ * the inner interpreter would. Returns false when op can't be folded, or
+ * would fault or be undefined at run time, so is left for then.
+ */
+static int fold_unary(int op, int a, int *result)
+{
+    switch (op)
+    {
+        case OP_INC:    *result = (unsigned int)a + 1; break;
+        case OP_DEC:    *result = (unsigned int)a - 1; break;
+        case OP_DBL:    *result = (unsigned int)a * 2; break;
+        case OP_NEG:    *result = -(unsigned int)a; break;
+        case OP_INVERT: *result = ~a; break;
+        case OP_ISZERO: *result = a == 0 ? -1 : 0; break;
+        case OP_ISNEG:  *result = a < 0 ? -1 : 0; break;
+        default:        return false;
+    }
+    return true;
+}
+
+static int fold_binary(int op, int a, int b, int *result)
+{
+    switch (op)
+    {
+        case OP_ADD:    *result = (unsigned int)a + b; break;
+        case OP_SUB:    *result = (unsigned int)a - b; break;
+        case OP_MUL:    *result = (unsigned int)a * b; break;
+        case OP_AND:    *result = a & b; break;
+        case OP_OR:     *result = a | b; break;
+        case OP_XOR:    *result = a ^ b; break;
+        case OP_EQ:     *result = a == b ? -1 : 0; break;
+        case OP_NEQ:    *result = a != b ? -1 : 0; break;
+        case OP_LT:     *result = a < b ? -1 : 0; break;
+        case OP_GT:     *result = a > b ? -1 : 0; break;
+
+        case OP_DIV:
+        case OP_MOD:
+            if (b == 0 || div_overflows(a, b))
+                return false;
+            *result = op == OP_DIV ? a / b : a % b;
+            break;
+
+        case OP_LSHIFT:
+        case OP_RSHIFT:
+            if (b < 0 || b > 31)
+                return false;
+            *result = op == OP_LSHIFT ? (int)((unsigned int)a << b) : a >> b;
+            break;
+
+        default:
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Computes the magic multiplier and shift for signed division by d >= 2,
+ * as in Hacker's Delight (10-1): the quotient is the high half of the
+ * product, shifted, and rounded up if negative.
+ */
+static void div_magic(int d, int *magic, int *shift)
+{
+    const unsigned int two31 = 0x80000000;
+    unsigned int anc = two31 - 1 - two31 % d;
+    unsigned int q1 = two31 / anc, r1 = two31 - q1 * anc;
+    unsigned int q2 = two31 / d, r2 = two31 - q2 * d;
+    unsigned int delta;
+    int p = 31;
+
+    do
+    {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc)
+        {
+            q1++;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= (unsigned int)d)
+        {
+            q2++;
+            r2 -= d;
+        }
+        delta = d - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+
+    *magic = q2 + 1;
+    *shift = p - 32;
+}
+
+static int is_literal(word_t *insn, word_t *end)
+{
+    return insn != NULL && vm_opcode(*insn) == OP_LIT && insn + 2 == end;
+}
+
+/**
+ * Rewrites a multiplication or division by the positive literal just
+ * compiled: by one it vanishes, by a power of two it becomes a shift, and
+ * any other divisor becomes a multiply by its reciprocal.
+ */
+static int strength_reduce(context_t *ctx, int op, word_t *lit)
+{
+    int n = lit[1].val;
+    if ((op != OP_MUL && op != OP_DIV) || n <= 0)
+        return false;
+
+    if (n == 1)
+    {
+        ctx->dp = lit;
+        ctx->last_op = ctx->prev_op;
+        ctx->prev_op = NULL;
+        return true;
+    }
+
+    int k = (n & (n - 1)) == 0 ? __builtin_ctz(n) : -1;
+    if (op == OP_MUL && k == 1)
+    {
+        lit[0].code = vm_code[OP_DBL];
+        ctx->dp = lit + 1;
+    }
+    else if (op == OP_MUL && k > 1)
+    {
+        lit[1].val = k;
+        set_ref(ctx, &lit[1], false);
+        ctx->prev_op = lit;
+        ctx->last_op = comma_ref(ctx, (word_t){ .code = vm_code[OP_LSHIFT] });
+    }
+    else if (op == OP_DIV && k > 0)
     {
-        compile(ctx, 2, entry, n);
+        lit[0].code = vm_code[OP_DIV_SHIFT];
+        lit[1].val = k;
+        set_ref(ctx, &lit[1], false);
     }
+    else if (op == OP_DIV)
+    {
+        int magic, shift;
+        div_magic(n, &magic, &shift);
+        lit[0].code = vm_code[OP_DIV_MAGIC];
+        lit[1].val = magic;
+        set_ref(ctx, &lit[1], false);
+        comma(ctx, (word_t){ .val = shift });
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Folds op into the literal(s) just compiled, if it can be evaluated now.
+ * Like fusion, this relies on last_op and prev_op only ever spanning
+ * straight-line code.
+ */
+static int fold_constants(context_t *ctx, int op)
+{
+    word_t *lit = ctx->last_op;
+    if (!is_literal(lit, (word_t *)align(ctx->dp)))
+        return false;
+
+    int result;
+    if (fold_unary(op, lit[1].val, &result))
+    {
+        lit[1].val = result;
+        return true;
+    }
+
+    word_t *lhs = ctx->prev_op;
+    if (is_literal(lhs, lit) && fold_binary(op, lhs[1].val, lit[1].val, &result))
+    {
+        lhs[1].val = result;
+        set_ref(ctx, &lhs[1], is_ref(ctx, &lhs[1]) || is_ref(ctx, &lit[1]));
+        ctx->dp = lit;
+        ctx->last_op = lhs;
+        ctx->prev_op = NULL;
+        return true;
+    }
+
+    return strength_reduce(ctx, op, lit);
+}
+
+/**
+ * Lays down op, first trying to fold it into preceding literals (if FOLD
+ * is set), or else fuse it with the previous instruction. That is only
+ * safe while nothing else has been compiled since, and no branch can land
+ * in between: HERE clears last_op, since every control structure takes
+ * its labels through it.
+ */
+void compile_op(context_t *ctx, int op)
+{
+    if (op == OP_EXIT)
+        tail_call(ctx);
+
+    if (ctx->fold && fold_constants(ctx, op))
+        return;
+
+    word_t *prev = ctx->last_op;
+    int first = prev != NULL ? vm_opcode(*prev) : -1;
+    if (first >= 0 && prev + 1 + vm_opcodes[first].operands == (word_t *)align(ctx->dp))
+    {
+        for (unsigned int i = 0; i < sizeof(superinstructions) / sizeof(superinstructions[0]); i++)
+        {
+            if ((int)superinstructions[i].first == first && (int)superinstructions[i].second == op)
+            {
+                prev->code = vm_code[superinstructions[i].fused];
+                ctx->dp = prev + 1 + vm_opcodes[first].operands;
+                return;
+            }
+        }
+        ctx->prev_op = prev;
+    }
+    else
+    {
+        ctx->prev_op = NULL;
+    }
+
+    ctx->last_op = comma_ref(ctx, (word_t){ .code = vm_code[op] });
+}
+
+/**
+ * Returns the number of cells of xt's thread (less the final EXIT) that
+ * can be copied in place of a call to it, or -1 if it must be called.
+ * Only whole instructions are allowed, so no inline data, and no EXIT
+ * before the end; a tail JUMP is copied back as a CALL. Words reaching into their caller's frame are marked
+ * FLAG_NO_JIT by the return stack analysis at ';', and are never inlined;
+ * anything else balances its own >R / R> and loop frames.
+ */
+static int inline_size(entry_t *xt)
+{
+    if (!is_colon_definition(xt) || is_set(xt, FLAG_NO_JIT))
+        return -1;
+
+    word_t *body = (word_t *)xt->param.ptr;
+    int ncells = entry_info(xt)->alloc_size / sizeof(word_t) - 1;
+    if (ncells < 1 || vm_opcode(body[ncells]) != OP_EXIT)
+        return -1;
+
+    if (ncells > INLINE_THRESHOLD && !is_set(xt, FLAG_INLINE))
+        return -1;
+
+    int c = 0;
+    while (c < ncells)
+    {
+        int op = vm_opcode(body[c]);
+        if (op < 0 || op == OP_EXIT || op == OP_HALT || (op == OP_JUMP && c + 2 != ncells))
+            return -1;
+
+        c += 1 + vm_opcodes[op].operands;
+    }
+
+    return c == ncells ? ncells : -1;
+}
+
+/**
+ * Copies an inlineable thread into the current definition. Branch offsets
+ * are relative, so they survive the move; a branch to the dropped EXIT
+ * lands on whatever is compiled next. Straight-line threads go through
+ * the peephole stage one instruction at a time, so they fuse with their
+ * surroundings too.
+ */
+static void compile_inline(context_t *ctx, entry_t *xt, int ncells)
+{
+    word_t *body = (word_t *)xt->param.ptr;
+    int branches = false;
+
+    for (int c = 0; c < ncells; c += 1 + vm_opcodes[vm_opcode(body[c])].operands)
+    {
+        if (vm_is_branch(vm_opcode(body[c])))
+            branches = true;
+    }
+
+    if (branches)
+    {
+        for (int c = 0; c < ncells; c++)
+        {
+            word_t *cell = comma(ctx, vm_opcode(body[c]) == OP_JUMP && c + 2 == ncells ? (word_t){ .code = vm_code[OP_CALL] } : body[c]);
+            set_ref(ctx, cell, is_ref(ctx, &body[c]));
+        }
+
+        ctx->last_op = ctx->prev_op = NULL;
+        return;
+    }
+
+    for (int c = 0; c < ncells; )
+    {
+        int op = vm_opcode(body[c++]);
+        compile_op(ctx, op == OP_JUMP ? OP_CALL : op);
+        for (int n = 0; n < vm_opcodes[op].operands; n++, c++)
+            set_ref(ctx, comma(ctx, body[c]), is_ref(ctx, &body[c]));
+    }
+}
+
+void literal(context_t *ctx, int n)
+{
+    compile_op(ctx, OP_LIT);
+    comma(ctx, (word_t){ .val = n });
+}
+
+/**
+ * As literal, for a value that is, or may be, an address.
+ */
+void literal_ref(context_t *ctx, int n)
+{
+    compile_op(ctx, OP_LIT);
+    comma_ref(ctx, (word_t){ .val = n });
+}
+
+/**
+ * Lay down the threaded code for a call to xt: words the inner interpreter
+ * implements directly compile to their opcode, variables and constants to
+ * a literal, short colon definitions to a copy of their thread, and
+ * everything else to a CALL or PRIM with the xt inline.
+ */
+void compile_xt(context_t *ctx, entry_t *xt)
+{
+    int op = vm_primitive_opcode(xt->code_ptr);
+    int ncells;
+    if (op >= 0)
+        compile_op(ctx, op);
+    else if ((ncells = inline_size(xt)) > 0 && !dp_overflows(ctx, ncells * CELL))
+        compile_inline(ctx, xt, ncells);
+    else if (xt->code_ptr == __REF)
+        literal_ref(ctx, xt->param.val);
     else
     {
-        assert(false); // Failed to find (LIT)
+        compile_op(ctx, xt->code_ptr == __EXEC ? OP_CALL : OP_PRIM);
+        comma_ref(ctx, (word_t){ .ptr = (int *)xt });
     }
 }
 
@@ -5,56 +5,226 @@
 #include <stack_machine/common.h>
 #include <stack_machine/context.h>
 #include <stack_machine/entry.h>
+#include <stack_machine/error.h>
+#include <stack_machine/vm.h>
 #include <collections/hashtable.h>
 
 state_t __REF(context_t *ctx)
 {
-    pushnum(ctx->ds, ctx->w.val);
-    return OK;
+    return pushnum(ctx, ctx->w.val) ? OK : stack_overflow(ctx);
 }
 
 void indent(context_t *ctx)
 {
-    for (int i = 0, n = stack_size(ctx->rs); i < n; i++)
+    for (int i = 0, n = rs_depth(ctx); i < n; i++)
         printf("  ");
 }
 
 state_t __EXEC(context_t *ctx)
 {
-    if (ctx->echo)
+    return vm_run(ctx, (word_t *)ctx->w.ptr);
+}
+
+/**
+ * Hashes a name, folding it to upper case as it goes, so that lookups
+ * can hash the token straight out of the input buffer.
+ */
+unsigned int name_hash(const char *addr, int len)
+{
+    // FNV-1a: the dictionary table indexes on the low bits, which the old
+    // ELF hash left nearly constant for names differing only at the end
+    unsigned int val = 2166136261u;
+
+    for (int i = 0; i < len; i++)
     {
-        indent(ctx);
-        printf("Calling: 0x%x: %s   (%d)\n", ctx->ip, ctx->current_xt->name, ctx->current_xt);
+        val ^= (unsigned char) toupper(addr[i]);
+        val *= 16777619u;
     }
 
-    ctx->current_xt = (entry_t *)*ctx->w.ptr;
-    for (;;)
+    return val;
+}
+
+/**
+ * Compares len characters of addr, in any case, against a dictionary
+ * name (which is always stored in upper case).
+ */
+int name_matches(const char *name, const char *addr, int len)
+{
+    for (int i = 0; i < len; i++)
     {
+        if (name[i] != toupper(addr[i]))
+            return false;
+    }
+    return true;
+}
 
-        if (ctx->current_xt->code_ptr == __EXEC)
-        {
-            if (ctx->echo)
-            {
-                indent(ctx);
-                printf("Calling: 0x%x: %s   (%d)\n", ctx->ip, ctx->current_xt->name, ctx->current_xt);
-            }
-            ctx->current_xt = (entry_t *)*ctx->w.ptr;
-        }
+// Bitmap of the (upper case) first characters of every name ever defined
+static unsigned char first_chars[256 / 8];
 
-        if (ctx->echo)
-        {
-            indent(ctx);
-            printf("  Executing: 0x%x: %s   (%d)\n", ctx->ip, ctx->current_xt->name, ctx->current_xt);
-        }
+/**
+ * Returns false if no dictionary name starts with the character, so the
+ * interpreter can treat the token as a number without a lookup.
+ */
+int may_start_word(char c)
+{
+    unsigned char u = toupper(c);
+    return (first_chars[u >> 3] >> (u & 7)) & 1;
+}
+
+/*
+ * Headers are allocated from chunks rather than one by one: the fields
+ * used to find and run a word are packed together in one array, and the
+ * rest, only wanted when compiling or documenting it, in a parallel one.
+ * The names are copied, in upper case, into chunks of their own.
+ */
+
+#define HEADER_CHUNK 128
+#define NAME_CHUNK 4096
+
+typedef struct header_chunk {
+    struct header_chunk *next;
+    int used;
+    entry_t entries[HEADER_CHUNK];
+    entry_info_t info[HEADER_CHUNK];
+} header_chunk_t;
+
+static header_chunk_t *header_chunks;
+static entry_t *free_entries;       // linked through param
+static char *names, *names_end;
 
-        state_t retval = ctx->current_xt->code_ptr(ctx);
-        if (stack_empty(ctx->rs) || retval == ERROR)
-            return retval;
+static entry_t *alloc_entry(void)
+{
+    entry_t *entry = free_entries;
+    if (entry != NULL)
+    {
+        free_entries = (entry_t *)entry->param.ptr;
+        entry->param.ptr = NULL;
+        return entry;
+    }
 
-        ctx->current_xt = (entry_t *)(*(ctx->ip)).addr;
-        ctx->w = ctx->current_xt->param;
-        ctx->ip++;
+    header_chunk_t *chunk = header_chunks;
+    if (chunk == NULL || chunk->used == HEADER_CHUNK)
+    {
+        chunk = calloc(1, sizeof(header_chunk_t));
+        assert(chunk != NULL);
+        chunk->next = header_chunks;
+        header_chunks = chunk;
     }
+
+    return &chunk->entries[chunk->used++];
+}
+
+/**
+ * Returns an entry's header to be allocated again. Nothing may refer
+ * to it any more.
+ */
+void free_entry(entry_t *entry)
+{
+    memset(entry_info(entry), 0, sizeof(entry_info_t));
+    memset(entry, 0, sizeof(entry_t));
+    entry->param.ptr = (void *)free_entries;
+    free_entries = entry;
+}
+
+/**
+ * Copies a header from boot, the first time it is about to be replaced,
+ * so that restore_builtin can put it back. The copy is a header of its
+ * own that never goes in a dictionary.
+ */
+void keep_builtin(entry_t *entry)
+{
+    entry_info_t *info = entry_info(entry);
+    if (!is_set(entry, FLAG_BOOT) || info->builtin != NULL)
+        return;
+
+    entry_t *copy = alloc_entry();
+    *copy = *entry;
+    *entry_info(copy) = *info;
+    info->builtin = copy;
+}
+
+/**
+ * Returns a header from boot to its definition at the time, if it has
+ * been replaced since.
+ */
+void restore_builtin(entry_t *entry)
+{
+    entry_info_t *info = entry_info(entry);
+    entry_t *builtin = info->builtin;
+    if (builtin == NULL)
+        return;
+
+    entry->code_ptr = builtin->code_ptr;
+    entry->param = builtin->param;
+    entry->flags = builtin->flags;
+    *info = *entry_info(builtin);
+    info->builtin = builtin;
+}
+
+/**
+ * The cold half of a header. There are only ever a few chunks to look
+ * through.
+ */
+entry_info_t *entry_info(entry_t *entry)
+{
+    for (header_chunk_t *chunk = header_chunks; chunk != NULL; chunk = chunk->next)
+    {
+        if (entry >= chunk->entries && entry < chunk->entries + HEADER_CHUNK)
+            return &chunk->info[entry - chunk->entries];
+    }
+
+    assert(false);  // not a header
+    return NULL;
+}
+
+static char *copy_name(const char *name, int len)
+{
+    if (names + len + 1 > names_end)
+    {
+        int size = max(NAME_CHUNK, len + 1);
+        names = malloc(size);
+        assert(names != NULL);
+        names_end = names + size;
+    }
+
+    char *copy = names;
+    for (int i = 0; i < len; i++)
+        copy[i] = toupper(name[i]);
+
+    copy[len] = '\0';
+    names += len + 1;
+    return copy;
+}
+
+static void name_entry(entry_t *entry, char *name)
+{
+    entry->name_len = strlen(name);
+    entry->name = copy_name(name, entry->name_len);
+    entry->hash = name_hash(name, entry->name_len);
+    first_chars[(unsigned char) entry->name[0] >> 3] |= 1 << (entry->name[0] & 7);
+}
+
+/**
+ * Allocates a header, with a copy of name in upper case, for the caller
+ * to insert into a dictionary.
+ */
+entry_t *new_entry(char *name, state_t (*code_ptr)(context_t *ctx), unsigned int flags)
+{
+    entry_t *entry = alloc_entry();
+    name_entry(entry, name);
+    entry->code_ptr = code_ptr;
+    entry->flags = flags;
+    return entry;
+}
+
+// An entry that doesn't go in, because the name is taken, is given back
+static int insert_entry(hashtable_t *htbl, entry_t *entry)
+{
+    int status = hashtable_insert(htbl, entry);
+    if (status != 0)
+        free_entry(entry);
+
+    return status;
 }
 
 // TODO: this can be deleted once add_primitive converted to use ctx
@@ -66,7 +236,7 @@ int set_flags(hashtable_t *htbl, char *name, int flags)
     entry_t *entry;
     if (find_entry(htbl, name, &entry) == 0)
     {
-        entry->flags = flags;
+        entry->flags |= flags;
         return 0;
     }
     else
@@ -82,21 +252,14 @@ int add_primitive(hashtable_t *htbl, char *name, state_t (*code_ptr)(context_t *
     assert(htbl != NULL);
     assert(name != NULL);
 
-    entry_t *entry = calloc(0, sizeof(entry_t));
-    if (entry == NULL)
-        return -1;
-
-    entry->name = strtoupper(name);
-    entry->stack_effect = stack_effect;
-    entry->docstring = docstring;
-    entry->code_ptr = code_ptr;
-    entry->param.ptr = NULL;
-    entry->flags = FLAG_PRIMITIVE;
-    entry->alloc_size = 0;
+    entry_t *entry = new_entry(name, code_ptr, FLAG_PRIMITIVE);
+    entry_info_t *info = entry_info(entry);
+    info->stack_effect = stack_effect;
+    info->docstring = docstring;
 
     // TODO : add this once ctx available
     // ctx->last_word = entry;
-    return hashtable_insert(htbl, entry);
+    return insert_entry(htbl, entry);
 }
 
 int add_variable(context_t *ctx, char *name, word_t *addr)
@@ -104,19 +267,9 @@ int add_variable(context_t *ctx, char *name, word_t *addr)
     assert(ctx != NULL);
     assert(name != NULL);
 
-    entry_t *entry = calloc(0, sizeof(entry_t));
-    if (entry == NULL)
-        return -1;
-
-    entry->name = strtoupper(name);
-    entry->stack_effect = NULL;
-    entry->docstring = NULL;
-    entry->code_ptr = __REF;
+    entry_t *entry = new_entry(name, __REF, ctx->sticky_flags | FLAG_VARIABLE);
     entry->param.ptr = (void *)addr;
-    entry->flags = ctx->sticky_flags | FLAG_VARIABLE;
-    entry->alloc_size = 0;
-
-    return hashtable_insert(ctx->exe_tok, entry);
+    return insert_entry(ctx->exe_tok, entry);
 }
 
 int add_constant(context_t *ctx, char *name, const int value)
@@ -124,19 +277,9 @@ int add_constant(context_t *ctx, char *name, const int value)
     assert(ctx != NULL);
     assert(name != NULL);
 
-    entry_t *entry = calloc(0, sizeof(entry_t));
-    if (entry == NULL)
-        return -1;
-
-    entry->name = strtoupper(name);
-    entry->stack_effect = NULL;
-    entry->docstring = NULL;
-    entry->code_ptr = __REF;
+    entry_t *entry = new_entry(name, __REF, ctx->sticky_flags | FLAG_CONSTANT);
     entry->param.val = value;
-    entry->flags = ctx->sticky_flags | FLAG_CONSTANT;
-    entry->alloc_size = 0;
-
-    return hashtable_insert(ctx->exe_tok, entry);
+    return insert_entry(ctx->exe_tok, entry);
 }
 
 // replaces any existing word already defined
@@ -145,57 +288,61 @@ int add_word(context_t *ctx, char *name, word_t *addr)
     assert(ctx != NULL);
     assert(name != NULL);
 
-    entry_t *entry = calloc(0, sizeof(entry_t));
-    if (entry == NULL)
+    // An existing entry is reused, so that compiled references to it run
+    // the new definition
+    entry_t *entry;
+    if (find_entry(ctx->exe_tok, name, &entry) == 0)
+    {
+        keep_builtin(entry);
+        entry_info_t *info = entry_info(entry);
+        entry_t *builtin = info->builtin;
+        memset(info, 0, sizeof(entry_info_t));
+        info->builtin = builtin;
+        entry->code_ptr = __EXEC;
+        entry->flags = ctx->sticky_flags | (entry->flags & FLAG_BOOT);
+    }
+    else if (insert_entry(ctx->exe_tok, entry = new_entry(name, __EXEC, ctx->sticky_flags)) != 0)
+    {
         return -1;
+    }
 
-    entry->name = strtoupper(name);
-
-    // dont care what the return status is:
-    // if it existed it was deleted, if it didnt, fine: nothing to do
-    hashtable_remove(ctx->exe_tok, (void **)&entry);
-
-    entry->stack_effect = NULL;
-    entry->docstring = NULL;
-    entry->code_ptr = __EXEC;
     entry->param.ptr = (void *)addr;
-    entry->flags = ctx->sticky_flags;
-    entry->alloc_size = 0;
-
     ctx->last_word = entry;
-    return hashtable_insert(ctx->exe_tok, entry);
+    return 0;
 }
 
 
-int find_entry(hashtable_t *htbl, char *name, entry_t **entry)
+/**
+ * Looks up the name at (addr, len), in any case, without copying it.
+ */
+int find_word(hashtable_t *htbl, const char *addr, int len, entry_t **entry)
 {
     assert(htbl != NULL);
-    assert(name != NULL);
-
-    // Create a key filling in the name
-    entry_t *data = malloc(sizeof(entry_t));
-    if (data == NULL)
-        return -1;
+    assert(addr != NULL);
 
-    data->name = strtoupper(strdup(name));
+    // A key on the stack: only the name, length and hash are consulted
+    entry_t key = { .name = (char *)addr, .name_len = len, .hash = name_hash(addr, len) };
+    entry_t *data = &key;
 
-    entry_t *tmp = data;  // copy data ptr, so it can be freed later
     int retval;
     if ((retval = hashtable_lookup(htbl, (void **)&data)) == 0)
     {
         *entry = data;
     }
 
-    free(tmp->name); // free'ing strdup
-    free(tmp);
-
     return retval;
 }
 
+int find_entry(hashtable_t *htbl, char *name, entry_t **entry)
+{
+    assert(name != NULL);
+    return find_word(htbl, name, strlen(name), entry);
+}
+
 int entry_hash(const void *data)
 {
     entry_t *entry = (entry_t *)data;
-    return abs(hashfn(entry->name));
+    return entry->hash & 0x7FFFFFFF;
 }
 
 int entry_match(const void *data1, const void *data2)
@@ -203,7 +350,9 @@ int entry_match(const void *data1, const void *data2)
     entry_t *a = (entry_t *)data1;
     entry_t *b = (entry_t *)data2;
 
-    return strcmp(a->name, b->name) == 0;
+    return a->hash == b->hash &&
+           a->name_len == b->name_len &&
+           name_matches(b->name, a->name, a->name_len);
 }
 
 /**
@@ -213,22 +362,16 @@ int entry_match(const void *data1, const void *data2)
 char **get_words(hashtable_t *htbl)
 {
     int n = htbl->size;
-    char **words = calloc(0, (n + 1) * sizeof(char **));
+    char **words = calloc(1, (n + 1) * sizeof(char **));
     assert(words != NULL);
 
     int i = 0;
-    for (int bucket = 0; bucket < htbl->buckets; bucket++)
+    for (int slot = 0; slot < htbl->capacity; slot++)
     {
-        list_t *list = &htbl->table[bucket];
-        if (list->size > 0)
+        if (hashtable_occupied(htbl, slot))
         {
-            list_elem_t *element = list_head(list);
-            while (element != NULL)
-            {
-                entry_t *entry = list_data(element);
-                words[i++] = entry->name;
-                element = list_next(element);
-            }
+            entry_t *entry = hashtable_data(htbl, slot);
+            words[i++] = entry->name;
         }
     }
 
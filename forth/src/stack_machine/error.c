@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stdio.h>
 
 #include <kernel/tty.h>
 #include <kernel/vga.h>
@@ -53,9 +54,8 @@ char *sys_error_msg[] = {
 state_t stack_abort(context_t *ctx)
 {
     // drain the data and return stacks
-    int num;
-    while (popnum(ctx->ds, &num));
-    while (popnum(ctx->rs, &num));
+    ctx->sp = ctx->ds;
+    ctx->rp = ctx->rs;
     return ERROR;
 }
 
@@ -0,0 +1,143 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <stack_machine/common.h>
+#include <stack_machine/context.h>
+#include <stack_machine/heap.h>
+#include <stack_machine/profiler.h>
+
+static int tracing = false;
+
+// Allocations per line interpreted
+static unsigned int line_epoch, line_start;
+static unsigned int lines, last_line, busiest_line;
+static unsigned long long line_allocs;
+
+void heap_trace_start(void)
+{
+    heap_trace(true);
+    tracing = true;
+}
+
+void heap_trace_stop(void)
+{
+    heap_trace(false);
+    tracing = false;
+}
+
+void heap_line_start(void)
+{
+    heap_stats_t stats;
+    heap_stats(&stats);
+    line_start = stats.allocs;
+    line_epoch = heap_mark();
+}
+
+static char *format_site(char *out, void *site)
+{
+    if (site == NULL)
+    {
+        memcpy(out, "other sites", 11);
+        return out + 11;
+    }
+
+    *out++ = '0';
+    *out++ = 'x';
+    itoa((int)site, out, 16);
+    return out + strlen(out);
+}
+
+void heap_line_end(state_t state)
+{
+    heap_stats_t stats;
+    heap_stats(&stats);
+    last_line = stats.allocs - line_start;
+    busiest_line = max(busiest_line, last_line);
+    line_allocs += last_line;
+    lines++;
+
+    if (state != ERROR || !tracing)
+        return;
+
+    heap_site_t sites[HEAP_TRACE_SITES];
+    int n = heap_sites(sites, HEAP_TRACE_SITES, line_epoch);
+    for (int i = 0; i < n; i++)
+    {
+        if (sites[i].live == 0)
+            continue;
+
+        char line[HEAP_LINE] = { 0 };
+        char *out = format_count(line, sites[i].live, 0);
+        memcpy(out, " live, ", 7);
+        out = format_count(out + 7, sites[i].live_bytes, 0);
+        memcpy(out, " bytes from ", 12);
+        format_site(out + 12, sites[i].site);
+        printf("HEAP: %s\n", line);
+    }
+}
+
+static int by_allocs(const heap_site_t *a, const heap_site_t *b)
+{
+    return a->allocs < b->allocs ? 1 : a->allocs > b->allocs ? -1 : 0;
+}
+
+static char *format_stat(char *out, char *label, unsigned long long n)
+{
+    int len = strlen(label);
+    memcpy(out, label, len);
+    return format_count(out + len, n, 32 - len);
+}
+
+char **heap_report(void)
+{
+    heap_stats_t stats;
+    heap_site_t sites[HEAP_TRACE_SITES];
+    heap_stats(&stats);
+    int n = tracing ? heap_sites(sites, HEAP_TRACE_SITES, 0) : 0;
+    qsort(sites, n, sizeof(heap_site_t), (void *)by_allocs);
+
+    // The counters, a blank line and a heading, then a line per site
+    int lines_used = 12 + (n > 0 ? n + 2 : 0);
+    char **text = calloc(1, (lines_used + 1) * (sizeof(char *) + HEAP_LINE));
+    if (text == NULL)
+        return NULL;
+
+    for (int i = 0; i < lines_used; i++)
+        text[i] = (char *)(text + lines_used + 1) + i * HEAP_LINE;
+
+    int line = 0;
+    format_stat(text[line++], "allocations", stats.allocs);
+    format_stat(text[line++], "frees", stats.frees);
+    format_stat(text[line++], "live bytes", stats.live);
+    format_stat(text[line++], "peak live bytes", stats.peak);
+    format_stat(text[line++], "heap bytes", stats.heap);
+    format_stat(text[line++], "free runs", stats.free_runs);
+    format_stat(text[line++], "largest free run", stats.largest_free);
+    format_stat(text[line++], "lines interpreted", lines);
+    format_stat(text[line++], "allocations per line",
+                lines == 0 ? 0 : (long long)((double)(long long)line_allocs / lines));
+    format_stat(text[line++], "  in the last line", last_line);
+    format_stat(text[line++], "  in the busiest line", busiest_line);
+    format_stat(text[line++], "untraced allocations", stats.untraced);
+
+    if (n > 0)
+    {
+        line++;
+        static const char header[] = "    allocs      live  live bytes  call site";
+        memcpy(text[line++], header, sizeof(header));
+
+        for (int i = 0; i < n; i++)
+        {
+            char *out = format_count(text[line++], sites[i].allocs, 10);
+            out = format_count(out, sites[i].live, 10);
+            out = format_count(out, sites[i].live_bytes, 12);
+            *out++ = ' ';
+            *out++ = ' ';
+            format_site(out, sites[i].site);
+        }
+    }
+
+    text[line] = NULL;
+    return text;
+}
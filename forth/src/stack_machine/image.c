@@ -0,0 +1,574 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <stack_machine/common.h>
+#include <stack_machine/compiler.h>
+#include <stack_machine/context.h>
+#include <stack_machine/entry.h>
+#include <stack_machine/image.h>
+#include <stack_machine/jit.h>
+#include <stack_machine/slots.h>
+#include <stack_machine/vm.h>
+#include <forth/resources.h>
+#include <collections/hashtable.h>
+
+typedef state_t (*code_t)(context_t *ctx);
+
+static int relocate(context_t *ctx, entry_t **entries, const char *strings, image_ref_t ref, int addend)
+{
+    entry_t *named;
+    switch (ref.kind)
+    {
+        case IMAGE_NAMED:
+            if (find_entry(ctx->exe_tok, (char *)strings + ref.target, &named) == 0)
+                return (int)named + addend;
+            return addend;
+        case IMAGE_MEM:    return (int)ctx->mem + addend;
+        case IMAGE_CTX:    return (int)ctx + addend;
+        case IMAGE_TIB:    return (int)ctx->tib->buffer + addend;
+        case IMAGE_ENTRY:  return (int)entries[ref.target] + addend;
+        case IMAGE_OPCODE: return (int)vm_code[addend];
+        default:           return addend;
+    }
+}
+
+static code_t resolve_code(context_t *ctx, const char *strings, image_ref_t ref)
+{
+    entry_t *prim;
+    switch (ref.kind)
+    {
+        case IMAGE_EXEC:
+            return __EXEC;
+        case IMAGE_REF:
+            return __REF;
+        case IMAGE_PRIM:
+            if (find_entry(ctx->exe_tok, (char *)strings + ref.target, &prim) == 0)
+                return prim->code_ptr;
+            // fall through
+        default:
+            return NULL;
+    }
+}
+
+static char *resolve_string(const char *strings, int offset, char *keep)
+{
+    if (offset == IMAGE_KEEP)
+        return keep;
+    return offset == IMAGE_NONE ? NULL : (char *)strings + offset;
+}
+
+// Colon definitions are JIT compiled in the order they were defined
+static int by_param(const entry_t **a, const entry_t **b)
+{
+    return (*a)->param.val - (*b)->param.val;
+}
+
+static void jit_compile_all(context_t *ctx, entry_t **entries, int n)
+{
+    entry_t **words = malloc(n * sizeof(entry_t *));
+    int num_words = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        if (entries[i]->code_ptr == __EXEC)
+            words[num_words++] = entries[i];
+    }
+
+    qsort(words, num_words, sizeof(entry_t *), (void *)by_param);
+    for (int i = 0; i < num_words; i++)
+        jit_compile(ctx, words[i]);
+
+    free(words);
+}
+
+static int image_fits(context_t *ctx, const image_header_t *image)
+{
+    return image->magic == IMAGE_MAGIC && image->num_opcodes == NUM_OPCODES &&
+           image->context_size == sizeof(context_t) &&
+           image->mem_size <= (unsigned int)((byte_t *)ctx->mem_end - (byte_t *)ctx->mem);
+}
+
+int load_image(context_t *ctx, const image_header_t *image)
+{
+    if (!image_fits(ctx, image))
+        return -1;
+
+    const byte_t *mem = (const byte_t *)(image + 1);
+    const image_reloc_t *relocs = (const image_reloc_t *)(mem + align(image->mem_size));
+    const image_entry_t *images = (const image_entry_t *)(relocs + image->num_relocs);
+    const char *strings = (const char *)(images + image->num_entries);
+    int n = image->num_entries;
+
+    entry_t **entries = malloc(n * sizeof(entry_t *));
+    code_t *code = malloc(n * sizeof(code_t));
+    if (entries == NULL || code == NULL)
+    {
+        if (entries != NULL)
+            free(entries);
+        if (code != NULL)
+            free(code);
+        return -1;
+    }
+
+    // Find or add every entry, and look up the primitives' code, before
+    // any of them change: a primitive may since have been redefined
+    for (int i = 0; i < n; i++)
+    {
+        char *name = (char *)strings + images[i].name;
+        if (find_entry(ctx->exe_tok, name, &entries[i]) != 0)
+        {
+            entries[i] = new_entry(name, NULL, 0);
+            hashtable_insert(ctx->exe_tok, entries[i]);
+        }
+        code[i] = resolve_code(ctx, strings, images[i].code);
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        const image_entry_t *image_entry = &images[i];
+        entry_t *entry = entries[i];
+
+        // Whether a header is from boot is the running system's business
+        keep_builtin(entry);
+        entry->flags = (image_entry->flags & ~FLAG_BOOT) | (entry->flags & FLAG_BOOT);
+        entry->code_ptr = code[i];
+        entry->param.val = relocate(ctx, entries, strings, image_entry->param, image_entry->addend);
+        entry_info_t *info = entry_info(entry);
+        info->alloc_size = image_entry->alloc_size;
+        info->stack_effect = resolve_string(strings, image_entry->stack_effect, info->stack_effect);
+        info->docstring = resolve_string(strings, image_entry->docstring, info->docstring);
+    }
+
+    // The cells relocated are the ones that hold addresses
+    memcpy(ctx->mem, mem, image->mem_size);
+    for (word_t *cell = ctx->mem; (byte_t *)cell < (byte_t *)ctx->mem + image->mem_size; cell++)
+        set_ref(ctx, cell, false);
+
+    for (unsigned int i = 0; i < image->num_relocs; i++)
+    {
+        word_t *cell = (word_t *)((byte_t *)ctx->mem + relocs[i].offset);
+        cell->val = relocate(ctx, entries, strings, relocs[i].ref, cell->val);
+        set_ref(ctx, cell, true);
+    }
+
+    ctx->dp = (word_t *)((byte_t *)ctx->mem + image->mem_size);
+    ctx->last_op = ctx->prev_op = NULL;
+    if (image->last_word >= 0)
+        ctx->last_word = entries[image->last_word];
+    ctx->sticky_flags = image->sticky_flags;
+    ctx->base = image->base;
+    ctx->echo = image->echo;
+    ctx->fold = image->fold;
+
+    // The image is made with the JIT off, as its code is not relocatable
+    if (ctx->jit)
+        jit_compile_all(ctx, entries, n);
+
+    free(code);
+    free(entries);
+    return 0;
+}
+
+/*
+ * Snapshots. Only the cells the compiler marked as addresses (see
+ * comma_ref) are relocated: opcodes and xts, as well as anything laid
+ * down by , or LITERAL that points into the dictionary space, the
+ * context, the input buffer or an entry. Everything else is a number.
+ */
+
+typedef struct {
+    context_t *ctx;
+    entry_t **entries;          // every entry in the dictionary
+    int *names;                 // offset of each one's name in the strings, or -1
+    int num_entries;
+    char *strings;
+    int strings_size;
+} snapshot_t;
+
+static int within(int addr, void *start, int size)
+{
+    return addr >= (int)start && addr <= (int)start + size;
+}
+
+static int add_string(snapshot_t *snap, const char *s)
+{
+    int len = strlen(s) + 1;
+    memcpy(snap->strings + snap->strings_size, s, len);
+    snap->strings_size += len;
+    return snap->strings_size - len;
+}
+
+static int entry_name(snapshot_t *snap, int i)
+{
+    if (snap->names[i] < 0)
+        snap->names[i] = add_string(snap, snap->entries[i]->name);
+    return snap->names[i];
+}
+
+static image_ref_t locate(snapshot_t *snap, int x, int *addend)
+{
+    context_t *ctx = snap->ctx;
+    image_ref_t ref = { IMAGE_ABS, 0 };
+    int op = vm_opcode((word_t)x);
+    *addend = x;
+
+    if (op >= 0)
+    {
+        ref.kind = IMAGE_OPCODE;
+        *addend = op;
+    }
+    else if (within(x, ctx->mem, (byte_t *)ctx->mem_end - (byte_t *)ctx->mem))
+    {
+        ref.kind = IMAGE_MEM;
+        *addend = x - (int)ctx->mem;
+    }
+    else if (within(x, ctx, sizeof(context_t) - 1))
+    {
+        ref.kind = IMAGE_CTX;
+        *addend = x - (int)ctx;
+    }
+    else if (within(x, ctx->tib->buffer, READLINE_BUFSIZ))
+    {
+        ref.kind = IMAGE_TIB;
+        *addend = x - (int)ctx->tib->buffer;
+    }
+    else
+    {
+        for (int i = 0; i < snap->num_entries; i++)
+        {
+            if (within(x, snap->entries[i], sizeof(entry_t) - 1))
+            {
+                ref.kind = IMAGE_NAMED;
+                ref.target = entry_name(snap, i);
+                *addend = x - (int)snap->entries[i];
+                break;
+            }
+        }
+    }
+    return ref;
+}
+
+// Native code is left behind, and compiled again on restoring
+static int code_of(snapshot_t *snap, entry_t *entry, image_ref_t *ref)
+{
+    ref->target = 0;
+    if (entry->code_ptr == __EXEC || jit_contains(entry->code_ptr))
+    {
+        ref->kind = IMAGE_EXEC;
+        return 0;
+    }
+
+    if (entry->code_ptr == __REF)
+    {
+        ref->kind = IMAGE_REF;
+        return 0;
+    }
+
+    for (int i = 0; i < snap->num_entries; i++)
+    {
+        entry_t *prim = snap->entries[i];
+        if (is_set(prim, FLAG_PRIMITIVE) && prim->code_ptr == entry->code_ptr)
+        {
+            ref->kind = IMAGE_PRIM;
+            ref->target = entry_name(snap, i);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int saved_string(snapshot_t *snap, char *s)
+{
+    return s == NULL ? IMAGE_NONE : add_string(snap, s);
+}
+
+static unsigned int adler32(const void *data, int size)
+{
+    const byte_t *p = data;
+    unsigned int a = 1, b = 0;
+
+    for (int i = 0; i < size; i++)
+    {
+        a = (a + p[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    return (b << 16) | a;
+}
+
+/**
+ * Identifies the built-in dictionary, which a snapshot must be restored
+ * over: its layout follows from the bootstrap sources and the opcodes.
+ */
+static unsigned int system_id(void)
+{
+    return adler32(&system_forth, resource_size) ^ (NUM_OPCODES << 24) ^ sizeof(entry_t);
+}
+
+/**
+ * Makes an image of the context in one allocation, with room for the
+ * snapshot header before it. Returns NULL if it can't.
+ */
+static snapshot_header_t *snapshot(context_t *ctx)
+{
+    hashtable_t *htbl = ctx->exe_tok;
+    snapshot_t snap = { .ctx = ctx, .num_entries = hashtable_size(htbl) };
+    snap.entries = malloc(snap.num_entries * sizeof(entry_t *));
+    snap.names = malloc(snap.num_entries * sizeof(int));
+    if (snap.entries == NULL || snap.names == NULL)
+    {
+        free(snap.entries);
+        free(snap.names);
+        return NULL;
+    }
+
+    // Room for every name, and the strings of the entries saved
+    int saved = 0, strings_max = 0;
+    for (int i = 0, n = 0; i < htbl->capacity; i++)
+    {
+        if (!hashtable_occupied(htbl, i))
+            continue;
+
+        entry_t *entry = hashtable_data(htbl, i);
+        snap.entries[n] = entry;
+        snap.names[n++] = -1;
+        strings_max += entry->name_len + 1;
+
+        if (is_set(entry, FLAG_USER_DEFINED) || entry == ctx->last_word)
+        {
+            saved++;
+            entry_info_t *info = entry_info(entry);
+            strings_max += (info->stack_effect ? strlen(info->stack_effect) + 1 : 0) +
+                           (info->docstring ? strlen(info->docstring) + 1 : 0);
+        }
+    }
+
+    int mem_size = (byte_t *)ctx->dp - (byte_t *)ctx->mem;
+    int cells = align(mem_size) / sizeof(word_t);
+    int max_size = sizeof(snapshot_header_t) + sizeof(image_header_t) + cells * sizeof(word_t) +
+                   cells * sizeof(image_reloc_t) + saved * sizeof(image_entry_t) + strings_max;
+
+    snap.strings = malloc(strings_max + 1);
+    snapshot_header_t *header = calloc(1, max_size);
+    if (header == NULL || snap.strings == NULL)
+    {
+        if (header != NULL)
+            free(header);
+        if (snap.strings != NULL)
+            free(snap.strings);
+        free(snap.entries);
+        free(snap.names);
+        return NULL;
+    }
+
+    image_header_t *image = (image_header_t *)(header + 1);
+    word_t *mem = (word_t *)(image + 1);
+    image_reloc_t *relocs = (image_reloc_t *)(mem + cells);
+
+    memcpy(mem, ctx->mem, mem_size);
+    image->num_relocs = 0;
+    for (int i = 0; i < cells; i++)
+    {
+        if (!is_ref(ctx, &ctx->mem[i]))
+            continue;
+
+        int addend;
+        image_ref_t ref = locate(&snap, mem[i].val, &addend);
+        if (ref.kind != IMAGE_ABS)
+        {
+            relocs[image->num_relocs].offset = i * sizeof(word_t);
+            relocs[image->num_relocs].ref = ref;
+            image->num_relocs++;
+            mem[i].val = addend;
+        }
+    }
+
+    // The entries follow the relocations, and the strings the entries, so
+    // both are gathered up first: the names of entries referred to are
+    // already in the strings
+    image_entry_t *entries = malloc(saved * sizeof(image_entry_t) + 1);
+    int ok = entries != NULL;
+    image->last_word = -1;
+    image->num_entries = 0;
+
+    for (int i = 0; ok && i < snap.num_entries; i++)
+    {
+        entry_t *entry = snap.entries[i];
+        if (!is_set(entry, FLAG_USER_DEFINED) && entry != ctx->last_word)
+            continue;
+
+        image_entry_t *saved_entry = &entries[image->num_entries];
+        if (entry == ctx->last_word)
+            image->last_word = image->num_entries;
+
+        saved_entry->name = entry_name(&snap, i);
+        entry_info_t *info = entry_info(entry);
+        saved_entry->stack_effect = saved_string(&snap, info->stack_effect);
+        saved_entry->docstring = saved_string(&snap, info->docstring);
+        saved_entry->flags = entry->flags;
+        saved_entry->param = locate(&snap, entry->param.val, &saved_entry->addend);
+        saved_entry->alloc_size = info->alloc_size;
+        ok = code_of(&snap, entry, &saved_entry->code) == 0;
+        image->num_entries++;
+    }
+
+    if (ok)
+    {
+        image->magic = IMAGE_MAGIC;
+        image->num_opcodes = NUM_OPCODES;
+        image->context_size = sizeof(context_t);
+        image->mem_size = mem_size;
+        image->strings_size = snap.strings_size;
+        image->sticky_flags = ctx->sticky_flags;
+        image->base = ctx->base;
+        image->echo = ctx->echo;
+        image->fold = ctx->fold;
+
+        byte_t *end = (byte_t *)(relocs + image->num_relocs);
+        memcpy(end, entries, image->num_entries * sizeof(image_entry_t));
+        end += image->num_entries * sizeof(image_entry_t);
+        memcpy(end, snap.strings, snap.strings_size);
+        end += snap.strings_size;
+
+        header->magic = SNAPSHOT_MAGIC;
+        header->size = end - (byte_t *)image;
+        header->checksum = adler32(image, header->size);
+        header->system = system_id();
+    }
+    else
+    {
+        free(header);
+        header = NULL;
+    }
+
+    if (entries != NULL)
+        free(entries);
+    free(snap.strings);
+    free(snap.entries);
+    free(snap.names);
+    return header;
+}
+
+int save_system(context_t *ctx, int n)
+{
+    if (slot_buffer(n) == NULL)
+        return -35;     // invalid block number
+
+    snapshot_header_t *header = snapshot(ctx);
+    if (header == NULL)
+        return -34;     // block write exception
+
+    int status = slot_write(n, header, sizeof(snapshot_header_t) + header->size) == 0 ? 0 : -34;
+    free(header);
+    return status;
+}
+
+/**
+ * True if the image is laid out as its header says, in size bytes, and
+ * can be loaded into ctx.
+ */
+static int image_valid(context_t *ctx, const image_header_t *image, unsigned int size)
+{
+    if (size < sizeof(image_header_t) || !image_fits(ctx, image))
+        return false;
+
+    unsigned long long expected = sizeof(image_header_t) + align(image->mem_size) +
+        (unsigned long long)image->num_relocs * sizeof(image_reloc_t) +
+        (unsigned long long)image->num_entries * sizeof(image_entry_t) + image->strings_size;
+    if (expected != size || (image->last_word >= 0 && (unsigned int)image->last_word >= image->num_entries))
+        return false;
+
+    const image_reloc_t *relocs = (const image_reloc_t *)((const byte_t *)(image + 1) + align(image->mem_size));
+    for (unsigned int i = 0; i < image->num_relocs; i++)
+    {
+        if (relocs[i].offset % CELL != 0 || relocs[i].offset + CELL > align(image->mem_size))
+            return false;
+    }
+    return true;
+}
+
+int restore_system(context_t *ctx, int n)
+{
+    snapshot_header_t header;
+    if (slot_buffer(n) == NULL)
+        return -35;     // invalid block number
+
+    // The words being replaced may be running, or hold what's left of a
+    // line being interpreted
+    if (rs_depth(ctx) != 0)
+        return -21;     // unsupported operation
+
+    if (slot_read(n, &header, sizeof(header)) != 0 ||
+        header.magic != SNAPSHOT_MAGIC || header.system != system_id())
+    {
+        return -33;     // block read exception
+    }
+
+    snapshot_header_t *snap = malloc(sizeof(header) + header.size);
+    if (snap == NULL)
+        return -34;
+
+    image_header_t *image = (image_header_t *)(snap + 1);
+    if (slot_read(n, snap, sizeof(header) + header.size) != 0 ||
+        adler32(image, header.size) != header.checksum || !image_valid(ctx, image, header.size))
+    {
+        free(snap);
+        return -33;
+    }
+
+    // The user-defined words all go, to be replaced by those saved. Those
+    // from boot stay where they are, as the system refers to them, and go
+    // back to how they were then. Their native code goes too, if nothing
+    // else was compiled after it
+    hashtable_t *htbl = ctx->exe_tok;
+    entry_t **user = malloc(htbl->size * sizeof(entry_t *) + 1);
+    if (user == NULL)
+    {
+        free(snap);
+        return -34;
+    }
+
+    int num_user = 0;
+    void *user_code = NULL, *system_code = NULL;
+    for (int i = 0; i < htbl->capacity; i++)
+    {
+        entry_t *entry = hashtable_occupied(htbl, i) ? hashtable_data(htbl, i) : NULL;
+        if (entry == NULL)
+            continue;
+
+        entry_t *builtin = entry_info(entry)->builtin;
+        void *code = jit_contains(entry->code_ptr) ? entry->code_ptr : NULL;
+        if (is_set(entry, FLAG_BOOT) ? builtin != NULL : is_set(entry, FLAG_USER_DEFINED))
+        {
+            user[num_user++] = entry;
+            if (code != NULL && (user_code == NULL || code < user_code))
+                user_code = code;
+            code = builtin != NULL && jit_contains(builtin->code_ptr) ? builtin->code_ptr : NULL;
+        }
+
+        if (code > system_code)
+            system_code = code;
+    }
+
+    if (user_code > system_code)
+        jit_release(user_code);
+
+    for (int i = 0; i < num_user; i++)
+    {
+        if (is_set(user[i], FLAG_BOOT))
+        {
+            restore_builtin(user[i]);
+            continue;
+        }
+
+        void *data = user[i];
+        hashtable_remove(htbl, &data);
+        if (ctx->last_word == user[i])
+            ctx->last_word = NULL;
+        free_entry(user[i]);
+    }
+    free(user);
+
+    int status = load_image(ctx, image) == 0 ? 0 : -34;
+    free(snap);
+    return status;
+}
@@ -1,6 +1,10 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <ctype.h>
+#include <setjmp.h>
+
+#include <kernel/system.h>
 
 #include <stack_machine/common.h>
 #include <stack_machine/context.h>
@@ -8,8 +12,51 @@
 #include <stack_machine/interpreter.h>
 #include <stack_machine/entry.h>
 #include <stack_machine/error.h>
+#include <stack_machine/profiler.h>
 
-state_t interpret(context_t *ctx, char *in)
+/**
+ * Parses characters up to the delimiter from the parse area, returning
+ * the address and length within the TIB, and advances >IN past the
+ * delimiter. Nothing is copied.
+ */
+char *parse(context_t *ctx, char delim, int *len)
+{
+    inbuf_t *tib = ctx->tib;
+    char *start = tib->buffer + min(tib->in, tib->length);
+    char *end = tib->buffer + tib->length;
+    char *p = start;
+
+    while (p < end && *p != delim)
+        p++;
+
+    *len = p - start;
+    tib->in = (p - tib->buffer) + (p < end ? 1 : 0);
+    return start;
+}
+
+/**
+ * Skips leading whitespace, then parses a whitespace delimited name.
+ * Returns NULL if the parse area is exhausted.
+ */
+char *parse_name(context_t *ctx, int *len)
+{
+    inbuf_t *tib = ctx->tib;
+    char *p = tib->buffer + min(tib->in, tib->length);
+    char *end = tib->buffer + tib->length;
+
+    while (p < end && isspace(*p))
+        p++;
+
+    char *start = p;
+    while (p < end && !isspace(*p))
+        p++;
+
+    *len = p - start;
+    tib->in = (p - tib->buffer) + (p < end ? 1 : 0);
+    return *len > 0 ? start : NULL;
+}
+
+static state_t interpret_line(context_t *ctx, char *in)
 {
     int n = strlen(in);
     if (n == 0)
@@ -18,82 +65,179 @@ state_t interpret(context_t *ctx, char *in)
     if (n >= READLINE_BUFSIZ)
         return error_msg(ctx, -1, ": input larger than TIB size");
 
-    // Copy the input buffer into the context's TIB, then again for tokenizing
+    // Copy the input buffer into the context's TIB, and reset >IN
     memcpy(ctx->tib->buffer, in, n + 1);
-    char *inbuf = strdup(ctx->tib->buffer);
-    assert(inbuf != NULL);
+    ctx->tib->length = n;
+    ctx->tib->in = 0;
+
+    char *token;
+    int len, num;
 
     // Begin parsing tokens proper
-    ctx->tib->token = strtok_r(inbuf, DELIMITERS, &ctx->tib->saveptr);
-    while (ctx->tib->token != NULL)
+    while ((token = parse_name(ctx, &len)) != NULL)
     {
-        // skip whitespace
-        if (*ctx->tib->token != '\0')
+        word_t *dp = ctx->dp;
+
+        // Is this a word already in the dictionary? Tokens starting with
+        // a character no name starts with can only be numbers.
+        if (may_start_word(*token) && find_word(ctx->exe_tok, token, len, &ctx->current_xt) == 0)
         {
-            // Set the current offset
-            ctx->tib->cur_offset = ctx->tib->token - inbuf;
-            char *s = trim(strdup(ctx->tib->token));
-            assert(s != NULL);
+            // Word exists, so set the contents of the word register
+            // to the dictionary param,
+            ctx->w = ctx->current_xt->param;
 
-            // Is this a word already in the dictionary?
-            if (find_entry(ctx->exe_tok, s, &ctx->current_xt) == 0)
+            if (is_set(ctx->current_xt, FLAG_IMMEDIATE) || ctx->state != SMUDGE)
             {
-                // Word exists, so set the contents of the word register
-                // to the dictionary param,
-                ctx->w = ctx->current_xt->param;
-
-                if (is_set(ctx->current_xt, FLAG_IMMEDIATE) || ctx->state != SMUDGE)
+                // Execute immediately if word is marked as IMMEDIATE,
+                // or not in compile mode
+                if (ctx->echo)
                 {
-                    // Execute immediately if word is marked as IMMEDIATE,
-                    // or not in compile mode
-                    if (ctx->echo)
-                    {
-                        indent(ctx);
-                        printf("  Executing: 0x%x: %s   (%d)\n", ctx->ip, ctx->current_xt->name, ctx->current_xt);
-                    }
-                    state_t retval = ctx->current_xt->code_ptr(ctx);
-
-                    // Only propagte the state if an error has been signalled.
-                    // Certainly don't set to OK if in smudge mode.
-                    if (retval != OK || ctx->state != SMUDGE)
-                        ctx->state = retval;
-                }
-                else
-                {
-                    // Otherwise compile the execution token into the currently defined word
-                    compile(ctx, 1, (int)ctx->current_xt);
+                    indent(ctx);
+                    printf("  Executing: 0x%x: %s   (%d)\n", ctx->ip, ctx->current_xt->name, ctx->current_xt);
                 }
+                state_t retval = profiling ? profile_execute(ctx) : ctx->current_xt->code_ptr(ctx);
+
+                // Only propagte the state if an error has been signalled.
+                // Certainly don't set to OK if in smudge mode.
+                if (retval != OK || ctx->state != SMUDGE)
+                    ctx->state = retval;
             }
             else
             {
-                int num;
-                if (parsenum(s, &num, ctx->base))
-                {
-                    if (ctx->state == SMUDGE)
-                    {
-                        literal(ctx, num);
-                    }
-                    else if (pushnum(ctx->ds, num))
-                    {
-                        ctx->state = OK;
-                    }
-                    else
-                    {
-                        // ??stack overflow??
-                    }
-                }
-                else
-                {
-                    ctx->state = error_msg(ctx, -13, ": '%s'", s); // word not found
-                }
+                // Otherwise compile the execution token into the currently defined word
+                compile_xt(ctx, ctx->current_xt);
+            }
+        }
+        else if (parsenum(token, len, &num, ctx->base))
+        {
+            if (ctx->state == SMUDGE)
+            {
+                literal(ctx, num);
+            }
+            else if (pushnum(ctx, num))
+            {
+                ctx->state = OK;
+            }
+            else
+            {
+                ctx->state = stack_overflow(ctx);
             }
-            free(s);
         }
-        ctx->tib->token = strtok_r(NULL, DELIMITERS, &ctx->tib->saveptr);
+        else
+        {
+            char s[READLINE_BUFSIZ];
+            memcpy(s, token, len);
+            s[len] = '\0';
+            ctx->state = error_msg(ctx, -13, ": '%s'", s); // word not found
+        }
+
+        // Words that take data space check for room themselves: this
+        // catches compiling past the end, or storing to DP
+        if (ctx->state != ERROR && dp_overflows(ctx, 0))
+        {
+            ctx->dp = dp <= ctx->mem_end ? dp : ctx->mem_end;
+            ctx->last_op = ctx->prev_op = NULL;
+            ctx->state = error_msg(ctx, -8, NULL); // dictionary overflow
+        }
 
         if (ctx->state == ERROR) break;
     }
-    free(inbuf);
 
     return ctx->state;
-}
\ No newline at end of file
+}
+
+/* The innermost interpret running, which a fault unwinds to */
+static jmp_buf *recovery = NULL;
+static byte_t *fault_address;
+
+/**
+ * The Forth error code to throw for a processor fault, or 0 for a fault
+ * that isn't the program's doing, and can't be recovered from.
+ */
+static int fault_error(registers_t *r)
+{
+    switch (r->int_no)
+    {
+        case 0:  return -10;    // division by zero
+        case 6:  return -21;    // unsupported operation: an invalid opcode
+        case 12:                // stack fault
+        case 13:                // general protection fault
+        case 14: return -9;     // invalid memory address: a page fault
+        case 17: return -23;    // address alignment exception
+    }
+    return 0;
+}
+
+static void recover(registers_t *r, void *address)
+{
+    int errno = fault_error(r);
+    fault_address = r->int_no == 14 ? address : NULL;
+    if (errno != 0)
+        longjmp(*recovery, errno);
+}
+
+/**
+ * Running off either end of a stack touches the guard page there (see
+ * common.h): returns the error for that end, or 0 if address is in neither.
+ */
+static int guard_error(int *stack, int cells, byte_t *address, int underflow, int overflow)
+{
+    byte_t *end = (byte_t *)(stack + cells);
+    byte_t *start = end - stack_bytes(cells);
+
+    if (address >= start - PAGE_SIZE && address < start)
+        return underflow;
+    if (address >= end && address < end + PAGE_SIZE)
+        return overflow;
+    return 0;
+}
+
+/**
+ * The error to throw for a fault: a stack error if it was a page fault on
+ * one of the stacks' guard pages, or else errno.
+ */
+static int stack_error(context_t *ctx, byte_t *address, int errno)
+{
+    if (address == NULL)
+        return errno;
+
+    int guard = guard_error(ctx->ds, DS_SIZE, address, -4, -3);
+    if (guard == 0)
+        guard = guard_error(ctx->rs, RS_SIZE, address, -6, -5);
+    return guard != 0 ? guard : errno;
+}
+
+/**
+ * Interprets a line. A processor fault while doing so, such as running
+ * off a stack onto its guard page, unwinds back to here and is thrown as
+ * a Forth error, as if the word being executed had thrown it. interpret
+ * nests, through words that load source, and the innermost catches the
+ * fault.
+ */
+state_t interpret(context_t *ctx, char *in)
+{
+    jmp_buf here;
+    jmp_buf *outer = recovery;
+    word_t *ip = ctx->ip;
+
+    int errno = setjmp(here);
+    if (errno != 0)
+    {
+        recovery = outer;
+        fault_set_handler(outer != NULL ? recover : NULL);
+        errno = stack_error(ctx, fault_address, errno);
+
+        // The inner interpreter doesn't get to put back its caller's ip
+        ctx->ip = ip;
+        ctx->last_op = ctx->prev_op = NULL;
+        ctx->state = ctx->current_xt != NULL ? error(ctx, errno) : error_msg(ctx, errno, NULL);
+        return ctx->state;
+    }
+
+    recovery = &here;
+    fault_set_handler(recover);
+    state_t state = interpret_line(ctx, in);
+    recovery = outer;
+    fault_set_handler(outer != NULL ? recover : NULL);
+    return state;
+}
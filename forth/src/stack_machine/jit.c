@@ -0,0 +1,1181 @@
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <stack_machine/common.h>
+#include <stack_machine/context.h>
+#include <stack_machine/entry.h>
+#include <stack_machine/error.h>
+#include <stack_machine/jit.h>
+#include <stack_machine/vm.h>
+
+extern state_t __EXECUTE(context_t *ctx);
+
+/**
+ * Native code keeps the context in EBX, the data stack pointer in ESI, the
+ * base of the data stack in EDI and the return stack pointer in EBP. The
+ * stack pointers are written back to the context around calls out to other
+ * words, exactly as the inner interpreter does. Generated words have the
+ * same signature as a primitive, so they are entered through code_ptr.
+ */
+enum { EAX = 0, ECX, EDX, EBX, ESP, EBP, ESI, EDI };
+
+#define R_CTX   EBX
+#define R_SP    ESI
+#define R_DS    EDI
+#define R_RP    EBP
+
+// Condition codes, as the low nibble of Jcc/SETcc. Flipping the bottom
+// bit gives the inverse condition.
+#define CC_B    0x2
+#define CC_E    0x4
+#define CC_NE   0x5
+#define CC_A    0x7
+#define CC_NS   0x9
+#define CC_L    0xC
+#define CC_G    0xF
+
+// Shared exit paths, jumped to from anywhere in the word
+enum {
+    EXIT_RETURN = 0,
+    EXIT_BAIL,              // a called word signalled ERROR
+    EXIT_OVERFLOW,
+    EXIT_UNDERFLOW,
+    EXIT_RSTACK_OVERFLOW,
+    EXIT_MISALIGNED,
+    EXIT_OUT_OF_RANGE,
+    NUM_EXITS
+};
+
+static const int exit_errno[NUM_EXITS] = { 0, 0, -3, -4, -5, -23, -11 };
+
+/**
+ * Data stack cells consumed and (at most) produced by each opcode the JIT
+ * understands. After an instruction that ends a block the depth is no
+ * longer known statically.
+ */
+static const struct {
+    signed char supported;
+    signed char in;
+    signed char out;
+    signed char ends_block;
+} effects[NUM_OPCODES] = {
+    [OP_CALL]       = { 1, 0, 0, 1 },
+    [OP_PRIM]       = { 1, 0, 0, 1 },
+    [OP_JUMP]       = { 1, 0, 0, 1 },
+    [OP_EXIT]       = { 1, 0, 0, 1 },
+    [OP_EXECUTE]    = { 1, 1, 0, 1 },
+    [OP_LIT]        = { 1, 0, 1, 0 },
+    [OP_BRANCH]     = { 1, 0, 0, 1 },
+    [OP_0BRANCH]    = { 1, 1, 0, 1 },
+    [OP_DUP]        = { 1, 1, 2, 0 },
+    [OP_QDUP]       = { 1, 1, 2, 1 },
+    [OP_DROP]       = { 1, 1, 0, 0 },
+    [OP_SWAP]       = { 1, 2, 2, 0 },
+    [OP_OVER]       = { 1, 2, 3, 0 },
+    [OP_ROT]        = { 1, 3, 3, 0 },
+    [OP_MINROT]     = { 1, 3, 3, 0 },
+    [OP_NIP]        = { 1, 2, 1, 0 },
+    [OP_TUCK]       = { 1, 2, 3, 0 },
+    [OP_2DUP]       = { 1, 2, 4, 0 },
+    [OP_2DROP]      = { 1, 2, 0, 0 },
+    [OP_ADD]        = { 1, 2, 1, 0 },
+    [OP_SUB]        = { 1, 2, 1, 0 },
+    [OP_MUL]        = { 1, 2, 1, 0 },
+    [OP_DIV]        = { 1, 2, 1, 0 },
+    [OP_MOD]        = { 1, 2, 1, 0 },
+    [OP_INC]        = { 1, 1, 1, 0 },
+    [OP_DEC]        = { 1, 1, 1, 0 },
+    [OP_DBL]        = { 1, 1, 1, 0 },
+    [OP_NEG]        = { 1, 1, 1, 0 },
+    [OP_AND]        = { 1, 2, 1, 0 },
+    [OP_OR]         = { 1, 2, 1, 0 },
+    [OP_XOR]        = { 1, 2, 1, 0 },
+    [OP_INVERT]     = { 1, 1, 1, 0 },
+    [OP_LSHIFT]     = { 1, 2, 1, 0 },
+    [OP_RSHIFT]     = { 1, 2, 1, 0 },
+    [OP_EQ]         = { 1, 2, 1, 0 },
+    [OP_NEQ]        = { 1, 2, 1, 0 },
+    [OP_LT]         = { 1, 2, 1, 0 },
+    [OP_GT]         = { 1, 2, 1, 0 },
+    [OP_ISZERO]     = { 1, 1, 1, 0 },
+    [OP_ISNEG]      = { 1, 1, 1, 0 },
+    [OP_FETCH]      = { 1, 1, 1, 0 },
+    [OP_STORE]      = { 1, 2, 0, 0 },
+    [OP_PLUS_STORE] = { 1, 2, 0, 0 },
+    [OP_C_FETCH]    = { 1, 1, 1, 0 },
+    [OP_C_STORE]    = { 1, 2, 0, 0 },
+    [OP_TOR]        = { 1, 1, 0, 0 },
+    [OP_RFROM]      = { 1, 0, 1, 0 },
+    [OP_RFETCH]     = { 1, 0, 1, 0 },
+    [OP_RDROP]      = { 1, 0, 0, 0 },
+    [OP_DO]         = { 1, 2, 0, 0 },
+    [OP_QDO]        = { 1, 2, 0, 1 },
+    [OP_LOOP]       = { 1, 0, 0, 1 },
+    [OP_PLOOP]      = { 1, 1, 0, 1 },
+    [OP_I]          = { 1, 0, 1, 0 },
+    [OP_J]          = { 1, 0, 1, 0 },
+    [OP_UNLOOP]     = { 1, 0, 0, 0 },
+
+    [OP_LIT_ADD]          = { 1, 1, 1, 0 },
+    [OP_LIT_EQ]           = { 1, 1, 1, 0 },
+    [OP_LIT_EQ_0BRANCH]   = { 1, 1, 0, 1 },
+    [OP_SQUARE]           = { 1, 1, 1, 0 },
+    [OP_FETCH_ADD]        = { 1, 2, 1, 0 },
+
+    [OP_DIV_SHIFT]        = { 1, 1, 1, 0 },
+    [OP_DIV_MAGIC]        = { 1, 1, 1, 0 },
+};
+
+typedef struct {
+    int op;
+    int operand;
+    int offset;             // last operand: the offset, for branching opcodes
+    int cell;               // offset within the thread, in cells
+    int target;             // index of the instruction branched to
+    int rdepth;             // return stack depth on entry, -1 if not reached
+    int block;              // starts a basic block
+    byte_t *native;
+    byte_t *patch;          // rel32 of a branch still to be resolved
+} insn_t;
+
+typedef struct {
+    entry_t *entry;
+    insn_t *insns;
+    int n;
+    int rmax;               // deepest return stack use within the frame
+    byte_t *pc;
+    byte_t *exits[NUM_EXITS];   // chains of rel32s waiting on each exit
+} jit_t;
+
+static byte_t jit_arena[JIT_ARENA_SIZE] __attribute__((aligned(16)));
+static byte_t *jit_here = jit_arena;
+
+
+static void emit8(jit_t *j, int b)
+{
+    *j->pc++ = (byte_t)b;
+}
+
+static void emit32(jit_t *j, int x)
+{
+    memcpy(j->pc, &x, sizeof(int));
+    j->pc += sizeof(int);
+}
+
+/** opcode reg, [base + disp] -- two byte opcodes are given as 0x0Fxx */
+static void emit_mem(jit_t *j, int opcode, int reg, int base, int disp)
+{
+    if (opcode > 0xFF)
+        emit8(j, opcode >> 8);
+    emit8(j, opcode);
+
+    if (disp >= -128 && disp <= 127)
+    {
+        emit8(j, 0x40 | reg << 3 | base);
+        emit8(j, disp);
+    }
+    else
+    {
+        emit8(j, 0x80 | reg << 3 | base);
+        emit32(j, disp);
+    }
+}
+
+/** opcode reg, rm -- register to register form */
+static void emit_reg(jit_t *j, int opcode, int reg, int rm)
+{
+    if (opcode > 0xFF)
+        emit8(j, opcode >> 8);
+    emit8(j, opcode);
+    emit8(j, 0xC0 | reg << 3 | rm);
+}
+
+#define load(j, reg, base, disp)    emit_mem(j, 0x8B, reg, base, disp)
+#define store(j, base, disp, reg)   emit_mem(j, 0x89, reg, base, disp)
+#define lea(j, reg, base, disp)     emit_mem(j, 0x8D, reg, base, disp)
+
+/** add reg, cells * CELL (negative to subtract) */
+static void adjust(jit_t *j, int reg, int cells)
+{
+    emit_reg(j, 0x83, cells < 0 ? 5 : 0, reg);
+    emit8(j, (cells < 0 ? -cells : cells) * CELL);
+}
+
+static void emit_rel32(jit_t *j, int opcode, void *target)
+{
+    if (opcode > 0xFF)
+        emit8(j, opcode >> 8);
+    emit8(j, opcode);
+    emit32(j, (int)target - (int)(j->pc + sizeof(int)));
+}
+
+/** Jcc to one of the shared exits, chaining the rel32 for later */
+static void jump_exit(jit_t *j, int cc, int exit)
+{
+    if (cc < 0)
+    {
+        emit8(j, 0xE9);
+    }
+    else
+    {
+        emit8(j, 0x0F);
+        emit8(j, 0x80 | cc);
+    }
+
+    byte_t *link = j->pc;
+    emit32(j, (int)j->exits[exit]);
+    j->exits[exit] = link;
+}
+
+/** Points every jump chained on the given exit at the current pc */
+static void resolve_exit(jit_t *j, int exit)
+{
+    byte_t *link = j->exits[exit];
+    while (link != NULL)
+    {
+        byte_t *next;
+        memcpy(&next, link, sizeof(byte_t *));
+        int rel = j->pc - (link + sizeof(int));
+        memcpy(link, &rel, sizeof(int));
+        link = next;
+    }
+    j->exits[exit] = NULL;
+}
+
+/** Jcc (or JMP, if cc < 0) to a branch target within the word */
+static void jump_insn(jit_t *j, insn_t *insn, int cc, int target)
+{
+    if (cc < 0)
+    {
+        emit8(j, 0xE9);
+    }
+    else
+    {
+        emit8(j, 0x0F);
+        emit8(j, 0x80 | cc);
+    }
+
+    insn->target = target;
+    insn->patch = j->pc;
+    emit32(j, 0);
+}
+
+/** call or jmp (ext 2 or 4) through the pointer at addr */
+static void emit_indirect(jit_t *j, int ext, void *addr)
+{
+    emit8(j, 0xFF);
+    emit8(j, 0x05 | ext << 3);
+    emit32(j, (int)addr);
+}
+
+/**
+ * Sets the word registers for a call to xt as the inner interpreter does,
+ * from the entry as it is when the call is made: a redefinition reuses
+ * the entry.
+ */
+static void emit_enter(jit_t *j, entry_t *xt)
+{
+    emit_mem(j, 0xC7, 0, R_CTX, offsetof(context_t, current_xt));
+    emit32(j, (int)xt);
+    emit8(j, 0xA1);                     // mov eax, [&xt->param]
+    emit32(j, (int)&xt->param);
+    store(j, R_CTX, offsetof(context_t, w), EAX);
+}
+
+/**
+ * Calls out to fn(ctx), or if fn is NULL to whatever code xt has when the
+ * call is made: a primitive, __EXEC or another JIT compiled word. The
+ * stack pointers are synced either side. As in the inner interpreter,
+ * ERROR aborts the word and any other state is recorded in the context.
+ */
+static void emit_call(jit_t *j, void *fn, entry_t *xt)
+{
+    store(j, R_CTX, offsetof(context_t, sp), R_SP);
+    store(j, R_CTX, offsetof(context_t, rp), R_RP);
+    if (xt != NULL)
+        emit_enter(j, xt);
+
+    emit8(j, 0x50 | R_CTX);             // push ebx
+    if (fn != NULL)
+        emit_rel32(j, 0xE8, fn);        // call fn
+    else
+        emit_indirect(j, 2, &xt->code_ptr);
+    emit_reg(j, 0x83, 0, ESP);          // add esp, 4
+    emit8(j, sizeof(context_t *));
+
+    emit_reg(j, 0x83, 7, EAX);          // cmp eax, ERROR
+    emit8(j, ERROR);
+    jump_exit(j, CC_E, EXIT_BAIL);
+    emit_reg(j, 0x85, EAX, EAX);        // test eax, eax
+    emit8(j, 0x74);                     // jz over the store
+    byte_t *skip = j->pc++;
+    store(j, R_CTX, offsetof(context_t, state), EAX);
+    *skip = j->pc - (skip + 1);
+
+    load(j, R_SP, R_CTX, offsetof(context_t, sp));
+    load(j, R_RP, R_CTX, offsetof(context_t, rp));
+}
+
+/**
+ * Tail call: tears down this word's frame and jumps to the code xt has
+ * when the jump is made, which then returns straight to our caller. On
+ * entry to a word the stack holds just the return address and ctx, so
+ * it sees exactly the same.
+ */
+static void emit_tail_call(jit_t *j, entry_t *xt)
+{
+    adjust(j, R_RP, -1);
+    store(j, R_CTX, offsetof(context_t, sp), R_SP);
+    store(j, R_CTX, offsetof(context_t, rp), R_RP);
+    emit_enter(j, xt);
+
+    emit8(j, 0x58 | EBP);
+    emit8(j, 0x58 | EDI);
+    emit8(j, 0x58 | ESI);
+    emit8(j, 0x58 | EBX);
+    emit_indirect(j, 4, &xt->code_ptr);  // jmp [&xt->code_ptr]
+}
+
+/** setcc into a forth flag: x1 x2 -- f, or x1 -- f against an immediate */
+static void emit_compare(jit_t *j, int cc, int imm, int has_imm)
+{
+    if (has_imm)
+    {
+        emit_reg(j, 0x31, EDX, EDX);            // xor edx, edx
+        emit_mem(j, 0x81, 7, R_SP, -CELL);      // cmp [esi-4], imm
+        emit32(j, imm);
+    }
+    else
+    {
+        load(j, EAX, R_SP, -CELL);
+        adjust(j, R_SP, -1);
+        emit_reg(j, 0x31, EDX, EDX);
+        emit_mem(j, 0x39, EAX, R_SP, -CELL);    // cmp [esi-4], eax
+    }
+    emit_reg(j, 0x0F90 | cc, 0, EDX);           // setcc dl
+    emit_reg(j, 0xF7, 3, EDX);                  // neg edx
+    store(j, R_SP, -CELL, EDX);
+}
+
+static int condition(int op)
+{
+    switch (op)
+    {
+        case OP_EQ:     return CC_E;
+        case OP_NEQ:    return CC_NE;
+        case OP_LT:     return CC_L;
+        case OP_GT:     return CC_G;
+        default:        return -1;
+    }
+}
+
+static int alu_opcode(int op)
+{
+    switch (op)
+    {
+        case OP_ADD:    return 0x01;
+        case OP_SUB:    return 0x29;
+        case OP_AND:    return 0x21;
+        case OP_OR:     return 0x09;
+        case OP_XOR:    return 0x31;
+        default:        return -1;
+    }
+}
+
+// ModRM reg field selecting the operation in the 0x81 immediate group
+static int alu_group(int op)
+{
+    switch (op)
+    {
+        case OP_ADD:    return 0;
+        case OP_OR:     return 1;
+        case OP_AND:    return 4;
+        case OP_SUB:    return 5;
+        default:        return 6;   // XOR
+    }
+}
+
+/**
+ * Checks once, at the start of a basic block, that the data stack holds
+ * enough cells for the whole block and has room for everything it pushes.
+ */
+static void emit_block_check(jit_t *j, int start)
+{
+    int depth = 0, low = 0, high = 0;
+    for (int i = start; i < j->n && (i == start || !j->insns[i].block); i++)
+    {
+        int op = j->insns[i].op;
+        low = min(low, depth - effects[op].in);
+        depth += effects[op].out - effects[op].in;
+        high = max(high, depth);
+        if (effects[op].ends_block)
+            break;
+    }
+
+    if (low < 0)
+    {
+        lea(j, EAX, R_SP, low * CELL);
+        emit_reg(j, 0x39, R_DS, EAX);           // cmp eax, edi
+        jump_exit(j, CC_B, EXIT_UNDERFLOW);
+    }
+
+    if (high > 0)
+    {
+        lea(j, EAX, R_SP, high * CELL);
+        lea(j, EDX, R_DS, DS_SIZE * CELL);
+        emit_reg(j, 0x39, EDX, EAX);            // cmp eax, edx
+        jump_exit(j, CC_A, EXIT_OVERFLOW);
+    }
+}
+
+/**
+ * Emits the instruction at i, possibly fused with those following it.
+ * Returns the number of instructions consumed.
+ */
+static int emit_insn(jit_t *j, int i)
+{
+    insn_t *insn = &j->insns[i];
+    insn_t *next = i + 1 < j->n && !j->insns[i + 1].block ? &j->insns[i + 1] : NULL;
+    insn_t *next2 = next != NULL && i + 2 < j->n && !j->insns[i + 2].block ? &j->insns[i + 2] : NULL;
+    int cc;
+
+    switch (insn->op)
+    {
+        case OP_CALL:
+        {
+            entry_t *xt = (entry_t *)insn->operand;
+            if (xt == j->entry)
+                emit_call(j, jit_here, NULL);           // recursion
+            else
+                emit_call(j, NULL, xt);
+            return 1;
+        }
+
+        case OP_PRIM:
+        {
+            emit_call(j, NULL, (entry_t *)insn->operand);
+            return 1;
+        }
+
+        case OP_JUMP:
+        {
+            // Recursion in tail position loops, keeping the frame
+            entry_t *xt = (entry_t *)insn->operand;
+            if (xt == j->entry)
+                jump_insn(j, insn, -1, 0);
+            else
+                emit_tail_call(j, xt);
+            return 1;
+        }
+
+        case OP_EXECUTE:
+            emit_call(j, __EXECUTE, NULL);
+            return 1;
+
+        case OP_EXIT:
+            if (i + 1 < j->n)
+                jump_exit(j, -1, EXIT_RETURN);
+            return 1;
+
+        case OP_LIT:
+            if (next != NULL && alu_opcode(next->op) >= 0)
+            {
+                emit_mem(j, 0x81, alu_group(next->op), R_SP, -CELL);
+                emit32(j, insn->operand);
+                return 2;
+            }
+
+            if (next != NULL && (next->op == OP_LSHIFT || next->op == OP_RSHIFT) && insn->operand >= 0 && insn->operand < 32)
+            {
+                emit_mem(j, 0xC1, next->op == OP_LSHIFT ? 4 : 7, R_SP, -CELL);  // shl/sar [esi-4], imm8
+                emit8(j, insn->operand);
+                return 2;
+            }
+
+            if (next != NULL && (cc = condition(next->op)) >= 0)
+            {
+                if (next2 != NULL && next2->op == OP_0BRANCH)
+                {
+                    adjust(j, R_SP, -1);
+                    emit_mem(j, 0x81, 7, R_SP, 0);      // cmp [esi], imm
+                    emit32(j, insn->operand);
+                    jump_insn(j, insn, cc ^ 1, next2->target);
+                    return 3;
+                }
+
+                emit_compare(j, cc, insn->operand, true);
+                return 2;
+            }
+
+            emit_mem(j, 0xC7, 0, R_SP, 0);              // mov [esi], imm
+            emit32(j, insn->operand);
+            adjust(j, R_SP, 1);
+            return 1;
+
+        case OP_BRANCH:
+            jump_insn(j, insn, -1, insn->target);
+            return 1;
+
+        case OP_0BRANCH:
+            adjust(j, R_SP, -1);
+            emit_mem(j, 0x83, 7, R_SP, 0);              // cmp [esi], 0
+            emit8(j, 0);
+            jump_insn(j, insn, CC_E, insn->target);
+            return 1;
+
+        case OP_DUP:
+            load(j, EAX, R_SP, -CELL);
+            store(j, R_SP, 0, EAX);
+            adjust(j, R_SP, 1);
+            return 1;
+
+        case OP_QDUP:
+        {
+            load(j, EAX, R_SP, -CELL);
+            emit_reg(j, 0x85, EAX, EAX);
+            emit8(j, 0x74);                             // jz over the push
+            byte_t *skip = j->pc++;
+            store(j, R_SP, 0, EAX);
+            adjust(j, R_SP, 1);
+            *skip = j->pc - (skip + 1);
+            return 1;
+        }
+
+        case OP_DROP:
+            adjust(j, R_SP, -1);
+            return 1;
+
+        case OP_SWAP:
+            load(j, EAX, R_SP, -CELL);
+            load(j, EDX, R_SP, -2 * CELL);
+            store(j, R_SP, -2 * CELL, EAX);
+            store(j, R_SP, -CELL, EDX);
+            return 1;
+
+        case OP_OVER:
+            load(j, EAX, R_SP, -2 * CELL);
+            store(j, R_SP, 0, EAX);
+            adjust(j, R_SP, 1);
+            return 1;
+
+        case OP_ROT:
+            load(j, EAX, R_SP, -3 * CELL);
+            load(j, EDX, R_SP, -2 * CELL);
+            load(j, ECX, R_SP, -CELL);
+            store(j, R_SP, -3 * CELL, EDX);
+            store(j, R_SP, -2 * CELL, ECX);
+            store(j, R_SP, -CELL, EAX);
+            return 1;
+
+        case OP_MINROT:
+            load(j, EAX, R_SP, -3 * CELL);
+            load(j, EDX, R_SP, -2 * CELL);
+            load(j, ECX, R_SP, -CELL);
+            store(j, R_SP, -3 * CELL, ECX);
+            store(j, R_SP, -2 * CELL, EAX);
+            store(j, R_SP, -CELL, EDX);
+            return 1;
+
+        case OP_NIP:
+            load(j, EAX, R_SP, -CELL);
+            store(j, R_SP, -2 * CELL, EAX);
+            adjust(j, R_SP, -1);
+            return 1;
+
+        case OP_TUCK:
+            load(j, EAX, R_SP, -CELL);
+            load(j, EDX, R_SP, -2 * CELL);
+            store(j, R_SP, -2 * CELL, EAX);
+            store(j, R_SP, -CELL, EDX);
+            store(j, R_SP, 0, EAX);
+            adjust(j, R_SP, 1);
+            return 1;
+
+        case OP_2DUP:
+            load(j, EAX, R_SP, -2 * CELL);
+            load(j, EDX, R_SP, -CELL);
+            store(j, R_SP, 0, EAX);
+            store(j, R_SP, CELL, EDX);
+            adjust(j, R_SP, 2);
+            return 1;
+
+        case OP_2DROP:
+            adjust(j, R_SP, -2);
+            return 1;
+
+        case OP_ADD:
+        case OP_SUB:
+        case OP_AND:
+        case OP_OR:
+        case OP_XOR:
+            load(j, EAX, R_SP, -CELL);
+            adjust(j, R_SP, -1);
+            emit_mem(j, alu_opcode(insn->op), EAX, R_SP, -CELL);
+            return 1;
+
+        case OP_MUL:
+            load(j, EAX, R_SP, -2 * CELL);
+            emit_mem(j, 0x0FAF, EAX, R_SP, -CELL);      // imul eax, [esi-4]
+            adjust(j, R_SP, -1);
+            store(j, R_SP, -CELL, EAX);
+            return 1;
+
+        // A zero divisor traps, and interpret throws -10. So would the
+        // smallest cell divided by -1, which is out of range instead
+        case OP_DIV:
+        case OP_MOD:
+        {
+            load(j, ECX, R_SP, -CELL);
+            load(j, EAX, R_SP, -2 * CELL);
+            emit_reg(j, 0x83, 7, ECX);                  // cmp ecx, -1
+            emit8(j, -1);
+            emit8(j, 0x75);                             // jne over the check
+            byte_t *skip = j->pc++;
+            emit_reg(j, 0x81, 7, EAX);                  // cmp eax, CELL_MIN
+            emit32(j, CELL_MIN);
+            jump_exit(j, CC_E, EXIT_OUT_OF_RANGE);
+            *skip = j->pc - (skip + 1);
+
+            emit8(j, 0x99);                             // cdq
+            emit_reg(j, 0xF7, 7, ECX);                  // idiv ecx
+            adjust(j, R_SP, -1);
+            store(j, R_SP, -CELL, insn->op == OP_DIV ? EAX : EDX);
+            return 1;
+        }
+
+        case OP_INC:
+            emit_mem(j, 0xFF, 0, R_SP, -CELL);
+            return 1;
+
+        case OP_DEC:
+            emit_mem(j, 0xFF, 1, R_SP, -CELL);
+            return 1;
+
+        case OP_DBL:
+            emit_mem(j, 0xD1, 4, R_SP, -CELL);          // shl [esi-4], 1
+            return 1;
+
+        case OP_NEG:
+            emit_mem(j, 0xF7, 3, R_SP, -CELL);
+            return 1;
+
+        case OP_INVERT:
+            emit_mem(j, 0xF7, 2, R_SP, -CELL);
+            return 1;
+
+        case OP_LSHIFT:
+        case OP_RSHIFT:
+            load(j, ECX, R_SP, -CELL);
+            adjust(j, R_SP, -1);
+            emit_mem(j, 0xD3, insn->op == OP_LSHIFT ? 4 : 7, R_SP, -CELL);   // shl/sar [esi-4], cl
+            return 1;
+
+        case OP_EQ:
+        case OP_NEQ:
+        case OP_LT:
+        case OP_GT:
+            cc = condition(insn->op);
+            if (next != NULL && next->op == OP_0BRANCH)
+            {
+                load(j, EAX, R_SP, -CELL);
+                adjust(j, R_SP, -2);
+                emit_mem(j, 0x39, EAX, R_SP, 0);        // cmp [esi], eax
+                jump_insn(j, insn, cc ^ 1, next->target);
+                return 2;
+            }
+            emit_compare(j, cc, 0, false);
+            return 1;
+
+        case OP_ISZERO:
+            if (next != NULL && next->op == OP_0BRANCH)
+            {
+                adjust(j, R_SP, -1);
+                emit_mem(j, 0x83, 7, R_SP, 0);
+                emit8(j, 0);
+                jump_insn(j, insn, CC_NE, next->target);
+                return 2;
+            }
+            emit_reg(j, 0x31, EDX, EDX);
+            emit_mem(j, 0x83, 7, R_SP, -CELL);          // cmp [esi-4], 0
+            emit8(j, 0);
+            emit_reg(j, 0x0F90 | CC_E, 0, EDX);
+            emit_reg(j, 0xF7, 3, EDX);
+            store(j, R_SP, -CELL, EDX);
+            return 1;
+
+        case OP_ISNEG:
+            emit_mem(j, 0xC1, 7, R_SP, -CELL);          // sar [esi-4], 31
+            emit8(j, 31);
+            return 1;
+
+        case OP_FETCH:
+            load(j, EAX, R_SP, -CELL);
+            emit8(j, 0xA8);                             // test al, 3
+            emit8(j, CELL - 1);
+            jump_exit(j, CC_NE, EXIT_MISALIGNED);
+            load(j, EAX, EAX, 0);
+            store(j, R_SP, -CELL, EAX);
+            return 1;
+
+        case OP_STORE:
+        case OP_PLUS_STORE:
+            load(j, EAX, R_SP, -CELL);
+            emit8(j, 0xA8);
+            emit8(j, CELL - 1);
+            jump_exit(j, CC_NE, EXIT_MISALIGNED);
+            load(j, EDX, R_SP, -2 * CELL);
+            emit_mem(j, insn->op == OP_STORE ? 0x89 : 0x01, EDX, EAX, 0);
+            adjust(j, R_SP, -2);
+            return 1;
+
+        case OP_C_FETCH:
+            load(j, EAX, R_SP, -CELL);
+            emit_mem(j, 0x0FB6, EAX, EAX, 0);           // movzx eax, byte [eax]
+            store(j, R_SP, -CELL, EAX);
+            return 1;
+
+        case OP_C_STORE:
+            load(j, EAX, R_SP, -CELL);
+            load(j, EDX, R_SP, -2 * CELL);
+            emit_mem(j, 0x88, EDX, EAX, 0);             // mov [eax], dl
+            adjust(j, R_SP, -2);
+            return 1;
+
+        case OP_TOR:
+            load(j, EAX, R_SP, -CELL);
+            adjust(j, R_SP, -1);
+            store(j, R_RP, 0, EAX);
+            adjust(j, R_RP, 1);
+            return 1;
+
+        case OP_RFROM:
+            adjust(j, R_RP, -1);
+            load(j, EAX, R_RP, 0);
+            store(j, R_SP, 0, EAX);
+            adjust(j, R_SP, 1);
+            return 1;
+
+        case OP_RFETCH:
+            load(j, EAX, R_RP, -CELL);
+            store(j, R_SP, 0, EAX);
+            adjust(j, R_SP, 1);
+            return 1;
+
+        case OP_RDROP:
+            adjust(j, R_RP, -1);
+            return 1;
+
+        case OP_DO:
+        case OP_QDO:
+            load(j, EAX, R_SP, -2 * CELL);              // limit
+            load(j, EDX, R_SP, -CELL);                  // index
+            adjust(j, R_SP, -2);
+            if (insn->op == OP_QDO)
+            {
+                emit_reg(j, 0x39, EDX, EAX);            // cmp eax, edx
+                jump_insn(j, insn, CC_E, insn->target);
+            }
+            store(j, R_RP, 0, EAX);
+            store(j, R_RP, CELL, EDX);
+            adjust(j, R_RP, 2);
+            return 1;
+
+        case OP_LOOP:
+            load(j, EAX, R_RP, -CELL);
+            emit_reg(j, 0xFF, 0, EAX);                  // inc eax
+            store(j, R_RP, -CELL, EAX);
+            emit_mem(j, 0x3B, EAX, R_RP, -2 * CELL);    // cmp eax, [ebp-8]
+            jump_insn(j, insn, CC_NE, insn->target);
+            adjust(j, R_RP, -2);
+            return 1;
+
+        case OP_PLOOP:
+            // continue unless (x ^ (x + n)) & (x ^ n) < 0, x = index - limit
+            load(j, ECX, R_SP, -CELL);
+            adjust(j, R_SP, -1);
+            load(j, EAX, R_RP, -CELL);
+            emit_mem(j, 0x2B, EAX, R_RP, -2 * CELL);    // sub eax, [ebp-8]
+            emit_mem(j, 0x01, ECX, R_RP, -CELL);        // add [ebp-4], ecx
+            emit_reg(j, 0x89, EAX, EDX);                // mov edx, eax
+            emit_reg(j, 0x01, ECX, EDX);                // add edx, ecx
+            emit_reg(j, 0x31, EAX, EDX);                // xor edx, eax
+            emit_reg(j, 0x31, EAX, ECX);                // xor ecx, eax
+            emit_reg(j, 0x21, ECX, EDX);                // and edx, ecx
+            jump_insn(j, insn, CC_NS, insn->target);
+            adjust(j, R_RP, -2);
+            return 1;
+
+        case OP_I:
+        case OP_J:
+            load(j, EAX, R_RP, insn->op == OP_I ? -CELL : -3 * CELL);
+            store(j, R_SP, 0, EAX);
+            adjust(j, R_SP, 1);
+            return 1;
+
+        case OP_UNLOOP:
+            adjust(j, R_RP, -2);
+            return 1;
+
+        case OP_LIT_ADD:
+            emit_mem(j, 0x81, 0, R_SP, -CELL);          // add [esi-4], imm
+            emit32(j, insn->operand);
+            return 1;
+
+        case OP_LIT_EQ:
+            emit_compare(j, CC_E, insn->operand, true);
+            return 1;
+
+        case OP_LIT_EQ_0BRANCH:
+            adjust(j, R_SP, -1);
+            emit_mem(j, 0x81, 7, R_SP, 0);              // cmp [esi], imm
+            emit32(j, insn->operand);
+            jump_insn(j, insn, CC_NE, insn->target);
+            return 1;
+
+        case OP_SQUARE:
+            load(j, EAX, R_SP, -CELL);
+            emit_reg(j, 0x0FAF, EAX, EAX);              // imul eax, eax
+            store(j, R_SP, -CELL, EAX);
+            return 1;
+
+        case OP_FETCH_ADD:
+            load(j, EAX, R_SP, -CELL);
+            emit8(j, 0xA8);
+            emit8(j, CELL - 1);
+            jump_exit(j, CC_NE, EXIT_MISALIGNED);
+            load(j, EAX, EAX, 0);
+            adjust(j, R_SP, -1);
+            emit_mem(j, 0x01, EAX, R_SP, -CELL);        // add [esi-4], eax
+            return 1;
+
+        case OP_DIV_SHIFT:
+            load(j, EAX, R_SP, -CELL);
+            emit_reg(j, 0x89, EAX, EDX);                // mov edx, eax
+            emit_reg(j, 0xC1, 7, EDX);                  // sar edx, 31
+            emit8(j, 31);
+            emit_reg(j, 0xC1, 5, EDX);                  // shr edx, 32 - k
+            emit8(j, 32 - insn->operand);
+            emit_reg(j, 0x01, EDX, EAX);                // add eax, edx
+            emit_reg(j, 0xC1, 7, EAX);                  // sar eax, k
+            emit8(j, insn->operand);
+            store(j, R_SP, -CELL, EAX);
+            return 1;
+
+        case OP_DIV_MAGIC:
+            emit8(j, 0xB8 | EAX);                       // mov eax, magic
+            emit32(j, insn->operand);
+            emit_mem(j, 0xF7, 5, R_SP, -CELL);          // imul dword [esi-4]
+            if (insn->operand < 0)
+                emit_mem(j, 0x03, EDX, R_SP, -CELL);    // add edx, [esi-4]
+            emit_reg(j, 0xC1, 7, EDX);                  // sar edx, shift
+            emit8(j, insn->offset);
+            emit_reg(j, 0x89, EDX, EAX);                // mov eax, edx
+            emit_reg(j, 0xC1, 5, EAX);                  // shr eax, 31
+            emit8(j, 31);
+            emit_reg(j, 0x01, EAX, EDX);                // add edx, eax
+            store(j, R_SP, -CELL, EDX);
+            return 1;
+    }
+
+    return 1;
+}
+
+/**
+ * Splits the thread into instructions and resolves branch targets.
+ * Anything that isn't an opcode the JIT knows (inline data, say) fails.
+ */
+static int decode(jit_t *j, word_t *body, int ncells)
+{
+    int *index = malloc(ncells * sizeof(int));
+    if (index == NULL)
+        return false;
+
+    for (int c = 0; c < ncells; c++)
+        index[c] = -1;
+
+    int ok = true;
+    for (int c = 0; c < ncells && ok; j->n++)
+    {
+        int op = vm_opcode(body[c]);
+        if (op < 0 || !effects[op].supported || c + vm_opcodes[op].operands >= ncells)
+        {
+            ok = false;
+            break;
+        }
+
+        insn_t *insn = &j->insns[j->n];
+        insn->op = op;
+        insn->cell = c;
+        insn->rdepth = -1;
+        insn->operand = vm_opcodes[op].operands > 0 ? body[c + 1].val : 0;
+        insn->offset = body[c + vm_opcodes[op].operands].val;
+        index[c] = j->n;
+        c += 1 + vm_opcodes[op].operands;
+
+        // Words reading their caller's return address only work threaded
+        if ((op == OP_CALL || op == OP_JUMP) && is_set(((entry_t *)insn->operand), FLAG_NO_JIT))
+            ok = false;
+    }
+
+    for (int i = 0; i < j->n && ok; i++)
+    {
+        insn_t *insn = &j->insns[i];
+        if (vm_is_branch(insn->op))
+        {
+            // offsets are in bytes, relative to the offset cell itself
+            int target = insn->cell + vm_opcodes[insn->op].operands + insn->offset / (int)CELL;
+            if (insn->offset % CELL != 0 || target < 0 || target >= ncells || index[target] < 0)
+            {
+                ok = false;
+                break;
+            }
+
+            insn->target = index[target];
+            j->insns[insn->target].block = true;
+        }
+
+        if (effects[insn->op].ends_block && i + 1 < j->n)
+            j->insns[i + 1].block = true;
+    }
+
+    if (j->n > 0)
+        j->insns[0].block = true;
+
+    free(index);
+    return ok;
+}
+
+/**
+ * Follows every path through the word, checking the return stack is used
+ * consistently: the same depth wherever paths meet, and back to empty at
+ * each EXIT. Words that reach below their own frame are marked FLAG_NO_JIT.
+ */
+static int check_return_stack(jit_t *j)
+{
+    int *worklist = malloc(j->n * sizeof(int));
+    if (worklist == NULL)
+        return false;
+
+    int pending = 0;
+    int ok = true;
+
+    j->insns[0].rdepth = 0;
+    worklist[pending++] = 0;
+
+    while (pending > 0 && ok)
+    {
+        int i = worklist[--pending];
+        insn_t *insn = &j->insns[i];
+        int depth = insn->rdepth;
+        int needs = 0;          // cells of the frame the instruction reads
+        int succ[2] = { -1, -1 };
+        int succ_depth[2] = { depth, depth };
+
+        switch (insn->op)
+        {
+            case OP_TOR:
+                succ_depth[0]++;
+                break;
+
+            case OP_RFROM:
+            case OP_RDROP:
+                succ_depth[0]--;
+                // fall through
+            case OP_RFETCH:
+            case OP_I:
+                needs = 1;
+                break;
+
+            case OP_J:
+                needs = 3;
+                break;
+
+            case OP_DO:
+            case OP_QDO:
+                succ_depth[0] += 2;     // ?DO's skip leaves no frame
+                break;
+
+            case OP_LOOP:
+            case OP_PLOOP:
+            case OP_UNLOOP:
+                succ_depth[0] -= 2;     // (+)LOOP keeps the frame going round
+                needs = 2;
+                break;
+
+            case OP_EXIT:
+            case OP_JUMP:
+                if (depth != 0)
+                    ok = false;
+                break;
+        }
+
+        if (depth < needs)
+        {
+            j->entry->flags |= FLAG_NO_JIT;
+            ok = false;
+        }
+
+        j->rmax = max(j->rmax, succ_depth[0]);
+
+        if (insn->op != OP_EXIT && insn->op != OP_JUMP && insn->op != OP_BRANCH)
+            succ[0] = i + 1;
+        if (vm_is_branch(insn->op))
+            succ[1] = insn->target;
+
+        for (int k = 0; k < 2 && ok; k++)
+        {
+            if (succ[k] < 0)
+                continue;
+
+            if (succ[k] >= j->n)
+            {
+                ok = false;     // runs off the end of the thread
+            }
+            else if (j->insns[succ[k]].rdepth < 0)
+            {
+                j->insns[succ[k]].rdepth = succ_depth[k];
+                worklist[pending++] = succ[k];
+            }
+            else if (j->insns[succ[k]].rdepth != succ_depth[k])
+            {
+                ok = false;
+            }
+        }
+    }
+
+    free(worklist);
+    return ok;
+}
+
+static void emit_word(jit_t *j)
+{
+    // prologue: save callee-saved registers, load the stack pointers
+    emit8(j, 0x50 | EBX);
+    emit8(j, 0x50 | ESI);
+    emit8(j, 0x50 | EDI);
+    emit8(j, 0x50 | EBP);
+    emit8(j, 0x8B);                         // mov ebx, [esp+20]
+    emit8(j, 0x5C);
+    emit8(j, 0x24);
+    emit8(j, 5 * sizeof(int));
+    load(j, R_SP, R_CTX, offsetof(context_t, sp));
+    load(j, R_DS, R_CTX, offsetof(context_t, ds));
+    load(j, R_RP, R_CTX, offsetof(context_t, rp));
+
+    // The word takes a return stack cell just as it would threaded, plus
+    // whatever it pushes itself
+    lea(j, EAX, R_RP, (j->rmax + 1) * CELL);
+    load(j, EDX, R_CTX, offsetof(context_t, rs));
+    emit_reg(j, 0x81, 0, EDX);              // add edx, RS_SIZE * CELL
+    emit32(j, RS_SIZE * CELL);
+    emit_reg(j, 0x39, EDX, EAX);
+    jump_exit(j, CC_A, EXIT_RSTACK_OVERFLOW);
+    emit_mem(j, 0xC7, 0, R_RP, 0);
+    emit32(j, (int)j->entry);
+    adjust(j, R_RP, 1);
+
+    for (int i = 0; i < j->n; )
+    {
+        j->insns[i].native = j->pc;
+        if (j->insns[i].block)
+            emit_block_check(j, i);
+        i += emit_insn(j, i);
+    }
+
+    for (int i = 0; i < j->n; i++)
+    {
+        insn_t *insn = &j->insns[i];
+        if (insn->patch != NULL)
+        {
+            int rel = j->insns[insn->target].native - (insn->patch + sizeof(int));
+            memcpy(insn->patch, &rel, sizeof(int));
+        }
+    }
+
+    // epilogue: drop the frame cell, write back the stack pointers
+    resolve_exit(j, EXIT_RETURN);
+    adjust(j, R_RP, -1);
+    store(j, R_CTX, offsetof(context_t, sp), R_SP);
+    store(j, R_CTX, offsetof(context_t, rp), R_RP);
+    emit_reg(j, 0x31, EAX, EAX);            // return OK
+    byte_t *ret = j->pc;
+    emit8(j, 0x58 | EBP);
+    emit8(j, 0x58 | EDI);
+    emit8(j, 0x58 | ESI);
+    emit8(j, 0x58 | EBX);
+    emit8(j, 0xC3);
+
+    // A called word already reported the error and reset the stacks
+    resolve_exit(j, EXIT_BAIL);
+    emit8(j, 0xB8);                         // mov eax, ERROR
+    emit32(j, ERROR);
+    emit_rel32(j, 0xE9, ret);
+
+    for (int exit = EXIT_OVERFLOW; exit < NUM_EXITS; exit++)
+    {
+        if (j->exits[exit] == NULL)
+            continue;
+
+        // error_msg(ctx, errno, " in: %s", name)
+        resolve_exit(j, exit);
+        emit8(j, 0x68);
+        emit32(j, (int)j->entry->name);
+        emit8(j, 0x68);
+        emit32(j, (int)" in: %s");
+        emit8(j, 0x68);
+        emit32(j, exit_errno[exit]);
+        emit8(j, 0x50 | R_CTX);
+        emit_rel32(j, 0xE8, error_msg);
+        emit_reg(j, 0x83, 0, ESP);
+        emit8(j, 4 * sizeof(int));
+        emit_rel32(j, 0xE9, ret);
+    }
+}
+
+// Worst case code size: a call out with its block check and status test
+#define MAX_INSN_SIZE 96
+#define MAX_OVERHEAD_SIZE 256
+
+int jit_compile(context_t *ctx, entry_t *entry)
+{
+    int ncells = entry_info(entry)->alloc_size / sizeof(word_t);
+    if (ncells <= 0)
+        return false;
+
+    jit_t jit = { .entry = entry };
+    jit.insns = calloc(1, ncells * sizeof(insn_t));
+    if (jit.insns == NULL)
+        return false;
+
+    // The analysis runs even when the JIT is off, so that words reaching
+    // into their caller's frame are always known about
+    int ok = decode(&jit, (word_t *)entry->param.ptr, ncells) && check_return_stack(&jit);
+
+    if (ok && ctx->jit && jit_here + jit.n * MAX_INSN_SIZE + MAX_OVERHEAD_SIZE <= jit_arena + JIT_ARENA_SIZE)
+    {
+        jit.pc = jit_here;
+        emit_word(&jit);
+
+        entry->code_ptr = (void *)jit_here;
+        jit_here = (byte_t *)((int)(jit.pc + 15) & ~15);
+    }
+    else
+    {
+        ok = false;
+    }
+
+    free(jit.insns);
+    return ok;
+}
+
+int jit_contains(void *addr)
+{
+    return (byte_t *)addr >= jit_arena && (byte_t *)addr < jit_here;
+}
+
+void jit_release(void *addr)
+{
+    if (jit_contains(addr))
+        jit_here = addr;
+}
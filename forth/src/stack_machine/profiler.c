@@ -0,0 +1,463 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <kernel/system.h>
+
+#include <stack_machine/common.h>
+#include <stack_machine/compiler.h>
+#include <stack_machine/context.h>
+#include <stack_machine/entry.h>
+#include <stack_machine/jit.h>
+#include <stack_machine/profiler.h>
+#include <stack_machine/vm.h>
+#include <collections/hashtable.h>
+
+/**
+ * Per word counts, kept in an open addressed table keyed on the xt.
+ * Inclusive (total) time is only added as the outermost activation of a
+ * word returns, so recursion doesn't count it twice.
+ */
+typedef struct {
+    entry_t *xt;
+    unsigned int calls;
+    unsigned int active;
+    unsigned long long self;
+    unsigned long long total;
+} profile_t;
+
+/**
+ * A timed activation. rp is where its EXIT will be, or NULL for calls
+ * timed from C, which are closed by profile_execute. Tail calls push a
+ * frame on top of their caller's, at the same rp, so the caller's total
+ * still includes them.
+ */
+typedef struct {
+    profile_t *rec;
+    int *rp;
+    int tail;
+    unsigned long long start;
+    unsigned long long children;
+} frame_t;
+
+int profiling = false;
+
+static profile_t records[PROFILE_WORDS];
+static frame_t frames[PROFILE_DEPTH];
+static int depth = 0;
+
+static profile_t *lookup(entry_t *xt)
+{
+    unsigned int slot = ((unsigned int)xt >> 4) & (PROFILE_WORDS - 1);
+    for (int i = 0; i < PROFILE_WORDS; i++, slot = (slot + 1) & (PROFILE_WORDS - 1))
+    {
+        if (records[slot].xt == xt)
+            return &records[slot];
+
+        if (records[slot].xt == NULL)
+        {
+            records[slot].xt = xt;
+            return &records[slot];
+        }
+    }
+    return NULL;
+}
+
+static void push_frame(entry_t *xt, int *rp, int tail)
+{
+    profile_t *rec = lookup(xt);
+    if (rec == NULL || depth == PROFILE_DEPTH)
+        return;
+
+    rec->calls++;
+    rec->active++;
+    frames[depth++] = (frame_t){ .rec = rec, .rp = rp, .tail = tail, .children = 0, .start = rdtsc() };
+}
+
+static void pop_frame(unsigned long long now)
+{
+    frame_t *frame = &frames[--depth];
+    unsigned long long elapsed = now - frame->start;
+
+    frame->rec->self += elapsed - frame->children;
+    if (--frame->rec->active == 0)
+        frame->rec->total += elapsed;
+
+    if (depth > 0)
+        frames[depth - 1].children += elapsed;
+}
+
+void profile_enter(entry_t *xt, int *rp)
+{
+    push_frame(xt, rp, false);
+}
+
+void profile_tail(entry_t *xt, int *rp)
+{
+    // Only the latest of a chain of tail calls is kept, as it may never end
+    if (depth > 0 && frames[depth - 1].tail && frames[depth - 1].rp == rp)
+        pop_frame(rdtsc());
+
+    push_frame(xt, rp, true);
+}
+
+void profile_exit(int *rp)
+{
+    // Anything deeper never returned normally (R> DROP and the like)
+    unsigned long long now = rdtsc();
+    while (depth > 0 && frames[depth - 1].rp != NULL && frames[depth - 1].rp >= rp)
+        pop_frame(now);
+}
+
+state_t profile_execute(context_t *ctx)
+{
+    int saved = depth;
+    push_frame(ctx->current_xt, NULL, false);
+
+    state_t retval = ctx->current_xt->code_ptr(ctx);
+
+    // Closes everything an error (or PROFILE-RESET) left open, too
+    unsigned long long now = rdtsc();
+    while (depth > saved)
+        pop_frame(now);
+
+    return retval;
+}
+
+void profile_start(context_t *ctx)
+{
+    if (!profiling)
+    {
+        vm_swap_handlers(ctx);
+        profiling = true;
+    }
+}
+
+void profile_stop(context_t *ctx)
+{
+    if (profiling)
+    {
+        // Close whatever is still running now, rather than after the swap
+        unsigned long long now = rdtsc();
+        while (depth > 0)
+            pop_frame(now);
+
+        vm_swap_handlers(ctx);
+        profiling = false;
+    }
+}
+
+void profile_reset(void)
+{
+    memset(records, 0, sizeof(records));
+    depth = 0;
+}
+
+/**
+ * Formats a 64 bit count in decimal, right aligned in width characters,
+ * using only 32 bit division (libgcc isn't linked into libforth).
+ */
+char *format_count(char *out, unsigned long long n, int width)
+{
+    char digits[24];
+    int len = 0;
+    unsigned int hi = n >> 32, lo = n;
+
+    do
+    {
+        unsigned int r = hi % 10;
+        hi /= 10;
+        unsigned int t = (r << 16) | (lo >> 16);
+        unsigned int q = t / 10;
+        t = ((t % 10) << 16) | (lo & 0xFFFF);
+        lo = (q << 16) | (t / 10);
+        digits[len++] = '0' + t % 10;
+    } while (hi != 0 || lo != 0);
+
+    while (width-- > len)
+        *out++ = ' ';
+    while (len > 0)
+        *out++ = digits[--len];
+    return out;
+}
+
+static int by_self_time(const profile_t **a, const profile_t **b)
+{
+    if ((*a)->self == (*b)->self)
+        return (*a)->calls < (*b)->calls ? 1 : (*a)->calls > (*b)->calls ? -1 : 0;
+    return (*a)->self < (*b)->self ? 1 : -1;
+}
+
+#define PROFILE_LINE 80
+
+char **profile_report(void)
+{
+    int n = 0;
+    unsigned long long sum = 0;
+    profile_t **sorted = malloc(PROFILE_WORDS * sizeof(profile_t *));
+    if (sorted == NULL)
+        return NULL;
+
+    for (int slot = 0; slot < PROFILE_WORDS; slot++)
+    {
+        if (records[slot].xt != NULL && records[slot].calls > 0)
+        {
+            sorted[n++] = &records[slot];
+            sum += records[slot].self;
+        }
+    }
+    qsort(sorted, n, sizeof(profile_t *), (void *)by_self_time);
+
+    // Pointers to each line, then the lines themselves, in one block
+    char **text = calloc(1, (n + 2) * (sizeof(char *) + PROFILE_LINE));
+    if (text == NULL)
+    {
+        free(sorted);
+        return NULL;
+    }
+
+    static const char header[] = "     calls        self cycles  self%       total cycles  word";
+    char *line = (char *)(text + n + 2);
+    text[0] = memcpy(line, header, sizeof(header));
+
+    for (int i = 0; i < n; i++)
+    {
+        profile_t *rec = sorted[i];
+        int percent = sum == 0 ? 0 : (int)(100.0 * (double)(long long)rec->self / (double)(long long)sum);
+        char *out = text[i + 1] = line + (i + 1) * PROFILE_LINE;
+
+        out = format_count(out, rec->calls, 10);
+        out = format_count(out, rec->self, 19);
+        out = format_count(out, percent, 6);
+        *out++ = '%';
+        out = format_count(out, rec->total, 19);
+        *out++ = ' ';
+        *out++ = ' ';
+        char *name = rec->xt->name != NULL ? rec->xt->name : "?";
+        memcpy(out, name, min(strlen(name), line + (i + 2) * PROFILE_LINE - out - 1));
+    }
+
+    text[n + 1] = NULL;
+    free(sorted);
+    return text;
+}
+
+
+/**
+ * The sampling profiler: while SAMPLE-ON is in force, every timer tick
+ * counts the interrupted thread position, word and EIP in fixed-size
+ * histograms. Native code and C never update ctx->ip, hence the EIP.
+ * Only the report maps them back to dictionary words.
+ */
+typedef struct {
+    unsigned int key;
+    unsigned int count;
+} histogram_t;
+
+static histogram_t by_ip[SAMPLE_SLOTS];
+static histogram_t by_xt[SAMPLE_SLOTS];
+static histogram_t by_eip[SAMPLE_SLOTS];
+static unsigned int samples = 0;
+static unsigned int dropped = 0;
+static int sample_hz = 0;
+static context_t *sampled = NULL;
+
+static void count(histogram_t *hist, unsigned int key)
+{
+    // A short probe: this runs in the interrupt handler
+    unsigned int slot = ((key >> 2) ^ (key >> 12)) & (SAMPLE_SLOTS - 1);
+    for (int i = 0; i < 16; i++, slot = (slot + 1) & (SAMPLE_SLOTS - 1))
+    {
+        if (hist[slot].count == 0)
+            hist[slot].key = key;
+
+        if (hist[slot].key == key)
+        {
+            hist[slot].count++;
+            return;
+        }
+    }
+    dropped++;
+}
+
+static void sample(registers_t *r)
+{
+    // ctx->ip is only saved inside a thread, which has pushed a return
+    // address; at the top level it is left over from the last one
+    samples++;
+    count(by_ip, sampled->rp > sampled->rs ? (unsigned int)sampled->ip : 0);
+    count(by_xt, (unsigned int)sampled->current_xt);
+    count(by_eip, r->eip);
+}
+
+void sample_start(context_t *ctx, int hz)
+{
+    sampled = ctx;
+    sample_hz = hz;
+    timer_set_sampler(sample);
+    timer_phase(hz);
+}
+
+void sample_stop(void)
+{
+    timer_set_sampler(NULL);
+    timer_phase(0);
+    sample_hz = 0;
+}
+
+void sample_reset(void)
+{
+    // Nothing may be counted while the histograms are cleared
+    timer_set_sampler(NULL);
+    memset(by_ip, 0, sizeof(by_ip));
+    memset(by_xt, 0, sizeof(by_xt));
+    memset(by_eip, 0, sizeof(by_eip));
+    samples = dropped = 0;
+
+    if (sample_hz > 0)
+        timer_set_sampler(sample);
+}
+
+/**
+ * Finds the word whose thread, or native code, holds addr: the thread
+ * ranges are known exactly, native code is taken to run up to the start
+ * of the next word in the JIT arena.
+ */
+static entry_t *word_at(hashtable_t *htbl, unsigned int addr)
+{
+    entry_t *best = NULL;
+    for (int slot = 0; slot < htbl->capacity; slot++)
+    {
+        if (!hashtable_occupied(htbl, slot))
+            continue;
+
+        entry_t *entry = hashtable_data(htbl, slot);
+        unsigned int thread = (unsigned int)entry->param.val;
+        if (is_colon_definition(entry) && addr >= thread && addr < thread + entry_info(entry)->alloc_size)
+            return entry;
+
+        unsigned int code = (unsigned int)entry->code_ptr;
+        if (jit_contains(entry->code_ptr) && code <= addr && (best == NULL || code > (unsigned int)best->code_ptr))
+            best = entry;
+    }
+    return jit_contains((void *)addr) ? best : NULL;
+}
+
+typedef struct {
+    char *name;             // or NULL for an address outside any word
+    unsigned int addr;
+    unsigned int count;
+} tally_t;
+
+static int add_tally(tally_t *tallies, int n, char *name, unsigned int addr, unsigned int count)
+{
+    for (int i = 0; i < n; i++)
+    {
+        if (tallies[i].name == name && tallies[i].addr == addr)
+        {
+            tallies[i].count += count;
+            return n;
+        }
+    }
+    tallies[n] = (tally_t){ .name = name, .addr = addr, .count = count };
+    return n + 1;
+}
+
+static int by_count(const tally_t *a, const tally_t *b)
+{
+    return a->count < b->count ? 1 : a->count > b->count ? -1 : 0;
+}
+
+/**
+ * Maps one histogram onto words (or bare addresses) and appends it to the
+ * report as a section, returning the next free line.
+ */
+static int report_section(context_t *ctx, char **text, int line, char *heading, histogram_t *hist, int kind)
+{
+    tally_t *tallies = malloc(SAMPLE_SLOTS * sizeof(tally_t));
+    if (tallies == NULL)
+        return line;
+
+    int n = 0;
+    for (int slot = 0; slot < SAMPLE_SLOTS; slot++)
+    {
+        if (hist[slot].count == 0)
+            continue;
+
+        unsigned int key = hist[slot].key;
+        entry_t *entry = kind == 'x' ? (entry_t *)key : word_at(ctx->exe_tok, key);
+        if (entry != NULL)
+            n = add_tally(tallies, n, entry->name, 0, hist[slot].count);
+        else if (kind == 'e' && vm_contains((void *)key))
+            n = add_tally(tallies, n, "(inner interpreter)", 0, hist[slot].count);
+        else if (kind == 'e')
+            n = add_tally(tallies, n, NULL, key, hist[slot].count);
+        else
+            n = add_tally(tallies, n, "(interpreter)", 0, hist[slot].count);
+    }
+    qsort(tallies, n, sizeof(tally_t), (void *)by_count);
+
+    static const char columns[] = "  samples      %  ";
+    memcpy(text[line], columns, sizeof(columns) - 1);
+    memcpy(text[line++] + sizeof(columns) - 1, heading, strlen(heading));
+
+    for (int i = 0; i < n; i++)
+    {
+        char *start = text[line++], *out = start;
+        out = format_count(out, tallies[i].count, 9);
+        out = format_count(out, samples == 0 ? 0 : (int)(100.0 * (int)tallies[i].count / (int)samples), 6);
+        *out++ = '%';
+        *out++ = ' ';
+        *out++ = ' ';
+
+        char *name = tallies[i].name;
+        if (name == NULL)
+        {
+            *out++ = '0';
+            *out++ = 'x';
+            itoa(tallies[i].addr, out, 16);
+        }
+        else
+        {
+            memcpy(out, name, min(strlen(name), start + SAMPLE_LINE - out - 1));
+        }
+    }
+
+    free(tallies);
+    return line + 1;
+}
+
+char **sample_report(context_t *ctx)
+{
+    // Keep ticking while the report is built, but not into the histograms
+    timer_set_sampler(NULL);
+
+    // Room for the summary, three headings, blank lines, and a line per
+    // histogram slot in use
+    int lines = 8;
+    for (int slot = 0; slot < SAMPLE_SLOTS; slot++)
+        lines += (by_ip[slot].count != 0) + (by_xt[slot].count != 0) + (by_eip[slot].count != 0);
+
+    char **text = calloc(1, lines * (sizeof(char *) + SAMPLE_LINE));
+    if (text != NULL)
+    {
+        for (int i = 0; i < lines; i++)
+            text[i] = (char *)(text + lines) + i * SAMPLE_LINE;
+
+        int line = 0;
+        char *out = format_count(text[line++], samples, 0);
+        memcpy(out, " samples, ", 10);
+        out = format_count(out + 10, dropped, 0);
+        memcpy(out, " not counted", 12);
+        line++;
+
+        line = report_section(ctx, text, line, "word being run (by thread position)", by_ip, 'i');
+        line = report_section(ctx, text, line, "word last called (current_xt)", by_xt, 'x');
+        line = report_section(ctx, text, line, "native word or C address (by EIP)", by_eip, 'e');
+        text[line - 1] = NULL;
+    }
+
+    if (sample_hz > 0)
+        timer_set_sampler(sample);
+
+    return text;
+}
@@ -12,8 +12,12 @@
 #include <stack_machine/context.h>
 #include <stack_machine/compiler.h>
 #include <stack_machine/interpreter.h>
+#include <stack_machine/repl.h>
 #include <stack_machine/entry.h>
 #include <stack_machine/error.h>
+#include <stack_machine/heap.h>
+#include <stack_machine/image.h>
+#include <stack_machine/vm.h>
 
 #include <util/history.h>
 #include <collections/hashtable.h>
@@ -33,7 +37,7 @@ void prompt(context_t *ctx)
         terminal_setcolor(0x0F);
         terminal_writestring("  ok");
         terminal_setcolor(0x07);
-        for (int i = 0, n = stack_size(ctx->ds); i < n; i++)
+        for (int i = 0, n = ds_depth(ctx); i < n; i++)
             terminal_putchar('.');
 
         terminal_putchar('\n');
@@ -45,33 +49,49 @@ void prompt(context_t *ctx)
     terminal_flush();
 }
 
-context_t *init_context()
+/**
+ * Allocates a context with only the primitives defined, for callers that
+ * want to load their own Forth on top of them.
+ */
+context_t *create_context()
 {
-    context_t *ctx = calloc(0, sizeof(context_t));
+    context_t *ctx = calloc(1, sizeof(context_t));
     assert(ctx != NULL);
 
-    ctx->mem = calloc(0, sizeof(byte_t) * MEMSIZ);
+    // Compiled code points into the dictionary, so it can never move: take
+    // a share of the free memory up front for it to grow into
+    unsigned int size = (sbrk_available() / DICTIONARY_SHARE) & ~(CELL - 1);
+    if (size < MEMSIZ)
+        size = MEMSIZ;
+
+    ctx->mem = calloc(1, size + DICTIONARY_GUARD);
     assert(ctx->mem != NULL);
+    ctx->mem_end = (word_t *)((byte_t *)ctx->mem + size);
+    ctx->refs = calloc(1, ((size + DICTIONARY_GUARD) / CELL + 31) / 32 * sizeof(unsigned int));
+    assert(ctx->refs != NULL);
 
     ctx->dp = ctx->mem;
     ctx->ip = ctx->mem;
 
-    ctx->tib = calloc(0, sizeof(inbuf_t));
+    ctx->tib = calloc(1, sizeof(inbuf_t));
     ctx->tib->buffer = malloc(READLINE_BUFSIZ);
 
     ctx->base = DEFAULT_BASE;
     ctx->echo = DEFAULT_ECHO;
+    ctx->jit = DEFAULT_JIT;
+    ctx->fold = DEFAULT_FOLD;
     ctx->state = OK;
-    ctx->ds = malloc(sizeof(stack_t));
-    stack_init(ctx->ds, free);
+    ctx->sp = ctx->ds = alloc_stack(DS_SIZE);
+    assert(ctx->ds != NULL);
 
-    ctx->rs = malloc(sizeof(stack_t));
-    stack_init(ctx->rs, free);
+    ctx->rp = ctx->rs = alloc_stack(RS_SIZE);
+    assert(ctx->rs != NULL);
 
     ctx->exe_tok = malloc(sizeof(hashtable_t));
-    hashtable_init(ctx->exe_tok, BUCKETS, entry_hash, entry_match, free);
+    hashtable_init(ctx->exe_tok, BUCKETS, entry_hash, entry_match, NULL);
 
     // primitives
+    vm_init();
     init_arithmetic_words(ctx);
     init_bit_logic_words(ctx);
     init_comparison_words(ctx);
@@ -79,19 +99,57 @@ context_t *init_context()
     init_misc_words(ctx);
     init_stack_manipulation_words(ctx);
     init_memory_words(ctx);
+    return ctx;
+}
 
+/**
+ * Interprets the Forth sources that make up the system into a context
+ * from create_context. The build runs this once, in forth-image, and
+ * links the result in as the dictionary image.
+ */
+void bootstrap(context_t *ctx)
+{
     // bootstrap forth system proper
-    load(ctx, "system.fth", &system_forth);
+    load(ctx, "system.fth", (char *)&system_forth);
 
     // Any word definitions from this point onwards are 'user-defined'
     ctx->sticky_flags = FLAG_USER_DEFINED;
 
     // FIXME: temporary for testing -- convert to blocks?
-    load(ctx, "examples.fth", &examples_forth);
+    load(ctx, "examples.fth", (char *)&examples_forth);
     //load(ctx, "mandlebrot.fth", &mandlebrot_forth);
+}
+
+context_t *init_context()
+{
+    context_t *ctx = create_context();
+
+    // Built without an image, the sources are interpreted at every boot
+    if (load_image(ctx, (image_header_t *)&dictionary_image) != 0)
+        bootstrap(ctx);
+
+    // Whatever is defined now, the system may refer to (see restore_system)
+    hashtable_t *htbl = ctx->exe_tok;
+    for (int i = 0; i < htbl->capacity; i++)
+    {
+        if (hashtable_occupied(htbl, i))
+            ((entry_t *)hashtable_data(htbl, i))->flags |= FLAG_BOOT;
+    }
+
     return ctx;
 }
 
+/**
+ * Runs a script in place of the interactive prompt, returning 0 if it ran
+ * to the end, or 1 if it stopped at an error.
+ */
+int run_script(char *name, char *text)
+{
+    context_t *ctx = init_context();
+    load(ctx, name, text);
+    return ctx->state == ERROR ? 1 : 0;
+}
+
 #define COMPLETER_SIZ 20
 char *filtered_words[COMPLETER_SIZ];
 char *filter_words(char *text, int state, context_t *ctx)
@@ -99,21 +157,19 @@ char *filter_words(char *text, int state, context_t *ctx)
     if (state == 0)
     {
         char **words = get_words(ctx->exe_tok);
-        char *match = strtoupper(strdup(text));
-        int len = strlen(match);
+        int len = strlen(text);
         int n = ctx->exe_tok->size;
 
-        memset(&filtered_words, 0, COMPLETER_SIZ);
+        memset(&filtered_words, 0, sizeof(filtered_words));
         for (int i = 0, j = 0; i < n && j < COMPLETER_SIZ; i++)
         {
-            if (memcmp(match, words[i], len) == 0)
+            if (name_matches(words[i], text, len))
             {
                 filtered_words[j++] = words[i];
             }
         }
 
         free(words);
-        free(match);
     }
 
     if (state == COMPLETER_SIZ)
@@ -147,6 +203,7 @@ void repl()
         }
 
         add_history(hist, in);
-        interpret(ctx, in);
+        heap_line_start();
+        heap_line_end(interpret(ctx, in));
     }
 }
\ No newline at end of file
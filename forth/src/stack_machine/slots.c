@@ -44,7 +44,7 @@ slot_t *slot_reload(int n)
 
     slot_t *slot = slots[n];
     if (slot == NULL)
-        slots[n] = slot = calloc(0, sizeof(slot_t));
+        slots[n] = slot = calloc(1, sizeof(slot_t));
 
     assert(slot != NULL);
     memset(slot->buffer, 0, SLOT_SIZ);
@@ -79,3 +79,34 @@ void slot_mark_dirty(int n)
     if (slot != NULL)
         slot->flags |= SLOT_DIRTY;
 }
+
+/**
+ * Copies size bytes into the slots from n onwards, marking them dirty.
+ * Returns -1, having copied nothing, if they would run past the last.
+ */
+int slot_write(int n, const void *data, int size)
+{
+    if (n < 0 || size < 0 || n + (size + SLOT_SIZ - 1) / SLOT_SIZ > NUM_SLOTS)
+        return -1;
+
+    for (const char *src = data; size > 0; n++, src += SLOT_SIZ, size -= SLOT_SIZ)
+    {
+        memcpy(slot_buffer(n), src, min(size, SLOT_SIZ));
+        slot_mark_dirty(n);
+    }
+    return 0;
+}
+
+/**
+ * Copies size bytes out of the slots from n onwards, or returns -1.
+ */
+int slot_read(int n, void *data, int size)
+{
+    if (n < 0 || size < 0 || n + (size + SLOT_SIZ - 1) / SLOT_SIZ > NUM_SLOTS)
+        return -1;
+
+    for (char *dst = data; size > 0; n++, dst += SLOT_SIZ, size -= SLOT_SIZ)
+        memcpy(dst, slot_buffer(n), min(size, SLOT_SIZ));
+
+    return 0;
+}
@@ -0,0 +1,868 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <stack_machine/common.h>
+#include <stack_machine/compiler.h>
+#include <stack_machine/context.h>
+#include <stack_machine/entry.h>
+#include <stack_machine/error.h>
+#include <stack_machine/profiler.h>
+#include <stack_machine/vm.h>
+
+// Primitives which have a fast path in the inner interpreter. The C
+// versions are still used when the word is EXECUTEd or interpreted.
+extern state_t __UNNEST(context_t *ctx);
+extern state_t __EXECUTE(context_t *ctx);
+extern state_t __DOLIT(context_t *ctx);
+extern state_t __BRANCH(context_t *ctx);
+extern state_t __0BRANCH(context_t *ctx);
+extern state_t __DUP(context_t *ctx);
+extern state_t __QDUP(context_t *ctx);
+extern state_t __DROP(context_t *ctx);
+extern state_t __SWAP(context_t *ctx);
+extern state_t __OVER(context_t *ctx);
+extern state_t __ROT(context_t *ctx);
+extern state_t __MINROT(context_t *ctx);
+extern state_t __NIP(context_t *ctx);
+extern state_t __TUCK(context_t *ctx);
+extern state_t __2DUP(context_t *ctx);
+extern state_t __2DROP(context_t *ctx);
+extern state_t __ADD(context_t *ctx);
+extern state_t __SUB(context_t *ctx);
+extern state_t __MUL(context_t *ctx);
+extern state_t __DIV(context_t *ctx);
+extern state_t __MOD(context_t *ctx);
+extern state_t __INC(context_t *ctx);
+extern state_t __DEC(context_t *ctx);
+extern state_t __DBL(context_t *ctx);
+extern state_t __NEG(context_t *ctx);
+extern state_t __AND(context_t *ctx);
+extern state_t __OR(context_t *ctx);
+extern state_t __XOR(context_t *ctx);
+extern state_t __INVERT(context_t *ctx);
+extern state_t __LSHIFT(context_t *ctx);
+extern state_t __RSHIFT(context_t *ctx);
+extern state_t __EQ(context_t *ctx);
+extern state_t __NEQ(context_t *ctx);
+extern state_t __LT(context_t *ctx);
+extern state_t __GT(context_t *ctx);
+extern state_t __ISZERO(context_t *ctx);
+extern state_t __ISNEG(context_t *ctx);
+extern state_t __FETCH(context_t *ctx);
+extern state_t __STORE(context_t *ctx);
+extern state_t __PLUS_STORE(context_t *ctx);
+extern state_t __C_FETCH(context_t *ctx);
+extern state_t __C_STORE(context_t *ctx);
+extern state_t __TOR(context_t *ctx);
+extern state_t __RFROM(context_t *ctx);
+extern state_t __RFETCH(context_t *ctx);
+extern state_t __RDROP(context_t *ctx);
+extern state_t __DO(context_t *ctx);
+extern state_t __QDO(context_t *ctx);
+extern state_t __LOOP(context_t *ctx);
+extern state_t __PLOOP(context_t *ctx);
+extern state_t __I(context_t *ctx);
+extern state_t __J(context_t *ctx);
+extern state_t __UNLOOP(context_t *ctx);
+
+const opcode_info_t vm_opcodes[NUM_OPCODES] = {
+    [OP_HALT]       = { "HALT",     0, NULL },
+    [OP_CALL]       = { "CALL",     1, NULL },
+    [OP_PRIM]       = { "PRIM",     1, NULL },
+    [OP_JUMP]       = { "JUMP",     1, NULL },
+    [OP_EXIT]       = { "EXIT",     0, __UNNEST },
+    [OP_EXECUTE]    = { "EXECUTE",  0, __EXECUTE },
+    [OP_LIT]        = { "(LIT)",    1, __DOLIT },
+    [OP_BRANCH]     = { "BRANCH",   1, __BRANCH },
+    [OP_0BRANCH]    = { "0BRANCH",  1, __0BRANCH },
+
+    [OP_DUP]        = { "DUP",      0, __DUP },
+    [OP_QDUP]       = { "?DUP",     0, __QDUP },
+    [OP_DROP]       = { "DROP",     0, __DROP },
+    [OP_SWAP]       = { "SWAP",     0, __SWAP },
+    [OP_OVER]       = { "OVER",     0, __OVER },
+    [OP_ROT]        = { "ROT",      0, __ROT },
+    [OP_MINROT]     = { "-ROT",     0, __MINROT },
+    [OP_NIP]        = { "NIP",      0, __NIP },
+    [OP_TUCK]       = { "TUCK",     0, __TUCK },
+    [OP_2DUP]       = { "2DUP",     0, __2DUP },
+    [OP_2DROP]      = { "2DROP",    0, __2DROP },
+
+    [OP_ADD]        = { "+",        0, __ADD },
+    [OP_SUB]        = { "-",        0, __SUB },
+    [OP_MUL]        = { "*",        0, __MUL },
+    [OP_DIV]        = { "/",        0, __DIV },
+    [OP_MOD]        = { "MOD",      0, __MOD },
+    [OP_INC]        = { "1+",       0, __INC },
+    [OP_DEC]        = { "1-",       0, __DEC },
+    [OP_DBL]        = { "2*",       0, __DBL },
+    [OP_NEG]        = { "NEGATE",   0, __NEG },
+
+    [OP_AND]        = { "AND",      0, __AND },
+    [OP_OR]         = { "OR",       0, __OR },
+    [OP_XOR]        = { "XOR",      0, __XOR },
+    [OP_INVERT]     = { "INVERT",   0, __INVERT },
+    [OP_LSHIFT]     = { "LSHIFT",   0, __LSHIFT },
+    [OP_RSHIFT]     = { "RSHIFT",   0, __RSHIFT },
+
+    [OP_EQ]         = { "=",        0, __EQ },
+    [OP_NEQ]        = { "<>",       0, __NEQ },
+    [OP_LT]         = { "<",        0, __LT },
+    [OP_GT]         = { ">",        0, __GT },
+    [OP_ISZERO]     = { "0=",       0, __ISZERO },
+    [OP_ISNEG]      = { "0<",       0, __ISNEG },
+
+    [OP_FETCH]      = { "@",        0, __FETCH },
+    [OP_STORE]      = { "!",        0, __STORE },
+    [OP_PLUS_STORE] = { "+!",       0, __PLUS_STORE },
+    [OP_C_FETCH]    = { "C@",       0, __C_FETCH },
+    [OP_C_STORE]    = { "C!",       0, __C_STORE },
+
+    [OP_TOR]        = { ">R",       0, __TOR },
+    [OP_RFROM]      = { "R>",       0, __RFROM },
+    [OP_RFETCH]     = { "R@",       0, __RFETCH },
+    [OP_RDROP]      = { "RDROP",    0, __RDROP },
+
+    [OP_DO]         = { "(DO)",     0, __DO },
+    [OP_QDO]        = { "(?DO)",    1, __QDO },
+    [OP_LOOP]       = { "(LOOP)",   1, __LOOP },
+    [OP_PLOOP]      = { "(+LOOP)",  1, __PLOOP },
+    [OP_I]          = { "I",        0, __I },
+    [OP_J]          = { "J",        0, __J },
+    [OP_UNLOOP]     = { "UNLOOP",   0, __UNLOOP },
+
+    [OP_LIT_ADD]          = { "(LIT)+",         1, NULL },
+    [OP_LIT_EQ]           = { "(LIT)=",         1, NULL },
+    [OP_LIT_EQ_0BRANCH]   = { "(LIT)=0BRANCH",  2, NULL },
+    [OP_SQUARE]           = { "DUP*",           0, NULL },
+    [OP_FETCH_ADD]        = { "@+",             0, NULL },
+
+    [OP_DIV_SHIFT]        = { "(/SHIFT)",       1, NULL },
+    [OP_DIV_MAGIC]        = { "(/MAGIC)",       2, NULL },
+};
+
+void *vm_code[NUM_OPCODES];
+
+// The handlers not currently in vm_code: the profiled twins of the call
+// and return opcodes while profiling is off, or the plain ones while it
+// is on. Every other opcode has the same handler in both.
+static void *vm_alt_code[NUM_OPCODES];
+
+// Pushed onto the return stack on entry to vm_run, so that the outermost
+// EXIT lands on OP_HALT and returns control back to the caller
+static word_t halt_thread[1];
+
+void vm_init(void)
+{
+    // Called with no context, vm_run just publishes its label addresses
+    vm_run(NULL, NULL);
+    halt_thread[0].code = vm_code[OP_HALT];
+}
+
+/**
+ * Returns the opcode whose code address is held in the given cell, or
+ * -1 if it is not a code address (i.e. inline data).
+ */
+int vm_opcode(word_t cell)
+{
+    for (int op = 0; op < NUM_OPCODES; op++)
+    {
+        if (vm_code[op] == cell.code || vm_alt_code[op] == cell.code)
+            return op;
+    }
+    return -1;
+}
+
+/**
+ * True if addr is (roughly) within the inner interpreter's opcode
+ * handlers, i.e. between the first and last of them.
+ */
+int vm_contains(void *addr)
+{
+    void *first = vm_code[0], *last = vm_code[0];
+    for (int op = 0; op < NUM_OPCODES; op++)
+    {
+        first = min(first, min(vm_code[op], vm_alt_code[op]));
+        last = max(last, max(vm_code[op], vm_alt_code[op]));
+    }
+    return addr >= first && addr <= last;
+}
+
+/**
+ * Swaps the opcode cells of the thread from start to end, instruction by
+ * instruction, to the other handler. Operands are stepped over, so a
+ * literal or xt equal to a handler address is left alone. A cell that is
+ * no opcode is inline data (a string after (S") say) and is skipped.
+ */
+static void swap_thread(word_t *start, word_t *end)
+{
+    for (word_t *cell = start; cell < end; cell++)
+    {
+        int op = vm_opcode(*cell);
+        if (op < 0)
+            continue;
+
+        if (cell->code == vm_code[op])
+            cell->code = vm_alt_code[op];
+        cell += vm_opcodes[op].operands;
+    }
+}
+
+/**
+ * Swaps the handlers for the call and return opcodes with their profiled
+ * twins, or back again, both in vm_code (for anything compiled from now
+ * on) and in the thread of every colon definition, including the one
+ * being compiled. The plain handlers thus never have to check whether
+ * profiling is on. Headerless threads (:NONAME) keep what they had,
+ * which only leaves them out of the profile.
+ */
+void vm_swap_handlers(context_t *ctx)
+{
+    hashtable_t *htbl = ctx->exe_tok;
+    for (int slot = 0; slot < htbl->capacity; slot++)
+    {
+        if (!hashtable_occupied(htbl, slot))
+            continue;
+
+        entry_t *entry = hashtable_data(htbl, slot);
+        if (!is_colon_definition(entry))
+            continue;
+
+        word_t *start = (word_t *)entry->param.ptr;
+        int size = entry_info(entry)->alloc_size;
+        if (size > 0)
+            swap_thread(start, start + size / (int)sizeof(word_t));
+        else if (entry == ctx->last_word && entry->code_ptr == __EXEC)
+            swap_thread(start, (word_t *)ctx->dp);
+    }
+
+    for (int op = 0; op < NUM_OPCODES; op++)
+    {
+        void *code = vm_code[op];
+        vm_code[op] = vm_alt_code[op];
+        vm_alt_code[op] = code;
+    }
+}
+
+/**
+ * Returns the opcode implementing the given primitive in the inner
+ * interpreter, or -1 if it must be called through OP_PRIM.
+ */
+int vm_primitive_opcode(state_t (*code_ptr)(context_t *ctx))
+{
+    for (int op = 0; op < NUM_OPCODES; op++)
+    {
+        if (vm_opcodes[op].primitive == code_ptr)
+            return op;
+    }
+    return -1;
+}
+
+/**
+ * True for opcodes whose last operand is a branch offset, in bytes
+ * relative to the offset cell itself.
+ */
+int vm_is_branch(int op)
+{
+    switch (op)
+    {
+        case OP_BRANCH:
+        case OP_0BRANCH:
+        case OP_LIT_EQ_0BRANCH:
+        case OP_QDO:
+        case OP_LOOP:
+        case OP_PLOOP:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * Steps the loop-control frame at the top of the return stack by n, for
+ * +LOOP. Returns false once the index crosses the boundary between
+ * limit-1 and limit in either direction, i.e. when index-limit changes
+ * sign while n has the opposite sign to it (wrapping round past the
+ * largest number does not count).
+ */
+int loop_continues(int *rp, int n)
+{
+    int x = (unsigned)rp[-1] - (unsigned)rp[-2];
+    int y = (unsigned)x + (unsigned)n;
+    rp[-1] = (unsigned)rp[-1] + (unsigned)n;
+    return ((x ^ y) & (x ^ n)) >= 0;
+}
+
+static state_t vm_error(context_t *ctx, word_t *ip, int errno)
+{
+    // ip has already been advanced past the failing opcode
+    int op = vm_opcode(ip[-1]);
+    return error_msg(ctx, errno, " in: %s", op < 0 ? "?" : vm_opcodes[op].name);
+}
+
+#define NEXT            goto *(ip++)->code
+
+// Running off the stacks otherwise page faults on their guard pages: only
+// opcodes that move a stack pointer without touching the cells, and those
+// that take from the return stack, check (see common.h)
+#define DS_CHECK(n)     if (sp - ds < (n)) goto underflow
+#define RS_CHECK(n)     if (rp - rs < (n)) goto r_underflow
+
+#define SAVE_REGS       ctx->ip = ip; ctx->sp = sp; ctx->rp = rp
+#define LOAD_REGS       ip = ctx->ip; sp = ctx->sp; rp = ctx->rp
+
+#define truth(x)        ((x) ? -1 : 0)
+
+/**
+ * The inner interpreter: runs the thread at ip until the matching EXIT.
+ * Instruction, data- and return-stack pointers are kept in locals and
+ * only written back to the context around calls out to C primitives, so
+ * NEXT is a load and an indirect jump.
+ */
+state_t vm_run(context_t *ctx, word_t *ip)
+{
+    static void *const labels[NUM_OPCODES] = {
+        [OP_HALT]       = &&op_halt,
+        [OP_CALL]       = &&op_call,
+        [OP_PRIM]       = &&op_prim,
+        [OP_JUMP]       = &&op_jump,
+        [OP_EXIT]       = &&op_exit,
+        [OP_EXECUTE]    = &&op_execute,
+        [OP_LIT]        = &&op_lit,
+        [OP_BRANCH]     = &&op_branch,
+        [OP_0BRANCH]    = &&op_0branch,
+        [OP_DUP]        = &&op_dup,
+        [OP_QDUP]       = &&op_qdup,
+        [OP_DROP]       = &&op_drop,
+        [OP_SWAP]       = &&op_swap,
+        [OP_OVER]       = &&op_over,
+        [OP_ROT]        = &&op_rot,
+        [OP_MINROT]     = &&op_minrot,
+        [OP_NIP]        = &&op_nip,
+        [OP_TUCK]       = &&op_tuck,
+        [OP_2DUP]       = &&op_2dup,
+        [OP_2DROP]      = &&op_2drop,
+        [OP_ADD]        = &&op_add,
+        [OP_SUB]        = &&op_sub,
+        [OP_MUL]        = &&op_mul,
+        [OP_DIV]        = &&op_div,
+        [OP_MOD]        = &&op_mod,
+        [OP_INC]        = &&op_inc,
+        [OP_DEC]        = &&op_dec,
+        [OP_DBL]        = &&op_dbl,
+        [OP_NEG]        = &&op_neg,
+        [OP_AND]        = &&op_and,
+        [OP_OR]         = &&op_or,
+        [OP_XOR]        = &&op_xor,
+        [OP_INVERT]     = &&op_invert,
+        [OP_LSHIFT]     = &&op_lshift,
+        [OP_RSHIFT]     = &&op_rshift,
+        [OP_EQ]         = &&op_eq,
+        [OP_NEQ]        = &&op_neq,
+        [OP_LT]         = &&op_lt,
+        [OP_GT]         = &&op_gt,
+        [OP_ISZERO]     = &&op_iszero,
+        [OP_ISNEG]      = &&op_isneg,
+        [OP_FETCH]      = &&op_fetch,
+        [OP_STORE]      = &&op_store,
+        [OP_PLUS_STORE] = &&op_plus_store,
+        [OP_C_FETCH]    = &&op_c_fetch,
+        [OP_C_STORE]    = &&op_c_store,
+        [OP_TOR]        = &&op_tor,
+        [OP_RFROM]      = &&op_rfrom,
+        [OP_RFETCH]     = &&op_rfetch,
+        [OP_RDROP]      = &&op_rdrop,
+        [OP_DO]         = &&op_do,
+        [OP_QDO]        = &&op_qdo,
+        [OP_LOOP]       = &&op_loop,
+        [OP_PLOOP]      = &&op_ploop,
+        [OP_I]          = &&op_i,
+        [OP_J]          = &&op_j,
+        [OP_UNLOOP]     = &&op_unloop,
+        [OP_LIT_ADD]          = &&op_lit_add,
+        [OP_LIT_EQ]           = &&op_lit_eq,
+        [OP_LIT_EQ_0BRANCH]   = &&op_lit_eq_0branch,
+        [OP_SQUARE]           = &&op_square,
+        [OP_FETCH_ADD]        = &&op_fetch_add,
+        [OP_DIV_SHIFT]        = &&op_div_shift,
+        [OP_DIV_MAGIC]        = &&op_div_magic,
+    };
+
+    static void *const profiled_labels[NUM_OPCODES] = {
+        [OP_CALL]       = &&op_call_profiled,
+        [OP_PRIM]       = &&op_prim_profiled,
+        [OP_JUMP]       = &&op_jump_profiled,
+        [OP_EXIT]       = &&op_exit_profiled,
+        [OP_EXECUTE]    = &&op_execute_profiled,
+    };
+
+    if (ctx == NULL)
+    {
+        memcpy(vm_code, labels, sizeof(labels));
+        for (int op = 0; op < NUM_OPCODES; op++)
+            vm_alt_code[op] = profiled_labels[op] != NULL ? profiled_labels[op] : labels[op];
+        return OK;
+    }
+
+    word_t *saved_ip = ctx->ip;
+    int *sp = ctx->sp, *ds = ctx->ds;
+    int *rp = ctx->rp, *rs = ctx->rs;
+    entry_t *xt;
+    state_t retval;
+    int x;
+
+    if (rp - rs >= RS_SIZE)
+        return rstack_overflow(ctx);
+
+    *rp++ = (int)halt_thread;
+    NEXT;
+
+op_halt:
+    SAVE_REGS;
+    ctx->ip = saved_ip;
+    return OK;
+
+op_call:
+    xt = (entry_t *)(ip++)->ptr;
+    if (ctx->echo)
+    {
+        indent(ctx);
+        printf("Calling: 0x%x: %s\n", ip - 2, xt->name);
+    }
+    *rp++ = (int)ip;
+    ip = (word_t *)xt->param.ptr;
+    NEXT;
+
+op_jump:
+    xt = (entry_t *)ip->ptr;
+    if (ctx->echo)
+    {
+        indent(ctx);
+        printf("Jumping: 0x%x: %s\n", ip - 1, xt->name);
+    }
+    ip = (word_t *)xt->param.ptr;
+    NEXT;
+
+op_prim:
+    xt = (entry_t *)(ip++)->ptr;
+call_primitive:
+    ctx->current_xt = xt;
+    ctx->w = xt->param;
+    SAVE_REGS;
+    retval = xt->code_ptr(ctx);
+primitive_returned:
+    if (retval != OK)
+    {
+        if (retval == ERROR)
+        {
+            ctx->ip = saved_ip;
+            return ERROR;
+        }
+        ctx->state = retval;
+    }
+    LOAD_REGS;
+    NEXT;
+
+op_exit:
+    RS_CHECK(1);
+    ip = (word_t *)*--rp;
+    NEXT;
+
+op_execute:
+    xt = (entry_t *)*--sp;
+    if (xt->code_ptr != __EXEC)
+        goto call_primitive;
+
+    *rp++ = (int)ip;
+    ip = (word_t *)xt->param.ptr;
+    NEXT;
+
+op_lit:
+    *sp++ = (ip++)->val;
+    NEXT;
+
+op_branch:
+    ip = (word_t *)((char *)ip + ip->val);
+    NEXT;
+
+op_0branch:
+    if (*--sp == 0)
+        ip = (word_t *)((char *)ip + ip->val);
+    else
+        ip++;
+    NEXT;
+
+op_dup:
+    sp[0] = sp[-1];
+    sp++;
+    NEXT;
+
+op_qdup:
+    if (sp[-1] != 0)
+    {
+        sp[0] = sp[-1];
+        sp++;
+    }
+    NEXT;
+
+op_drop:
+    DS_CHECK(1);
+    sp--;
+    NEXT;
+
+op_swap:
+    x = sp[-1];
+    sp[-1] = sp[-2];
+    sp[-2] = x;
+    NEXT;
+
+op_over:
+    sp[0] = sp[-2];
+    sp++;
+    NEXT;
+
+op_rot:
+    x = sp[-3];
+    sp[-3] = sp[-2];
+    sp[-2] = sp[-1];
+    sp[-1] = x;
+    NEXT;
+
+op_minrot:
+    x = sp[-1];
+    sp[-1] = sp[-2];
+    sp[-2] = sp[-3];
+    sp[-3] = x;
+    NEXT;
+
+op_nip:
+    sp[-2] = sp[-1];
+    sp--;
+    NEXT;
+
+op_tuck:
+    x = sp[-1];
+    sp[0] = x;
+    sp[-1] = sp[-2];
+    sp[-2] = x;
+    sp++;
+    NEXT;
+
+op_2dup:
+    sp[0] = sp[-2];
+    sp[1] = sp[-1];
+    sp += 2;
+    NEXT;
+
+op_2drop:
+    DS_CHECK(2);
+    sp -= 2;
+    NEXT;
+
+op_add:
+    sp[-2] += sp[-1];
+    sp--;
+    NEXT;
+
+op_sub:
+    sp[-2] -= sp[-1];
+    sp--;
+    NEXT;
+
+op_mul:
+    sp[-2] *= sp[-1];
+    sp--;
+    NEXT;
+
+op_div:
+    if (div_overflows(sp[-2], sp[-1]))
+        goto out_of_range;
+    sp[-2] /= sp[-1];
+    sp--;
+    NEXT;
+
+op_mod:
+    if (div_overflows(sp[-2], sp[-1]))
+        goto out_of_range;
+    sp[-2] %= sp[-1];
+    sp--;
+    NEXT;
+
+op_inc:
+    sp[-1]++;
+    NEXT;
+
+op_dec:
+    sp[-1]--;
+    NEXT;
+
+op_dbl:
+    sp[-1] *= 2;
+    NEXT;
+
+op_neg:
+    sp[-1] = -sp[-1];
+    NEXT;
+
+op_and:
+    sp[-2] &= sp[-1];
+    sp--;
+    NEXT;
+
+op_or:
+    sp[-2] |= sp[-1];
+    sp--;
+    NEXT;
+
+op_xor:
+    sp[-2] ^= sp[-1];
+    sp--;
+    NEXT;
+
+op_invert:
+    sp[-1] = ~sp[-1];
+    NEXT;
+
+op_lshift:
+    sp[-2] <<= sp[-1];
+    sp--;
+    NEXT;
+
+op_rshift:
+    sp[-2] >>= sp[-1];
+    sp--;
+    NEXT;
+
+op_eq:
+    sp[-2] = truth(sp[-2] == sp[-1]);
+    sp--;
+    NEXT;
+
+op_neq:
+    sp[-2] = truth(sp[-2] != sp[-1]);
+    sp--;
+    NEXT;
+
+op_lt:
+    sp[-2] = truth(sp[-2] < sp[-1]);
+    sp--;
+    NEXT;
+
+op_gt:
+    sp[-2] = truth(sp[-2] > sp[-1]);
+    sp--;
+    NEXT;
+
+op_iszero:
+    sp[-1] = truth(sp[-1] == 0);
+    NEXT;
+
+op_isneg:
+    sp[-1] = truth(sp[-1] < 0);
+    NEXT;
+
+op_fetch:
+    if (sp[-1] % sizeof(word_t) != 0)
+        goto misaligned;
+    sp[-1] = *(int *)sp[-1];
+    NEXT;
+
+op_store:
+    if (sp[-1] % sizeof(word_t) != 0)
+        goto misaligned;
+    *(int *)sp[-1] = sp[-2];
+    sp -= 2;
+    NEXT;
+
+op_plus_store:
+    if (sp[-1] % sizeof(word_t) != 0)
+        goto misaligned;
+    *(int *)sp[-1] += sp[-2];
+    sp -= 2;
+    NEXT;
+
+op_c_fetch:
+    sp[-1] = *(unsigned char *)sp[-1];
+    NEXT;
+
+op_c_store:
+    *(char *)sp[-1] = (unsigned char)sp[-2] & 0xFF;
+    sp -= 2;
+    NEXT;
+
+op_tor:
+    *rp++ = *--sp;
+    NEXT;
+
+op_rfrom:
+    RS_CHECK(1);
+    *sp++ = *--rp;
+    NEXT;
+
+op_rfetch:
+    RS_CHECK(1);
+    *sp++ = rp[-1];
+    NEXT;
+
+op_rdrop:
+    RS_CHECK(1);
+    rp--;
+    NEXT;
+
+// Loop-control frames are the limit and then the index on the return
+// stack, so I is the top cell, as R@ would see it
+op_do:
+    rp[0] = sp[-2];
+    rp[1] = sp[-1];
+    rp += 2;
+    sp -= 2;
+    NEXT;
+
+op_qdo:
+    sp -= 2;
+    if (sp[0] == sp[1])
+    {
+        ip = (word_t *)((char *)ip + ip->val);
+        NEXT;
+    }
+    rp[0] = sp[0];
+    rp[1] = sp[1];
+    rp += 2;
+    ip++;
+    NEXT;
+
+op_loop:
+    RS_CHECK(2);
+    if (++rp[-1] != rp[-2])
+    {
+        ip = (word_t *)((char *)ip + ip->val);
+        NEXT;
+    }
+    rp -= 2;
+    ip++;
+    NEXT;
+
+op_ploop:
+    RS_CHECK(2);
+    if (loop_continues(rp, *--sp))
+    {
+        ip = (word_t *)((char *)ip + ip->val);
+        NEXT;
+    }
+    rp -= 2;
+    ip++;
+    NEXT;
+
+op_i:
+    RS_CHECK(1);
+    *sp++ = rp[-1];
+    NEXT;
+
+op_j:
+    RS_CHECK(3);
+    *sp++ = rp[-3];
+    NEXT;
+
+op_unloop:
+    RS_CHECK(2);
+    rp -= 2;
+    NEXT;
+
+op_lit_add:
+    sp[-1] += (ip++)->val;
+    NEXT;
+
+op_lit_eq:
+    sp[-1] = truth(sp[-1] == (ip++)->val);
+    NEXT;
+
+op_lit_eq_0branch:
+    if (*--sp != ip[0].val)
+        ip = (word_t *)((char *)&ip[1] + ip[1].val);
+    else
+        ip += 2;
+    NEXT;
+
+op_square:
+    sp[-1] *= sp[-1];
+    NEXT;
+
+op_fetch_add:
+    if (sp[-1] % sizeof(word_t) != 0)
+        goto misaligned;
+    sp[-2] += *(int *)sp[-1];
+    sp--;
+    NEXT;
+
+// Division rounds towards zero, so negative dividends are biased by the
+// divisor less one before the (flooring) arithmetic shift
+op_div_shift:
+    x = (ip++)->val;
+    sp[-1] = (sp[-1] + ((sp[-1] >> 31) & ((1 << x) - 1))) >> x;
+    NEXT;
+
+// Multiply by the divisor's reciprocal and keep the high half: the magic
+// number and shift are from div_magic() in the compiler
+op_div_magic:
+    x = (int)(((long long)ip[0].val * sp[-1]) >> 32);
+    if (ip[0].val < 0)
+        x += sp[-1];
+    x >>= ip[1].val;
+    sp[-1] = x + ((unsigned int)x >> 31);
+    ip += 2;
+    NEXT;
+
+// Profiled twins of the call and return opcodes, swapped into threads by
+// PROFILE-ON: they time the word, then carry on as the plain handlers
+op_call_profiled:
+    profile_enter((entry_t *)ip->ptr, rp + 1);
+    goto op_call;
+
+op_jump_profiled:
+    profile_tail((entry_t *)ip->ptr, rp);
+    goto op_jump;
+
+op_exit_profiled:
+    profile_exit(rp);
+    goto op_exit;
+
+op_execute_profiled:
+    xt = (entry_t *)sp[-1];
+    if (xt->code_ptr == __EXEC)
+    {
+        profile_enter(xt, rp + 1);
+        goto op_execute;
+    }
+    sp--;
+    goto profile_primitive;
+
+op_prim_profiled:
+    xt = (entry_t *)(ip++)->ptr;
+profile_primitive:
+    ctx->current_xt = xt;
+    ctx->w = xt->param;
+    SAVE_REGS;
+    retval = profile_execute(ctx);
+    goto primitive_returned;
+
+underflow:
+    retval = vm_error(ctx, ip, -4);
+    goto abort;
+
+r_underflow:
+    retval = vm_error(ctx, ip, -6);
+    goto abort;
+
+misaligned:
+    retval = vm_error(ctx, ip, -23);
+    goto abort;
+
+out_of_range:
+    retval = vm_error(ctx, ip, -11);
+    goto abort;
+
+abort:
+    ctx->ip = saved_ip;
+    return retval;
+}
@@ -10,7 +10,7 @@ history_t *init_history(int size)
     history_t *hist = malloc(sizeof(history_t));
     if (hist != NULL)
     {
-        hist->items = (char **)calloc(0, (size + 1) * sizeof(char *));
+        hist->items = (char **)calloc(1, (size + 1) * sizeof(char *));
         hist->items[0] = "";    // always allow 1 item of blank history
         hist->count = 1;
         hist->size = size;
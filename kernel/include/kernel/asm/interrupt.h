@@ -1,6 +1,8 @@
 #ifndef __ASM_INTERRUPT_H
 #define __ASM_INTERRUPT_H
 
+#define EFLAGS_IF 0x200
+
 #define cli()    __asm__ ("cli")
 #define sti()    __asm__ ("sti")
 
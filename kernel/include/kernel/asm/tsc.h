@@ -0,0 +1,13 @@
+#ifndef __ASM_TSC_H
+#define __ASM_TSC_H
+
+/* Read the CPU's time stamp counter, which counts clock cycles since reset */
+
+static inline unsigned long long rdtsc(void)
+{
+    unsigned long long tsc;
+    __asm__ __volatile__ ("rdtsc" : "=A" (tsc));
+    return tsc;
+}
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef __MULTIBOOT_H
+#define __MULTIBOOT_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The bootloader leaves this in EAX, and a pointer to a multiboot_info_t in EBX */
+#define MULTIBOOT_BOOTLOADER_MAGIC 0x2BADB002
+
+/* Flags saying which multiboot_info_t fields are valid */
+#define MULTIBOOT_INFO_MEMORY   (1<<0)
+#define MULTIBOOT_INFO_CMDLINE  (1<<2)
+#define MULTIBOOT_INFO_MODS     (1<<3)
+#define MULTIBOOT_INFO_MEM_MAP  (1<<6)
+
+typedef struct {
+    uint32_t flags;
+    uint32_t mem_lower;         // KiB below 1MiB
+    uint32_t mem_upper;         // KiB above 1MiB, up to the first hole
+    uint32_t boot_device;
+    uint32_t cmdline;
+    uint32_t mods_count;
+    uint32_t mods_addr;
+    uint32_t syms[4];
+    uint32_t mmap_length;
+    uint32_t mmap_addr;
+} __attribute__((packed)) multiboot_info_t;
+
+typedef struct {
+    uint32_t mod_start;
+    uint32_t mod_end;           // one past the last byte
+    uint32_t string;            // the module's command line
+    uint32_t reserved;
+} __attribute__((packed)) multiboot_module_t;
+
+/* mmap_length bytes of these start at mmap_addr */
+typedef struct {
+    uint32_t size;              // of the rest of the entry
+    uint64_t addr;
+    uint64_t len;
+    uint32_t type;
+} __attribute__((packed)) multiboot_memory_map_t;
+
+#define MULTIBOOT_MEMORY_AVAILABLE 1
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -8,6 +8,7 @@
 #include <kernel/asm/io.h>
 #include <kernel/asm/interrupt.h>
 #include <kernel/asm/spinlock.h>
+#include <kernel/asm/tsc.h>
 
 #include <kernel/kb.h>
 #include <kernel/tty.h>
@@ -19,15 +20,18 @@ extern "C" {
 
 extern void draw_logo();
 
-extern void mmu_install();
+extern void mmu_install(char *top);
+extern int mmu_guard(void *addr);
 
 extern void gdt_set_gate(int num, unsigned long base, unsigned long limit, unsigned char access, unsigned char gran);
 extern void gdt_install(void);
+extern void double_fault_install(unsigned int cr3);
 
 extern void idt_set_gate(unsigned char num, unsigned long base, unsigned short sel, unsigned char flags);
 extern void idt_install(void);
 
 extern void isrs_install(void);
+extern void fault_set_handler(void (*handler)(registers_t *r, void *address));
 
 extern void irq_install(void);
 extern void *irq_install_handler(int irq, void (*handler)(registers_t *r));
@@ -35,11 +39,25 @@ extern void irq_uninstall_handler(int irq);
 
 extern void timer_install();
 extern void timer_wait(int ticks);
+extern void timer_phase(int hz);
+extern void timer_set_sampler(void (*sampler)(registers_t *r));
 
 extern char **dump(char *addr, int size, int columns);
+extern char *write(char *out, char c);
+extern char *rpad(char *out, char *in, int size, char pad_char);
+extern char *safe_puts(char *out, char *in, int size);
+extern char *hex_bytes(char *out, char *in, int size);
 extern int pager(char **text);
 
 extern char *sbrk(unsigned bytes);
+extern void sbrk_reserve(char *end);
+extern void sbrk_limit(char *end);
+extern unsigned int sbrk_available(void);
+
+extern void serial_install();
+extern void serial_putchar(char c);
+
+extern void shutdown(int status);
 
 #ifdef __cplusplus
 }
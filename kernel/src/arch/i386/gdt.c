@@ -1,3 +1,5 @@
+#include <stdio.h>
+
 #include <kernel/system.h>
 
 /* Defines a GDT entry. We say packed, because it prevents the
@@ -21,10 +23,26 @@ struct gdt_ptr
     unsigned int base;
 } __attribute__((packed));
 
-/* Our GDT, with 3 entries, and finally our special GDT pointer */
-struct gdt_entry gdt[3];
+/* A task state segment: only what a task switch saves and loads */
+struct tss_entry
+{
+    unsigned int prev_tss;
+    unsigned int esp0, ss0, esp1, ss1, esp2, ss2;
+    unsigned int cr3, eip, eflags;
+    unsigned int eax, ecx, edx, ebx, esp, ebp, esi, edi;
+    unsigned int es, cs, ss, ds, fs, gs;
+    unsigned int ldt;
+    unsigned short trap, iomap_base;
+} __attribute__((packed));
+
+/* Our GDT, with 5 entries: the last two are the task state segments that
+*  double_fault_install sets up. And finally our special GDT pointer */
+struct gdt_entry gdt[5];
 struct gdt_ptr gdtp;
 
+static struct tss_entry kernel_tss, double_fault_tss;
+static unsigned char double_fault_stack[4096] __attribute__((aligned(16)));
+
 extern void gdt_flush();
 
 /* Setup a descriptor in the Global Descriptor Table */
@@ -47,7 +65,7 @@ void gdt_set_gate(int num, unsigned long base, unsigned long limit, unsigned cha
 void gdt_install()
 {
     /* Setup the GDT pointer and limit */
-    gdtp.limit = (sizeof(struct gdt_entry) * 3) - 1;
+    gdtp.limit = (sizeof(struct gdt_entry) * 5) - 1;
     gdtp.base = (unsigned int) &gdt;
 
     /* Our NULL descriptor */
@@ -66,3 +84,36 @@ void gdt_install()
     /* Flush out the old GDT and install the new changes */
     gdt_flush();
 }
+
+/* Runs as a task of its own, on a stack of its own: when the stack runs
+*  into its guard page, the processor can't push the page fault's frame,
+*  and faults again, so there is no stack to handle it on */
+static void double_fault_task()
+{
+    printf("Double Fault Exception: the stack may have overflowed. System Halted!\n");
+    for (;;);
+}
+
+/* Makes a double fault switch to double_fault_task, with paging from the
+*  page directory at cr3. The processor saves the state of the kernel into
+*  kernel_tss as it switches */
+void double_fault_install(unsigned int cr3)
+{
+    double_fault_tss.cr3 = cr3;
+    double_fault_tss.eip = (unsigned int)double_fault_task;
+    double_fault_tss.eflags = 0x2;
+    double_fault_tss.esp = (unsigned int)(double_fault_stack + sizeof(double_fault_stack));
+    double_fault_tss.cs = 0x08;
+    double_fault_tss.ss = double_fault_tss.ds = double_fault_tss.es = 0x10;
+    double_fault_tss.fs = double_fault_tss.gs = 0x10;
+    double_fault_tss.iomap_base = sizeof(struct tss_entry);
+    kernel_tss.iomap_base = sizeof(struct tss_entry);
+
+    /* Available 32-bit TSS descriptors, byte granular */
+    gdt_set_gate(3, (unsigned long)&kernel_tss, sizeof(struct tss_entry) - 1, 0x89, 0x00);
+    gdt_set_gate(4, (unsigned long)&double_fault_tss, sizeof(struct tss_entry) - 1, 0x89, 0x00);
+    __asm__ __volatile__ ("ltr %%ax" :: "a"(0x18));
+
+    /* A task gate: the offset is unused */
+    idt_set_gate(8, 0, 0x20, 0x85);
+}
@@ -71,10 +71,27 @@ char *exception_messages[] =
     "Reserved (31)"
 };
 
+/* Called for a fault, if set, with the faulting registers and, for a page
+*  fault, the address that faulted. It recovers by unwinding past the
+*  fault, and returns only if it can't */
+static void (*fault_catcher)(registers_t *r, void *address) = 0;
+
 void fault_handler(registers_t *r)
 {
     if (r->int_no < 32)
     {
+        // Not when interrupts were off, as they are in an interrupt handler,
+        // which can't be unwound. The handler doesn't come back through the
+        // iret that would turn them on again, so turn them on here
+        if (fault_catcher && (r->eflags & EFLAGS_IF))
+        {
+            void *address;
+            __asm__ __volatile__ ("mov %%cr2, %0" : "=r"(address));
+            sti();
+            fault_catcher(r, address);
+            cli();
+        }
+
         // TODO: dont use anything that relies on malloc here, i.e not printf
         printf("%s Exception. System Halted!\n", exception_messages[r->int_no]);
         printf("Error-code: %d\n", r->err_code);
@@ -87,6 +104,13 @@ void fault_handler(registers_t *r)
     }
 }
 
+/* Installs a function to recover from faults; 0 removes it, and faults
+*  halt the system again */
+void fault_set_handler(void (*handler)(registers_t *r, void *address))
+{
+    fault_catcher = handler;
+}
+
 void isrs_install() {
     idt_set_gate(0, (unsigned)divide_by_zero_exception, 0x08, 0x8E);
     idt_set_gate(1, (unsigned)debug_exception, 0x08, 0x8E);
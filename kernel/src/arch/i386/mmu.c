@@ -1,43 +1,103 @@
 #include <kernel/system.h>
 
+/* Memory is identity mapped with 4MiB pages, each from a page directory
+*  entry of its own, so that turning paging on costs no page tables. The
+*  4MiB page around a guard page is split into 4KiB pages, from a small
+*  pool of page tables, so that the one page can be left unmapped */
+
 #define DIRECTORY_SIZE 1024
 #define PAGE_SIZE      4096
+#define LARGE_PAGE     0x400000
+#define PAGE_TABLES    8
+
+#define PAGE_PRESENT   0x001
+#define PAGE_WRITE     0x002
+#define PAGE_LARGE     0x080
+
+#define CR0_PG         0x80000000
+#define CR4_PSE        0x00000010
+#define CPUID_PSE      0x00000008
+
+static unsigned int page_directory[DIRECTORY_SIZE] __attribute__((aligned(PAGE_SIZE)));
+static unsigned int page_tables[PAGE_TABLES][DIRECTORY_SIZE] __attribute__((aligned(PAGE_SIZE)));
+static int tables_used = 0;
+static int paging = 0;
+
+static int has_large_pages()
+{
+    unsigned int eax = 1, ebx, ecx, edx;
+    __asm__ __volatile__ ("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    return (edx & CPUID_PSE) != 0;
+}
 
-extern unsigned int *_end;
+static void flush_tlb()
+{
+    unsigned int cr3;
+    __asm__ __volatile__ ("mov %%cr3, %0" : "=r"(cr3));
+    __asm__ __volatile__ ("mov %0, %%cr3" :: "r"(cr3) : "memory");
+}
 
-void mmu_install()
+/* Identity maps the memory below top (all 4GiB if top is NULL) and turns
+*  paging on. Paging stays off on a processor without 4MiB pages */
+void mmu_install(char *top)
 {
-    // page directory comes right after the kernel -- the address must be page aligned
-    unsigned int page_aligned_end = (((unsigned int)_end) & 0xFFFFF000) + 0x1000;
-    unsigned int *page_directory = (unsigned int*)page_aligned_end;
+    if (!has_large_pages())
+        return;
+
+    unsigned int entries = DIRECTORY_SIZE;
+    if (top != NULL)
+        entries = ((unsigned int)top >> 22) + (((unsigned int)top & (LARGE_PAGE - 1)) != 0);
 
-    // set each entry to not present
-    for (int i = 0; i < DIRECTORY_SIZE; i++)
+    for (unsigned int i = 0; i < DIRECTORY_SIZE; i++)
     {
-        // attribute: supervisor level, read/write, not present.
-        page_directory[i] = 0 | 2;
+        // attr: supervisor level, read/write, present if there is memory there
+        page_directory[i] = i < entries ? (i * LARGE_PAGE) | PAGE_LARGE | PAGE_WRITE | PAGE_PRESENT : 0;
     }
 
-    // first page table comes right after the page directory
-    unsigned int *first_page_table = page_directory + DIRECTORY_SIZE;
+    unsigned int cr4;
+    __asm__ __volatile__ ("mov %%cr4, %0" : "=r"(cr4));
+    cr4 |= CR4_PSE;
+    __asm__ __volatile__ ("mov %0, %%cr4" :: "r"(cr4));
 
-    // holds the physical address where we want to start mapping these pages to.
-    // in this case, we want to map these pages to the very beginning of memory.
-    unsigned int address = 0;
+    __asm__ __volatile__ ("mov %0, %%cr3" :: "r"(page_directory));
 
-    for (int i = 0; i < DIRECTORY_SIZE; i++)
+    unsigned int cr0;
+    __asm__ __volatile__ ("mov %%cr0, %0" : "=r"(cr0));
+    cr0 |= CR0_PG;
+    __asm__ __volatile__ ("mov %0, %%cr0" :: "r"(cr0) : "memory");
+
+    paging = 1;
+    double_fault_install((unsigned int)page_directory);
+}
+
+/* Unmaps the 4KiB page that addr is in, so that touching it faults.
+*  Returns 0, or -1 if paging is off or there are no page tables left */
+int mmu_guard(void *addr)
+{
+    if (!paging)
+        return -1;
+
+    unsigned int page = (unsigned int)addr & ~(PAGE_SIZE - 1);
+    unsigned int *entry = &page_directory[page / LARGE_PAGE];
+    if ((*entry & PAGE_PRESENT) == 0)
+        return 0;
+
+    if (*entry & PAGE_LARGE)
     {
+        if (tables_used == PAGE_TABLES)
+            return -1;
 
-        first_page_table[i] = address | 3;  // attr: supervisor level, read/write, not present
-        address += PAGE_SIZE;               // advance to next page boundary
+        unsigned int *table = page_tables[tables_used++];
+        unsigned int base = *entry & ~(LARGE_PAGE - 1);
+        for (int i = 0; i < DIRECTORY_SIZE; i++)
+        {
+            table[i] = (base + i * PAGE_SIZE) | PAGE_WRITE | PAGE_PRESENT;
+        }
+        *entry = (unsigned int)table | PAGE_WRITE | PAGE_PRESENT;
     }
 
-    // moves page directory (ptr) into the cr3 register.
-    __asm __volatile("mov %0, %%cr3":: "b"(page_directory));
-
-    // switch paging bit on cr0
-    unsigned int cr0;
-    __asm __volatile("mov %%cr0, %0": "=b"(cr0));
-    cr0 |= 0x80000000;
-    __asm __volatile("mov %0, %%cr0":: "b"(cr0));
+    unsigned int *table = (unsigned int *)(*entry & ~(PAGE_SIZE - 1));
+    table[(page / PAGE_SIZE) % DIRECTORY_SIZE] &= ~PAGE_PRESENT;
+    flush_tlb();
+    return 0;
 }
@@ -0,0 +1,17 @@
+#include <kernel/system.h>
+
+/* QEMU's isa-debug-exit device, when present (-device isa-debug-exit,
+*  iobase=0xf4,iosize=0x04), ends the emulator when written to, with exit
+*  code (value << 1) | 1 */
+#define DEBUG_EXIT_PORT 0xF4
+
+/* Stops the machine: under QEMU with the debug exit device, the emulator
+*  exits with the given status; anywhere else, the CPU halts */
+void shutdown(int status)
+{
+    outportb(DEBUG_EXIT_PORT, status);
+
+    __asm__ __volatile__ ("cli");
+    for (;;)
+        __asm__ __volatile__ ("hlt");
+}
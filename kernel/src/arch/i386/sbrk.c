@@ -1,10 +1,12 @@
 #include <stdlib.h>
 #include <kernel/system.h>
 
+extern char _heap;
+static char *ptr = 0;
+static char *limit = 0;         // none until the memory map is known
+
 char *sbrk (unsigned amt)
 {
-    extern char _heap;
-    static char *ptr = 0;
     char *res;
 
     if (ptr == 0)
@@ -16,7 +18,36 @@ char *sbrk (unsigned amt)
     if (((long)ptr) % 8)
         ptr = ptr + (8 - (((long)(ptr)) % 8));
 
+    if (limit != 0 && (ptr >= limit || amt > (unsigned)(limit - ptr)))
+        return (char *)-1;
+
     res = ptr;
     ptr += amt;
     return (char *)res;
 }
+
+/* Moves the start of the heap up past end, so that memory the bootloader
+*  has put after the kernel (e.g. modules) is not handed out */
+void sbrk_reserve(char *end)
+{
+    if (ptr == 0)
+        ptr = &_heap;
+
+    if (end > ptr)
+        ptr = end;
+}
+
+/* Stops the heap growing past end, the last byte of usable memory + 1 */
+void sbrk_limit(char *end)
+{
+    limit = end;
+}
+
+/* The bytes sbrk can still hand out, or 0 if there is no limit known */
+unsigned int sbrk_available(void)
+{
+    if (ptr == 0)
+        ptr = &_heap;
+
+    return limit > ptr ? (unsigned int)(limit - ptr) : 0;
+}
@@ -0,0 +1,52 @@
+#include <stdbool.h>
+
+#include <kernel/system.h>
+
+/* The first serial port, which the console is mirrored to, so that a
+*  headless machine (or qemu -nographic) still has its output */
+#define COM1 0x3F8
+
+#define UART_DATA       0   // DLAB=0: transmit/receive buffer; DLAB=1: divisor low
+#define UART_IER        1   // DLAB=0: interrupt enable; DLAB=1: divisor high
+#define UART_FCR        2
+#define UART_LCR        3
+#define UART_MCR        4
+#define UART_LSR        5
+
+#define LCR_DLAB        0x80
+#define LCR_8N1         0x03
+#define MCR_LOOPBACK    0x10
+#define LSR_THR_EMPTY   0x20
+
+static bool serial_present = false;
+
+/* Sets COM1 up for 115200 baud 8N1, polled, and checks there is a UART
+*  there by sending a byte to itself in loopback mode */
+void serial_install()
+{
+    outportb(COM1 + UART_IER, 0x00);
+    outportb(COM1 + UART_LCR, LCR_DLAB);
+    outportb(COM1 + UART_DATA, 0x01);       // divisor 1: 115200 baud
+    outportb(COM1 + UART_IER, 0x00);
+    outportb(COM1 + UART_LCR, LCR_8N1);
+    outportb(COM1 + UART_FCR, 0xC7);        // enable and clear the FIFOs
+    outportb(COM1 + UART_MCR, MCR_LOOPBACK | 0x0B);
+
+    outportb(COM1 + UART_DATA, 0xAE);
+    serial_present = inportb(COM1 + UART_DATA) == 0xAE;
+
+    outportb(COM1 + UART_MCR, 0x0B);        // DTR, RTS and OUT2, not looped back
+}
+
+void serial_putchar(char c)
+{
+    if (!serial_present)
+        return;
+
+    if (c == '\n')
+        serial_putchar('\r');
+
+    while ((inportb(COM1 + UART_LSR) & LSR_THR_EMPTY) == 0)
+        ;
+    outportb(COM1 + UART_DATA, c);
+}
@@ -1,13 +1,54 @@
 #include <kernel/system.h>
 
+/* The PIT's input clock, divided down to give the IRQ0 rate */
+#define PIT_HZ 1193182
+
 /* Keep track of how many ticks that the system has been running for */
 static volatile unsigned long timer_ticks = 0;
 
+/* Current PIT divisor (65536 is what the BIOS leaves it at), and the part
+*  of a 65536 divisor tick accumulated since timer_ticks last advanced */
+static unsigned int timer_divisor = 65536;
+static unsigned int timer_fraction = 0;
+
+/* Called on every tick with the interrupted registers, if set */
+static void (*timer_sampler)(registers_t *r) = 0;
+
 /* Handles the timer by incrementing the 'timer_ticks' variable every time the
-*  timer fires. By default, the timer fires 18.222 times per second. */
+*  timer fires. By default, the timer fires 18.222 times per second. If the
+*  PIT has been sped up, 'timer_ticks' still counts at the original rate. */
 void timer_handler(registers_t *r)
 {
-    timer_ticks++;
+    if (timer_sampler)
+        timer_sampler(r);
+
+    timer_fraction += timer_divisor;
+    if (timer_fraction >= 65536)
+    {
+        timer_fraction -= 65536;
+        timer_ticks++;
+    }
+}
+
+/* Reprograms channel 0 of the PIT to fire 'hz' times per second, from the
+*  default 18.222 up to around 1.19 MHz */
+void timer_phase(int hz)
+{
+    unsigned int divisor = hz <= 18 ? 65536 : PIT_HZ / hz;
+    if (divisor < 1)
+        divisor = 1;
+
+    outportb(0x43, 0x36);             /* channel 0, lobyte/hibyte, mode 3 */
+    outportb(0x40, divisor & 0xFF);   /* 65536 is sent as 0 */
+    outportb(0x40, (divisor >> 8) & 0xFF);
+    timer_divisor = divisor;
+}
+
+/* Installs a function to be called with the interrupted registers on
+*  every tick, for sampling; 0 removes it */
+void timer_set_sampler(void (*sampler)(registers_t *r))
+{
+    timer_sampler = sampler;
 }
 
 /* Sets up the system clock by installing the timer handler into IRQ0 */
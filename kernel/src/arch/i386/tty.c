@@ -111,6 +111,8 @@ void terminal_decrementcursor(position_t *position)
 }
 void terminal_putchar(char c)
 {
+    serial_putchar(c);
+
     switch (c)
     {
         case '\b':  // Backspace
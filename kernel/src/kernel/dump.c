@@ -68,12 +68,12 @@ char **dump(char *addr, int size, int columns)
     const int bytes_per_line = columns * BYTES_PER_BLOCK;
     const int lines = (size / bytes_per_line) + 2;
     const int n = lines * 80;
-    const char **ret = calloc(0, n + (sizeof(char*) * lines));
+    char **ret = calloc(1, n + (sizeof(char*) * lines));
     if (ret == NULL)
         return NULL;
 
     char **ptr = ret;
-    char *out = ret + lines + 2;
+    char *out = (char *)(ret + lines + 2);
 
     const int extra_line = ((unsigned int)addr + size) % bytes_per_line == 0 ? 0 : bytes_per_line;
     const char *start = (char *)align((unsigned int)addr, bytes_per_line);
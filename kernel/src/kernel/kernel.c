@@ -6,17 +6,93 @@
 
 #include <kernel/tty.h>
 #include <kernel/system.h>
+#include <kernel/multiboot.h>
 #include <math.h>
 
 #include <stack_machine/repl.h>
 
-void kernel_early(void)
+/* The first multiboot module, if the bootloader was given one, is a Forth
+*  script to run in place of the interactive prompt */
+static multiboot_module_t *script_module(uint32_t magic, multiboot_info_t *mbi)
 {
-    //mmu_install();
+    if (magic != MULTIBOOT_BOOTLOADER_MAGIC || (mbi->flags & MULTIBOOT_INFO_MODS) == 0 || mbi->mods_count == 0)
+        return NULL;
+
+    return (multiboot_module_t *)mbi->mods_addr;
+}
+
+/* The end of the memory the kernel is loaded into, from the memory map if
+*  the bootloader gave one, or else from mem_upper: NULL if neither */
+static char *memory_end(uint32_t magic, multiboot_info_t *mbi)
+{
+    extern char _heap;
+    uint64_t heap = (uint32_t)&_heap;
+
+    if (magic != MULTIBOOT_BOOTLOADER_MAGIC)
+        return NULL;
+
+    if (mbi->flags & MULTIBOOT_INFO_MEM_MAP)
+    {
+        uint32_t addr = mbi->mmap_addr;
+        while (addr < mbi->mmap_addr + mbi->mmap_length)
+        {
+            multiboot_memory_map_t *region = (multiboot_memory_map_t *)addr;
+            if (region->type == MULTIBOOT_MEMORY_AVAILABLE && region->addr <= heap && heap < region->addr + region->len)
+            {
+                // Keep clear of the last page below 4GiB, so that end fits
+                uint64_t end = region->addr + region->len;
+                return (char *)(uint32_t)(end < 0xFFFFF000ull ? end : 0xFFFFF000ull);
+            }
+            addr += region->size + sizeof(region->size);
+        }
+    }
+
+    if (mbi->flags & MULTIBOOT_INFO_MEMORY)
+        return (char *)(0x100000 + mbi->mem_upper * 1024);
+
+    return NULL;
+}
+
+/* The end of the highest memory there is, which is what gets mapped: NULL
+*  to map all 4GiB, if that is where it ends or there is no memory map */
+static char *memory_top(uint32_t magic, multiboot_info_t *mbi)
+{
+    uint64_t top = 0;
+
+    if (magic != MULTIBOOT_BOOTLOADER_MAGIC || (mbi->flags & MULTIBOOT_INFO_MEM_MAP) == 0)
+        return NULL;
+
+    uint32_t addr = mbi->mmap_addr;
+    while (addr < mbi->mmap_addr + mbi->mmap_length)
+    {
+        multiboot_memory_map_t *region = (multiboot_memory_map_t *)addr;
+        if (region->type == MULTIBOOT_MEMORY_AVAILABLE && region->addr + region->len > top)
+            top = region->addr + region->len;
+        addr += region->size + sizeof(region->size);
+    }
+
+    return top == 0 || top > 0xFFFFF000ull ? NULL : (char *)(uint32_t)top;
+}
+
+void kernel_early(uint32_t magic, multiboot_info_t *mbi)
+{
+    extern char stack_guard;
+
+    char *end = memory_end(magic, mbi);
+    if (end != NULL)
+        sbrk_limit(end);
+
+    multiboot_module_t *module = script_module(magic, mbi);
+    if (module != NULL)
+        sbrk_reserve((char *)module->mod_end);
+
+    serial_install();
     terminal_initialize();
     gdt_install();
     idt_install();
     isrs_install();
+    mmu_install(memory_top(magic, mbi));
+    mmu_guard(&stack_guard);
     irq_install();
     __asm__ __volatile__ ("sti");
     timer_install();
@@ -24,8 +100,21 @@ void kernel_early(void)
     draw_logo();
 }
 
-void kernel_main(void)
+void kernel_main(uint32_t magic, multiboot_info_t *mbi)
 {
+    multiboot_module_t *module = script_module(magic, mbi);
+    if (module != NULL)
+    {
+        int size = module->mod_end - module->mod_start;
+        char *script = malloc(size + 1);
+        assert(script != NULL);
+        memcpy(script, (char *)module->mod_start, size);
+        script[size] = '\0';
+
+        char *name = module->string != 0 ? (char *)module->string : "script";
+        shutdown(run_script(name, script));
+    }
+
     repl();
 /*    char *buf = malloc(200);
     printf("string allocation = 0x%x\n", (unsigned int)buf);
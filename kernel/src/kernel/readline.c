@@ -228,8 +228,8 @@ char *readline(char *buf, uint16_t sz, char **history, complete_t *completer, co
     memset(buf, 0, sz);
 
     char *yank[2];
-    yank[0] = calloc(0, sz);
-    yank[1] = calloc(0, sz);
+    yank[0] = calloc(1, sz);
+    yank[1] = calloc(1, sz);
 
     uint16_t index = 0;
     uint16_t completion_state = 0;
@@ -0,0 +1,21 @@
+#ifndef _SETJMP_H
+#define _SETJMP_H 1
+
+#include <sys/cdefs.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The registers a function must keep for its caller: ebx, esi, edi and
+*  ebp, then esp and the return address */
+typedef unsigned int jmp_buf[6];
+
+extern int setjmp(jmp_buf env) __attribute__((returns_twice));
+extern void longjmp(jmp_buf env, int val) __attribute__((noreturn));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
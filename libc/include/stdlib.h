@@ -30,8 +30,59 @@ extern int atoi(char *str, int base);
 extern void* malloc(unsigned nbytes);
 extern void* calloc(unsigned n, unsigned size);
 extern void free(void *ap );
+extern void* malloc_from(unsigned nbytes, void *site);
+extern void* valloc(unsigned nbytes);
 extern void qsort(void *base, unsigned num, unsigned width, int (*comp)(const void *, const void *));
 
+/**
+ * The allocator's counters. Bytes are counted by the size of the blocks
+ * handed out, which is at least what was asked for.
+ */
+typedef struct {
+    unsigned int allocs;            // successful calls to malloc or calloc
+    unsigned int frees;             // calls to free, other than with NULL
+    unsigned int live;              // bytes handed out and not yet freed
+    unsigned int peak;              // the most ever live
+    unsigned int heap;              // bytes taken from sbrk
+    unsigned int free_runs;         // length of the free list, in runs of pages
+    unsigned int largest_free;      // bytes in the longest free run
+    unsigned int untraced;          // allocations the trace had no room for
+} heap_stats_t;
+
+/**
+ * While tracing, each allocation is recorded with its call site: the
+ * return address of malloc or calloc, or of strdup and the like, which
+ * allocate through malloc_from.
+ */
+typedef struct {
+    void *site;                     // NULL once all the sites are taken
+    unsigned int allocs;            // since tracing started
+    unsigned int live;              // blocks not yet freed
+    unsigned int live_bytes;
+} heap_site_t;
+
+#define HEAP_TRACE_SLOTS 2048       // live blocks traced, a power of 2
+#define HEAP_TRACE_SITES 64
+
+extern void heap_stats(heap_stats_t *stats);
+
+/**
+ * Starting a trace forgets the last one. Stopping records no more
+ * allocations, but still notices frees of those it has.
+ */
+extern void heap_trace(int on);
+
+/**
+ * Starts a new epoch of allocations, returning its number.
+ */
+extern unsigned int heap_mark(void);
+
+/**
+ * Copies up to n of the sites traced into sites, returning how many. live
+ * and live_bytes only count blocks allocated in epoch since or later.
+ */
+extern int heap_sites(heap_site_t *sites, int n, unsigned int since);
+
 #define min(a,b) (a < b ? a : b)
 #define max(a,b) (a > b ? a : b)
 
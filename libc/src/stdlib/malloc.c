@@ -1,99 +1,490 @@
 #include <stdlib.h>
 #include <string.h>
-//#include <kernel/system.h>
 
-typedef long Align;             /* for alignment to long boundary */
+extern char *sbrk(unsigned bytes);
 
-union header {                  /* block header */
-    struct {
-        union header *ptr;      /* next block if on free list */
-        unsigned size;          /* size of this block */
-    } s;
-    Align x;                    /* force alignment of blocks */
-};
+/*
+ * The heap is a contiguous run of pages taken from sbrk, and is carved
+ * into runs of whole pages, each of which starts with a run_t header:
+ *
+ *  - a slab: one page of objects of a single size class, for requests of
+ *    up to SMALL_MAX bytes;
+ *  - a large block: as many pages as the request needs, header included;
+ *  - a free run, kept in a bin by its length, and whose last word points
+ *    back at its header so that the run after it can coalesce with it.
+ *
+ * Every block malloc hands out lies in the first page of its run, so free
+ * finds the header by rounding the pointer down to the page: malloc and
+ * free are O(1) for small objects, and for large ones bounded by NBINS
+ * unless the request is bigger than any binned run. valloc's blocks start
+ * on the page after their header, and are the only ones that start on a
+ * page.
+ *
+ * malloc is sbrk's only caller, so the pages it gets are contiguous.
+ *
+ * The counters heap_stats reports are kept all the time. While tracing,
+ * each block allocated is also recorded with its call site in an open
+ * addressed table keyed by address, which free removes it from.
+ */
 
-typedef union header Header;
+#define PAGE 4096
+#define SMALL_MAX 256
+#define NBINS 32                    // bins[n] holds free runs of n pages, bins[0] any longer
 
-static Header base;             /* empty list to get started */
-static Header *freep = NULL;    /* start of free list */
+#define RUN_LARGE 0xfe
+#define RUN_FREE 0xff
 
+typedef struct run {
+    unsigned short kind;            // size class, RUN_LARGE or RUN_FREE
+    unsigned short prev_free;       // the run before this one is free
+    unsigned int npages;
+    struct run *next;               // in its bin, or the partial slabs of its class
+    struct run *prev;
+    void *free;                     // slab: freed objects
+    char *bump;                     // slab: first object never handed out
+    unsigned int used;              // slab: objects handed out
+    unsigned int pad;
+} run_t;
 
-#define NALLOC 4096             /* minimum #units to request */
+static const unsigned short sizes[] = { 4, 8, 16, 24, 32, 48, 64, 96, 128, 192, 256 };
+#define NCLASSES (sizeof(sizes) / sizeof(sizes[0]))
 
-/* morecore: ask system for more memory */
-static Header *morecore(unsigned nu)
+static unsigned char class_of[SMALL_MAX / 4 + 1];   // by request size in words
+static run_t *partial[NCLASSES];    // slabs with an object to hand out
+static run_t *bins[NBINS];
+
+static char *heap_hi;
+static int tail_free;               // prev_free of the run sbrk would add next
+
+static heap_stats_t stats;
+
+typedef struct {
+    void *p;
+    unsigned int size;
+    unsigned int site;              // index into sites
+    unsigned int epoch;
+} traced_t;
+
+static traced_t traced[HEAP_TRACE_SLOTS];
+static heap_site_t sites[HEAP_TRACE_SITES];    // the last for any others
+static unsigned int num_traced, num_sites, epoch;
+static int tracing;
+
+static void push(run_t **list, run_t *r)
+{
+    r->prev = NULL;
+    r->next = *list;
+    if (*list != NULL)
+        (*list)->prev = r;
+    *list = r;
+}
+
+static void unlink(run_t **list, run_t *r)
+{
+    if (r->prev != NULL)
+        r->prev->next = r->next;
+    else
+        *list = r->next;
+    if (r->next != NULL)
+        r->next->prev = r->prev;
+}
+
+static run_t **bin_of(unsigned int npages)
+{
+    return &bins[npages < NBINS ? npages : 0];
+}
+
+static void bin(run_t *r)
+{
+    push(bin_of(r->npages), r);
+    stats.free_runs++;
+}
+
+static void unbin(run_t *r)
+{
+    unlink(bin_of(r->npages), r);
+    stats.free_runs--;
+}
+
+static void set_prev_free(run_t *r, int free)
+{
+    char *next = (char *)r + r->npages * PAGE;
+    if (next < heap_hi)
+        ((run_t *)next)->prev_free = free;
+    else
+        tail_free = free;
+}
+
+/* release: returns a run to the free bins, joining it to free neighbours */
+static void release(run_t *r)
+{
+    run_t *next = (run_t *)((char *)r + r->npages * PAGE);
+    if ((char *)next < heap_hi && next->kind == RUN_FREE)
+    {
+        unbin(next);
+        r->npages += next->npages;
+    }
+
+    if (r->prev_free)
+    {
+        run_t *prev = ((run_t **)r)[-1];
+        unbin(prev);
+        prev->npages += r->npages;
+        r = prev;
+    }
+
+    r->kind = RUN_FREE;
+    ((run_t **)((char *)r + r->npages * PAGE))[-1] = r;
+    set_prev_free(r, 1);
+    bin(r);
+}
+
+/* morecore: ask system for at least npages more pages */
+static int morecore(unsigned int npages)
+{
+    if (heap_hi == NULL)
+    {
+        // sbrk hands out 8 byte aligned blocks: pad up to the next page
+        char *cp = sbrk(0);
+        char *lo = (char *)(((unsigned int)cp + PAGE - 1) & ~(PAGE - 1));
+        unsigned int pad = lo - (char *)(((unsigned int)cp + 7) & ~7);
+        if (pad > 0 && sbrk(pad) == (char *)-1)
+            return -1;
+        heap_hi = lo;
+    }
+
+    char *cp = sbrk(npages * PAGE);
+    if (cp == (char *)-1 || cp != heap_hi)
+        return -1;
+
+    run_t *r = (run_t *)cp;
+    r->npages = npages;
+    r->prev_free = tail_free;
+    heap_hi += npages * PAGE;
+    stats.heap += npages * PAGE;
+    release(r);
+    return 0;
+}
+
+/* take: removes a run of npages from the free bins, splitting a longer one */
+static run_t *take(unsigned int npages)
 {
-    char *cp, *sbrk(int);
-    Header *up;
+    run_t *r = NULL;
+    for (unsigned int n = npages; n < NBINS && r == NULL; n++)
+        r = bins[n];
 
-    if (nu < NALLOC)
-        nu = NALLOC;
-    cp = sbrk(nu * sizeof(Header));
-    if (cp == (char *) -1)  /* no space at all */
+    if (r == NULL)
+    {
+        for (r = bins[0]; r != NULL && r->npages < npages; r = r->next)
+            ;
+    }
+
+    if (r == NULL)
+    {
+        if (morecore(npages) != 0)
+            return NULL;
+        return take(npages);
+    }
+
+    unbin(r);
+    if (r->npages > npages)
+    {
+        run_t *rest = (run_t *)((char *)r + npages * PAGE);
+        rest->npages = r->npages - npages;
+        rest->prev_free = 0;
+        r->npages = npages;
+        release(rest);
+    }
+    set_prev_free(r, 0);
+    return r;
+}
+
+static run_t *new_slab(unsigned int c)
+{
+    run_t *s = take(1);
+    if (s == NULL)
         return NULL;
-    up = (Header *) cp;
-    up->s.size = nu;
-    free((void *)(up+1));
-    return freep;
+
+    s->kind = c;
+    s->free = NULL;
+    s->bump = (char *)(s + 1);
+    s->used = 0;
+    push(&partial[c], s);
+    return s;
 }
 
-/* malloc: general-purpose storage allocator */
-void *malloc(unsigned nbytes)
+static int slab_full(run_t *s)
+{
+    return s->free == NULL && s->bump + sizes[s->kind] > (char *)s + PAGE;
+}
+
+static void *malloc_small(unsigned int nbytes)
 {
-    Header *p, *prevp;
-    unsigned nunits;
-
-    nunits = (nbytes+sizeof(Header)-1)/sizeof(Header) + 1;
-    if ((prevp = freep) == NULL) {  /* no free list yet */
-        base.s.ptr = freep = prevp = &base;
-        base.s.size = 0;
-    }
-    for (p = prevp->s.ptr; ; prevp = p, p = p->s.ptr) {
-        if (p->s.size >= nunits) { /* big enough */
-            if (p->s.size == nunits) /* exactly */
-                prevp->s.ptr = p->s.ptr;
-            else {  /* allocate tail end */
-                p->s.size -= nunits;
-                p += p->s.size;
-                p->s.size = nunits;
-            }
-            freep = prevp;
-            return (void *)(p+1);
+    if (class_of[SMALL_MAX / 4] == 0)
+    {
+        for (unsigned int w = 0, c = 0; w <= SMALL_MAX / 4; w++)
+        {
+            while (sizes[c] < w * 4)
+                c++;
+            class_of[w] = c;
         }
-        if (p == freep) /* wrapped around free list */
-            if ((p = morecore(nunits)) == NULL)
-                return NULL;    /* none left */
     }
+
+    unsigned int c = class_of[(nbytes + 3) / 4];
+    run_t *s = partial[c];
+    if (s == NULL && (s = new_slab(c)) == NULL)
+        return NULL;
+
+    void *p = s->free;
+    if (p != NULL)
+    {
+        s->free = *(void **)p;
+    }
+    else
+    {
+        p = s->bump;
+        s->bump += sizes[c];
+    }
+
+    s->used++;
+    if (slab_full(s))
+        unlink(&partial[c], s);
+    return p;
+}
+
+static void *malloc_large(unsigned int nbytes)
+{
+    if (nbytes > (unsigned int)-1 - PAGE - sizeof(run_t))
+        return NULL;
+
+    run_t *r = take((nbytes + sizeof(run_t) + PAGE - 1) / PAGE);
+    if (r == NULL)
+        return NULL;
+
+    r->kind = RUN_LARGE;
+    return r + 1;
+}
+
+static run_t *run_of(void *p)
+{
+    if (((unsigned int)p & (PAGE - 1)) == 0)
+        return (run_t *)((char *)p - PAGE);
+    return (run_t *)((unsigned int)p & ~(PAGE - 1));
+}
+
+static unsigned int block_size(void *p)
+{
+    run_t *r = run_of(p);
+    return r->kind == RUN_LARGE ? r->npages * PAGE - ((char *)p - (char *)r) : sizes[r->kind];
+}
+
+static unsigned int slot_of(void *p)
+{
+    return (((unsigned int)p >> 2) * 2654435761u) & (HEAP_TRACE_SLOTS - 1);
+}
+
+static void trace(void *p, unsigned int size, void *site)
+{
+    // Keep the table sparse enough that probes stay short
+    if (num_traced >= HEAP_TRACE_SLOTS * 3 / 4)
+    {
+        stats.untraced++;
+        return;
+    }
+
+    unsigned int i;
+    for (i = 0; i < num_sites && sites[i].site != site; i++)
+        ;
+    if (i == num_sites)
+    {
+        if (num_sites < HEAP_TRACE_SITES - 1)
+            sites[num_sites++].site = site;
+        else
+            i = HEAP_TRACE_SITES - 1;
+    }
+    sites[i].allocs++;
+
+    unsigned int slot = slot_of(p);
+    while (traced[slot].p != NULL)
+        slot = (slot + 1) & (HEAP_TRACE_SLOTS - 1);
+
+    traced[slot].p = p;
+    traced[slot].size = size;
+    traced[slot].site = i;
+    traced[slot].epoch = epoch;
+    num_traced++;
+}
+
+static void untrace(void *p)
+{
+    unsigned int mask = HEAP_TRACE_SLOTS - 1;
+    unsigned int hole = slot_of(p);
+    while (traced[hole].p != p)
+    {
+        if (traced[hole].p == NULL)
+            return;
+        hole = (hole + 1) & mask;
+    }
+
+    // Shift back the entries after the hole that may sit in it
+    for (unsigned int k = (hole + 1) & mask; traced[k].p != NULL; k = (k + 1) & mask)
+    {
+        if (((k - slot_of(traced[k].p)) & mask) >= ((k - hole) & mask))
+        {
+            traced[hole] = traced[k];
+            hole = k;
+        }
+    }
+    traced[hole].p = NULL;
+    num_traced--;
+}
+
+static void *valloc_pages(unsigned int nbytes)
+{
+    if (nbytes > (unsigned int)-1 - 2 * PAGE)
+        return NULL;
+
+    run_t *r = take(1 + (nbytes + PAGE - 1) / PAGE);
+    if (r == NULL)
+        return NULL;
+
+    r->kind = RUN_LARGE;
+    return (char *)r + PAGE;
+}
+
+static void *allocated(void *p, void *site)
+{
+    if (p != NULL)
+    {
+        unsigned int size = block_size(p);
+        stats.allocs++;
+        stats.live += size;
+        if (stats.live > stats.peak)
+            stats.peak = stats.live;
+        if (tracing)
+            trace(p, size, site);
+    }
+    return p;
+}
+
+void *malloc_from(unsigned nbytes, void *site)
+{
+    return allocated(nbytes <= SMALL_MAX ? malloc_small(nbytes) : malloc_large(nbytes), site);
+}
+
+/* malloc: general-purpose storage allocator */
+void *malloc(unsigned nbytes)
+{
+    return malloc_from(nbytes, __builtin_return_address(0));
+}
+
+/* valloc: a block that starts on a page, at the cost of a page for its header */
+void *valloc(unsigned nbytes)
+{
+    return allocated(valloc_pages(nbytes), __builtin_return_address(0));
 }
 
 void *calloc(unsigned n, unsigned size)
 {
-    void *p = malloc(size);
-    if (p != NULL) {
-        memset(p, n, size);
+    if (size != 0 && n > (unsigned int)-1 / size)
+        return NULL;
+
+    void *p = malloc_from(n * size, __builtin_return_address(0));
+    if (p != NULL)
+    {
+        memset(p, 0, n * size);
     }
     return p;
 }
 
-/* free: put block ap in free list */
+/* free: put block ap back in its slab, or its pages in the bins */
 void free(void *ap)
 {
-    Header *bp, *p;
-
-    bp = (Header *)ap - 1;  /* point to block header */
-    for (p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
-        if (p >= p->s.ptr && (bp > p || bp < p->s.ptr))
-            break; /* freed block at start or end of arena */
-
-    if (bp + bp->s.size == p->s.ptr) {     /* join to upper nbr */
-        bp->s.size += p->s.ptr->s.size;
-        bp->s.ptr = p->s.ptr->s.ptr;
-    } else
-        bp->s.ptr = p->s.ptr;
-    if (p + p->s.size == bp) {    /* join to lower nbr */
-        p->s.size += bp->s.size;
-        p->s.ptr = bp->s.ptr;
-    } else
-        p->s.ptr = bp;
-    freep = p;
+    if (ap == NULL)
+        return;
+
+    stats.frees++;
+    stats.live -= block_size(ap);
+    if (num_traced > 0)
+        untrace(ap);
+
+    run_t *r = run_of(ap);
+    if (r->kind == RUN_LARGE)
+    {
+        release(r);
+        return;
+    }
+
+    unsigned int c = r->kind;
+    if (slab_full(r))
+        push(&partial[c], r);
+
+    *(void **)ap = r->free;
+    r->free = ap;
+    r->used--;
+
+    // Keep one slab per class in hand, so that a malloc/free pair doesn't
+    // take and release a page each time
+    if (r->used == 0 && (partial[c] != r || r->next != NULL))
+    {
+        unlink(&partial[c], r);
+        release(r);
+    }
+}
+
+void heap_stats(heap_stats_t *out)
+{
+    *out = stats;
+    out->largest_free = 0;
+
+    for (run_t *r = bins[0]; r != NULL; r = r->next)
+        out->largest_free = max(out->largest_free, r->npages * PAGE);
+
+    for (unsigned int n = NBINS - 1; n > 0 && out->largest_free == 0; n--)
+    {
+        if (bins[n] != NULL)
+            out->largest_free = n * PAGE;
+    }
+}
+
+void heap_trace(int on)
+{
+    if (on)
+    {
+        memset(traced, 0, sizeof(traced));
+        memset(sites, 0, sizeof(sites));
+        num_traced = num_sites = 0;
+        stats.untraced = 0;
+    }
+    tracing = on;
+}
+
+unsigned int heap_mark(void)
+{
+    return ++epoch;
+}
+
+int heap_sites(heap_site_t *out, int n, unsigned int since)
+{
+    heap_site_t all[HEAP_TRACE_SITES];
+    memcpy(all, sites, sizeof(all));
+    for (int i = 0; i < HEAP_TRACE_SITES; i++)
+        all[i].live = all[i].live_bytes = 0;
+
+    for (int slot = 0; slot < HEAP_TRACE_SLOTS; slot++)
+    {
+        if (traced[slot].p != NULL && traced[slot].epoch >= since)
+        {
+            all[traced[slot].site].live++;
+            all[traced[slot].site].live_bytes += traced[slot].size;
+        }
+    }
+
+    int count = 0;
+    for (int i = 0; i < HEAP_TRACE_SITES && count < n; i++)
+    {
+        if (all[i].allocs > 0)
+            out[count++] = all[i];
+    }
+    return count;
 }
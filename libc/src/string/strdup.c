@@ -5,7 +5,7 @@ char *strdup(const char* str)
 {
     char *p;
     int len = strlen(str) + 1;
-    if ((p = malloc(len)) == NULL)
+    if ((p = malloc_from(len, __builtin_return_address(0))) == NULL)
         return NULL;
 
     memcpy(p, str, len);
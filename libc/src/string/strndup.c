@@ -10,7 +10,7 @@ char *strndup(const char* str, int n)
     if (len > n)
         len = n;
 
-    if ((p = malloc(len + 1)) == NULL)
+    if ((p = malloc_from(len + 1, __builtin_return_address(0))) == NULL)
         return NULL;
 
     memcpy(p, str, len);